@@ -0,0 +1,441 @@
+#include "storage_accelerator/storage_accelerator.h"
+#include "ssd_simulator/ssd_simulator.h"
+#include "monitoring/metrics.h"
+#include "logger/logger.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Performance harness. Drives SSD_Simulator and StorageAccelerator directly,
+// without FUSE, and writes one JSON record per workload so that a run can
+// be compared against a saved baseline.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t FILE_SPAN = 8 * 1024 * 1024;  // Bytes each thread's data file covers
+constexpr size_t FILL_CHUNK = 1024 * 1024;
+
+struct Options {
+    double seconds = 1.0;
+    std::string filter;  // Only workloads whose name contains this
+    std::string output;  // JSON file, stdout when empty
+    int drives = 4;
+    size_t cache_mb = 64;
+    bool write_back = false;
+    size_t stripe_unit = 0;  // 0 keeps one block per drive request
+    std::vector<size_t> sizes = {4096, 64 * 1024, 1024 * 1024};
+    std::vector<size_t> threads = {1, 4, 16};
+};
+
+struct Result {
+    std::string name;
+    size_t size;  // Request size, or file size for rename, 0 for metadata
+    size_t threads;
+    double seconds;
+    uint64_t ops;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+};
+
+// One operation of a workload. Sets result to the bytes moved or a negative
+// errno; returning false ends the calling thread's run early.
+using Operation = std::function<bool(size_t thread, uint64_t iteration, ssize_t& result)>;
+
+class Bench {
+public:
+    explicit Bench(const Options& options) : options_(options) {}
+
+    bool selected(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    // Run op on threads threads until the time is up, timing every call
+    void measure(const std::string& name, size_t size, size_t threads, const Operation& op) {
+        OpStats stats;
+        std::atomic<bool> go{false};
+        std::atomic<size_t> ready{0};
+        Clock::time_point deadline;
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                for (uint64_t i = 0; Clock::now() < deadline; i++) {
+                    ssize_t result = 0;
+                    auto start = Clock::now();
+                    if (!op(t, i, result)) {
+                        break;
+                    }
+                    stats.record(result, Clock::now() - start);
+                }
+            });
+        }
+
+        while (ready.load() < threads) {
+            std::this_thread::yield();
+        }
+        auto start = Clock::now();
+        deadline = start + std::chrono::duration_cast<Clock::duration>(
+                               std::chrono::duration<double>(options_.seconds));
+        go.store(true, std::memory_order_release);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        Result result{name, size, threads, elapsed, stats.ops.load(), stats.errors.load(),
+                      stats.bytes.load(), stats.latency.percentile(0.5),
+                      stats.latency.percentile(0.99), stats.latency.percentile(0.999),
+                      stats.latency.max()};
+        fprintf(stderr, "%-16s size=%-8zu threads=%-3zu %10.1f ops/s %9.2f MB/s  p50 %9.1f us  p99 %9.1f us%s\n",
+                name.c_str(), size, threads, result.ops / elapsed, result.bytes / elapsed / 1e6,
+                result.p50_ns / 1e3, result.p99_ns / 1e3,
+                result.errors ? ("  errors " + std::to_string(result.errors)).c_str() : "");
+        results_.push_back(result);
+    }
+
+    bool write() const {
+        FILE* out = options_.output.empty() ? stdout : fopen(options_.output.c_str(), "w");
+        if (!out) {
+            perror(options_.output.c_str());
+            return false;
+        }
+
+        fprintf(out, "{\"context\":{\"time\":%lld,\"drives\":%d,\"cache_mb\":%zu,"
+                     "\"write_back\":%s,\"seconds\":%g,\"hardware_threads\":%u},\n\"results\":[",
+                static_cast<long long>(time(nullptr)), options_.drives, options_.cache_mb,
+                options_.write_back ? "true" : "false", options_.seconds,
+                std::thread::hardware_concurrency());
+        for (size_t i = 0; i < results_.size(); i++) {
+            const Result& r = results_[i];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"size\":%zu,\"threads\":%zu,\"seconds\":%.6f,"
+                         "\"ops\":%llu,\"errors\":%llu,\"bytes\":%llu,\"ops_per_sec\":%.3f,"
+                         "\"mb_per_sec\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+                         "\"max_us\":%.3f}",
+                    i ? "," : "", r.name.c_str(), r.size, r.threads, r.seconds,
+                    static_cast<unsigned long long>(r.ops), static_cast<unsigned long long>(r.errors),
+                    static_cast<unsigned long long>(r.bytes), r.ops / r.seconds,
+                    r.bytes / r.seconds / 1e6, r.p50_ns / 1e3, r.p99_ns / 1e3, r.p999_ns / 1e3,
+                    r.max_ns / 1e3);
+        }
+        fprintf(out, "\n]}\n");
+
+        return out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+    }
+
+private:
+    const Options& options_;
+    std::vector<Result> results_;
+};
+
+size_t maxThreads(const Options& options) {
+    size_t most = 1;
+    for (size_t threads : options.threads) {
+        most = std::max(most, threads);
+    }
+    return most;
+}
+
+// Aligned offset of a random request of size within a span
+off_t randomOffset(std::mt19937_64& rng, size_t size, size_t span) {
+    size_t slots = span > size ? span / size : 1;
+    return static_cast<off_t>(rng() % slots * size);
+}
+
+std::vector<std::mt19937_64> threadRngs(size_t threads) {
+    std::vector<std::mt19937_64> rngs;
+    for (size_t t = 0; t < threads; t++) {
+        rngs.emplace_back(0x5EED + t);
+    }
+    return rngs;
+}
+
+void runDrive(Bench& bench, const Options& options) {
+    if (!bench.selected("drive_write_seq") && !bench.selected("drive_read_rand")) {
+        return;
+    }
+
+    Logger logger("Benchmark");
+    SSD_Simulator drive(0, &logger);
+    size_t most = maxThreads(options);
+    std::vector<char> fill(FILL_CHUNK, 'd');
+    for (size_t t = 0; t < most; t++) {
+        for (size_t pos = 0; pos < FILE_SPAN; pos += FILL_CHUNK) {
+            drive.writeFile("bench_" + std::to_string(t), fill.data(), fill.size(), pos);
+        }
+    }
+
+    for (size_t size : options.sizes) {
+        std::vector<char> data(size * most, 'w');
+        std::vector<char> buffers(size * most);
+        for (size_t threads : options.threads) {
+            if (bench.selected("drive_write_seq")) {
+                bench.measure("drive_write_seq", size, threads,
+                              [&](size_t t, uint64_t i, ssize_t& result) {
+                    off_t offset = static_cast<off_t>(i * size % FILE_SPAN);
+                    result = drive.writeFile("bench_" + std::to_string(t), data.data() + t * size,
+                                             size, offset);
+                    return true;
+                });
+            }
+            if (bench.selected("drive_read_rand")) {
+                auto rngs = threadRngs(threads);
+                bench.measure("drive_read_rand", size, threads,
+                              [&](size_t t, uint64_t, ssize_t& result) {
+                    result = drive.readFile("bench_" + std::to_string(t), buffers.data() + t * size,
+                                            size, randomOffset(rngs[t], size, FILE_SPAN));
+                    return true;
+                });
+            }
+        }
+    }
+}
+
+std::string dataFile(size_t thread) {
+    return "/data_" + std::to_string(thread);
+}
+
+void fillDataFiles(StorageAccelerator& accelerator, size_t files) {
+    std::vector<char> fill(FILL_CHUNK, 'f');
+    for (size_t t = 0; t < files; t++) {
+        accelerator.createFile(dataFile(t), 0644);
+        for (size_t pos = 0; pos < FILE_SPAN; pos += FILL_CHUNK) {
+            accelerator.writeFile(dataFile(t), fill.data(), fill.size(), pos);
+        }
+    }
+    accelerator.flushAll();
+}
+
+void runFileData(Bench& bench, const Options& options, StorageAccelerator& accelerator) {
+    static const char* const names[] = {"fs_write_seq", "fs_read_seq", "fs_write_rand",
+                                        "fs_read_rand", "mixed"};
+    size_t most = maxThreads(options);
+
+    for (size_t size : options.sizes) {
+        std::vector<char> data(size * most, 'w');
+        std::vector<char> buffers(size * most);
+        for (size_t threads : options.threads) {
+            auto rngs = threadRngs(threads);
+            for (const char* name : names) {
+                if (!bench.selected(name)) {
+                    continue;
+                }
+                std::string workload = name;
+                // Sequential readers keep a stream each, as an open file would
+                std::vector<ReadStream> streams(threads);
+
+                bench.measure(workload, size, threads, [&](size_t t, uint64_t i, ssize_t& result) {
+                    char* buffer = buffers.data() + t * size;
+                    const char* source = data.data() + t * size;
+                    off_t sequential = static_cast<off_t>(i * size % FILE_SPAN);
+                    if (workload == "fs_write_seq") {
+                        result = accelerator.writeFile(dataFile(t), source, size, sequential);
+                    } else if (workload == "fs_read_seq") {
+                        result = accelerator.readFile(dataFile(t), buffer, size, sequential,
+                                                      &streams[t]);
+                    } else if (workload == "fs_write_rand") {
+                        result = accelerator.writeFile(dataFile(t), source, size,
+                                                       randomOffset(rngs[t], size, FILE_SPAN));
+                    } else if (workload == "fs_read_rand") {
+                        result = accelerator.readFile(dataFile(t), buffer, size,
+                                                      randomOffset(rngs[t], size, FILE_SPAN));
+                    } else {
+                        // Reads and writes across all files with some metadata traffic
+                        std::string path = dataFile(rngs[t]() % most);
+                        off_t offset = randomOffset(rngs[t], size, FILE_SPAN);
+                        unsigned dice = rngs[t]() % 100;
+                        if (dice < 60) {
+                            result = accelerator.readFile(path, buffer, size, offset);
+                        } else if (dice < 85) {
+                            result = accelerator.writeFile(path, source, size, offset);
+                        } else if (dice < 95) {
+                            result = accelerator.getMetadata(path) ? 0 : -ENOENT;
+                        } else {
+                            result = accelerator.listDirectory("/").empty() ? -ENOENT : 0;
+                        }
+                    }
+                    return true;
+                });
+            }
+            // Write-back data must not count against the next workload
+            accelerator.flushAll();
+        }
+    }
+}
+
+void runRename(Bench& bench, const Options& options, StorageAccelerator& accelerator) {
+    if (!bench.selected("rename_large")) {
+        return;
+    }
+
+    // Data is placed by inode, so the cost must not grow with the file
+    for (size_t threads : options.threads) {
+        bench.measure("rename_large", FILE_SPAN, threads, [&](size_t t, uint64_t i, ssize_t& result) {
+            std::string from = dataFile(t) + (i % 2 ? ".renamed" : "");
+            std::string to = dataFile(t) + (i % 2 ? "" : ".renamed");
+            result = accelerator.renameFile(from, to, 0);
+            return true;
+        });
+        // Put every file back under its own name
+        for (size_t t = 0; t < threads; t++) {
+            if (accelerator.getMetadata(dataFile(t) + ".renamed")) {
+                accelerator.renameFile(dataFile(t) + ".renamed", dataFile(t), 0);
+            }
+        }
+    }
+}
+
+void runMetadata(Bench& bench, const Options& options, StorageAccelerator& accelerator) {
+    if (!bench.selected("meta_")) {
+        return;
+    }
+
+    for (size_t threads : options.threads) {
+        auto directory = [](size_t t) { return "/meta_" + std::to_string(t); };
+        auto file = [&](size_t t, uint64_t i) { return directory(t) + "/f" + std::to_string(i); };
+        for (size_t t = 0; t < threads; t++) {
+            accelerator.createDirectory(directory(t), 0755);
+        }
+
+        // Each thread owns a directory; later phases replay what it created
+        std::vector<uint64_t> created(threads, 0);
+        bench.measure("meta_create", 0, threads, [&](size_t t, uint64_t i, ssize_t& result) {
+            result = accelerator.createFile(file(t, i), 0644);
+            created[t] = i + 1;
+            return true;
+        });
+        bench.measure("meta_stat", 0, threads, [&](size_t t, uint64_t i, ssize_t& result) {
+            result = accelerator.getMetadata(file(t, i % std::max<uint64_t>(created[t], 1))) ? 0 : -ENOENT;
+            return true;
+        });
+        bench.measure("meta_readdir", 0, threads, [&](size_t t, uint64_t, ssize_t& result) {
+            result = static_cast<ssize_t>(accelerator.listDirectory(directory(t)).size()) > 0 ? 0 : -ENOENT;
+            return true;
+        });
+        bench.measure("meta_unlink", 0, threads, [&](size_t t, uint64_t i, ssize_t& result) {
+            if (i >= created[t]) {
+                return false;
+            }
+            result = accelerator.deleteFile(file(t, i));
+            return true;
+        });
+
+        // Whatever the unlink phase had no time for
+        for (size_t t = 0; t < threads; t++) {
+            for (const auto& name : accelerator.listDirectory(directory(t))) {
+                accelerator.deleteFile(directory(t) + "/" + name);
+            }
+            accelerator.removeDirectory(directory(t));
+        }
+    }
+}
+
+std::vector<size_t> parseList(const char* text) {
+    std::vector<size_t> values;
+    const char* at = text;
+    while (*at) {
+        char* end = nullptr;
+        values.push_back(strtoull(at, &end, 10));
+        if (end == at) {
+            return {};  // Not a number
+        }
+        at = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --seconds S     Measured time per workload (default 1)\n"
+            "  --filter NAME   Run only workloads whose name contains NAME\n"
+            "  --output FILE   Write JSON results to FILE instead of stdout\n"
+            "  --drives N      Drives behind the accelerator (default 4)\n"
+            "  --cache-mb N    Block cache size, 0 disables it (default 64)\n"
+            "  --write-back    Use the write-back cache\n"
+            "  --stripe-unit N Bytes of a file placed on one drive (default one block)\n"
+            "  --sizes LIST    Request sizes in bytes (default 4096,65536,1048576)\n"
+            "  --threads LIST  Thread counts (default 1,4,16)\n"
+            "Workloads: drive_write_seq drive_read_rand fs_write_seq fs_read_seq fs_write_rand\n"
+            "           fs_read_rand mixed rename_large meta_create meta_stat meta_readdir\n"
+            "           meta_unlink\n",
+            program);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--seconds" && has_value) {
+            options.seconds = atof(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            options.output = argv[++i];
+        } else if (arg == "--drives" && has_value) {
+            options.drives = atoi(argv[++i]);
+        } else if (arg == "--cache-mb" && has_value) {
+            options.cache_mb = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--write-back") {
+            options.write_back = true;
+        } else if (arg == "--stripe-unit" && has_value) {
+            options.stripe_unit = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--sizes" && has_value) {
+            options.sizes = parseList(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            options.threads = parseList(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (options.seconds <= 0 || options.drives <= 0 || options.sizes.empty() ||
+        options.threads.empty() ||
+        std::find(options.sizes.begin(), options.sizes.end(), 0) != options.sizes.end() ||
+        std::find(options.threads.begin(), options.threads.end(), 0) != options.threads.end()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Per-operation logging would dominate the numbers
+    Logger::setLevel(ERROR);
+
+    Bench bench(options);
+    runDrive(bench, options);
+    {
+        AcceleratorConfig config;
+        config.num_drives = options.drives;
+        config.hash_seed = "benchmark_seed";
+        config.cache.capacity = options.cache_mb * 1024 * 1024;
+        config.cache.write_back = options.write_back;
+        config.stripe_unit = options.stripe_unit;
+        StorageAccelerator accelerator(config);
+        fillDataFiles(accelerator, maxThreads(options));
+        runFileData(bench, options, accelerator);
+        runRename(bench, options, accelerator);
+        runMetadata(bench, options, accelerator);
+    }
+
+    return bench.write() ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "storage_accelerator/storage_accelerator.h"
+#include "fuse_cache_options.h"
+
+// Accelerator settings as key=value pairs, given as mount options
+// (-o stripe_unit=1M,write_back) or one per line of a config file.
+// Keys are applied in order, so latency_profile comes before the
+// latency overrides it would otherwise reset. A key without a value is
+// a boolean switched on. Sizes take a K, M or G suffix (powers of 1024).
+//
+//   drives, seed                        Drive count and placement seed
+//   block_size, channels, queue_size    Simulated drive geometry
+//   latency_profile                     legacy or nvme
+//   read_latency_us, write_latency_us   Fixed cost per operation
+//   read_bandwidth, write_bandwidth     Bytes per second, 0 is unbounded
+//   queue_depth_penalty_us              Per request already in flight
+//   stripe_unit                         Default unit, a multiple of block_size
+//   load_balancing, redirect_threshold_us
+//   cache_size, write_back
+//   persist_dir, drive_blocks
+//   pool_threads, pin_threads
+//   dedup, dedup_verify, inline_limit
+//
+// Kernel caching of the FUSE front end takes these keys:
+//
+//   attr_timeout, entry_timeout, negative_timeout   Seconds
+//   keep_cache, auto_cache, writeback_cache
+//   max_write, max_read, max_background, congestion_threshold
+
+// 0, -ENOENT for a key that is not a setting (mount options pass those on
+// to FUSE) or -EINVAL for a value out of range; error then says why
+int applyConfigOption(AcceleratorConfig& config, const std::string& key,
+                      const std::string& value, std::string& error);
+// Same contract for the FUSE keys
+int applyFuseOption(FuseCacheOptions& options, const std::string& key,
+                    const std::string& value, std::string& error);
+// "key = value" lines, # starts a comment. Unknown keys are errors here,
+// and so are the FUSE keys without fuse_options to apply them to.
+// 0 or a negative errno, with error naming the file and line.
+int loadConfigFile(AcceleratorConfig& config, const std::string& path, std::string& error,
+                   FuseCacheOptions* fuse_options = nullptr);
+
+// "4096", "64K", "1M"; false if malformed or out of range
+bool parseSize(const std::string& text, uint64_t& out);
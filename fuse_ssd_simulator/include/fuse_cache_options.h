@@ -0,0 +1,16 @@
+#pragma once
+
+// Kernel-side caching. Attributes and dentries are served from the kernel
+// until their timeout, so stat-heavy workloads mostly stay out of user space.
+struct FuseCacheOptions {
+    double attr_timeout = 1.0;
+    double entry_timeout = 1.0;
+    double negative_timeout = 1.0;  // 0 disables negative dentries
+    bool keep_cache = true;         // Keep page cache across opens
+    bool auto_cache = true;         // Kernel drops pages when mtime/size change
+    bool writeback_cache = false;
+    unsigned int max_write = 1024 * 1024;
+    unsigned int max_read = 0;      // 0 leaves the kernel default
+    unsigned int max_background = 64;
+    unsigned int congestion_threshold = 48;
+};
@@ -1,15 +1,23 @@
 #pragma once
 
-#define FUSE_USE_VERSION 31
-#include <fuse3/fuse.h>
+#define FUSE_USE_VERSION 32
+#include <fuse3/fuse_lowlevel.h>
 #include <string>
 #include <memory>
 #include "storage_accelerator/storage_accelerator.h"
 #include "logger/logger.h"
+#include "fuse_cache_options.h"
 
+// Low-level FUSE front end. The kernel addresses everything by inode number,
+// so the hot paths resolve one integer through the metadata inode table
+// instead of walking full paths.
 class FuseInterface {
 public:
-    FuseInterface(const std::string& mount_point, std::shared_ptr<StorageAccelerator> accelerator);
+    FuseInterface(const std::string& mount_point, std::shared_ptr<StorageAccelerator> accelerator,
+                  const FuseCacheOptions& cache_options = FuseCacheOptions());
+    // Mount and serve requests until unmounted. Without -f this forks into
+    // the background, and only the calling thread survives a fork: a
+    // process that already runs threads must daemonize itself first.
     void run(int argc = 0, char* argv[] = nullptr);
     void cleanup();  // New method
 
@@ -18,20 +26,39 @@ private:
     std::shared_ptr<StorageAccelerator> accelerator_;
     static StorageAccelerator* static_accelerator_;
     static Logger* static_logger_;
-    
-    // Existing FUSE operations...
-    static int getattr_callback(const char* path, struct stat* stbuf, struct fuse_file_info* fi);
-    static int readdir_callback(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags flags);
-    static int open_callback(const char* path, struct fuse_file_info* fi);
-    static int read_callback(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
-    static int write_callback(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
-    static int create_callback(const char* path, mode_t mode, struct fuse_file_info* fi);
-    static int unlink_callback(const char* path);
-    static int truncate_callback(const char* path, off_t size, struct fuse_file_info* fi);
-    static int mkdir_callback(const char* path, mode_t mode);
-    static int rmdir_callback(const char* path);
-    static int rename_callback(const char* from, const char* to, unsigned int flags);
-    static int chmod_callback(const char* path, mode_t mode, struct fuse_file_info* fi);
-    static int chown_callback(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi);
-    static int utimens_callback(const char* path, const struct timespec ts[2], struct fuse_file_info* fi);
-};
\ No newline at end of file
+    static FuseCacheOptions cache_options_;
+    // The only extended attribute, a decimal byte count
+    static constexpr const char* STRIPE_UNIT_XATTR = "user.stripe_unit";
+
+    static std::string childPath(const std::string& parent, const char* name);
+    static std::string resolve(fuse_req_t req, fuse_ino_t ino);
+    static std::string resolve(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void fillStat(const FileMetadata& metadata, struct stat* stbuf);
+    static void fillEntry(const FileMetadata& metadata, struct fuse_entry_param* entry);
+    static void replyEntry(fuse_req_t req, const std::string& path, bool negative = false);
+
+    // FUSE low-level operations
+    static void init_callback(void* userdata, struct fuse_conn_info* conn);
+    static void lookup_callback(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void forget_callback(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+    static void forget_multi_callback(fuse_req_t req, size_t count, struct fuse_forget_data* forgets);
+    static void getattr_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void setattr_callback(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi);
+    static void readdir_callback(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void open_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void read_callback(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void write_callback(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
+    static void write_buf_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi);
+    static void create_callback(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, struct fuse_file_info* fi);
+    static void unlink_callback(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void mkdir_callback(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode);
+    static void rmdir_callback(fuse_req_t req, fuse_ino_t parent, const char* name);
+    static void rename_callback(fuse_req_t req, fuse_ino_t parent, const char* name,
+                                fuse_ino_t newparent, const char* newname, unsigned int flags);
+    static void flush_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void release_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+    static void fsync_callback(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi);
+    static void setxattr_callback(fuse_req_t req, fuse_ino_t ino, const char* name,
+                                  const char* value, size_t size, int flags);
+    static void getxattr_callback(fuse_req_t req, fuse_ino_t ino, const char* name, size_t size);
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// Consistent hashing with virtual nodes. Each drive owns vnodes points on a
+// 64-bit ring and a key belongs to the first point at or after its hash, so
+// adding or removing a drive only moves the keys next to that drive's points.
+// A ring is a plain value: callers build a new one and publish it.
+class ConsistentHashRing {
+public:
+    static constexpr size_t DEFAULT_VNODES = 128;
+
+    explicit ConsistentHashRing(size_t vnodes_per_drive = DEFAULT_VNODES);
+
+    void addDrive(size_t drive);
+    void removeDrive(size_t drive);
+    bool contains(size_t drive) const;
+
+    // Owner of a key hash; the ring must not be empty
+    size_t locate(uint64_t hash) const;
+
+    bool empty() const { return drives_.empty(); }
+    const std::vector<size_t>& drives() const { return drives_; }
+
+private:
+    size_t vnodes_;
+    std::vector<std::pair<uint64_t, size_t>> points_;  // Sorted by position
+    std::vector<size_t> drives_;                       // Sorted drive ids
+};
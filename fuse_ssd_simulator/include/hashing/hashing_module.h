@@ -2,12 +2,22 @@
 
 #include <string>
 #include <cstdint>
+#include <cstddef>
 
 class HashingModule {
 public:
     HashingModule(const std::string& seed);
     uint64_t hash(const std::string& input) const;
 
+    // Block placement hashing. A file's key is hashed once from its inode
+    // number, which survives renames, then each block is hashed from
+    // (file key, block index) as two integers with XXH3, so no per-block
+    // key string is built.
+    uint64_t fileKey(uint64_t file_id) const;
+    uint64_t hashBlock(uint64_t file_key, uint64_t block_index) const;
+    // Hashes of count consecutive blocks starting at first_block
+    void hashBlocks(uint64_t file_key, uint64_t first_block, size_t count, uint64_t* out) const;
+
 private:
     uint64_t seed_;
 };
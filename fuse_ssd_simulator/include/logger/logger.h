@@ -1,33 +1,49 @@
 #pragma once
 
 #include <string>
-#include <fstream>
-#include <mutex>
-#include <memory>
+#include <atomic>
 
+// Ordered by severity; messages below the minimum level are dropped
 enum LogLevel {
-    INFO,
     DEBUG,
+    INFO,
     ERROR
 };
 
+// Level-checked logging that skips building the message when the level is
+// disabled. logger is a Logger object (dereference pointers at the call site).
+#define LOG_DEBUG(logger, message) \
+    do { if (Logger::enabled(DEBUG)) (logger).debug(message); } while (0)
+#define LOG_INFO(logger, message) \
+    do { if (Logger::enabled(INFO)) (logger).info(message); } while (0)
+#define LOG_ERROR(logger, message) \
+    do { if (Logger::enabled(ERROR)) (logger).error(message); } while (0)
+
+// Messages go into a per-thread lock-free ring and a background writer
+// formats them and writes whole batches to the console and the log file.
 class Logger {
 public:
     Logger(const std::string& component);
     ~Logger();
 
-    void info(const std::string& message);
-    void debug(const std::string& message);
-    void error(const std::string& message);
+    void info(std::string message);
+    void debug(std::string message);
+    void error(std::string message);
 
     static void init(const std::string& log_file);
-    
+
+    // Runtime minimum level, checked before any formatting
+    static void setLevel(LogLevel level);
+    static bool enabled(LogLevel level) {
+        return level >= min_level_.load(std::memory_order_relaxed);
+    }
+
+    // Block until everything logged so far has been written out
+    static void flush();
+
 private:
     std::string component_;
-    std::ofstream log_stream_;
-    std::mutex log_mutex_;
-    static std::unique_ptr<std::ofstream> global_log_stream_;
-    static std::mutex global_log_mutex_;
+    static std::atomic<int> min_level_;
 
-    void log(LogLevel level, const std::string& message);
+    void log(LogLevel level, std::string&& message);
 };
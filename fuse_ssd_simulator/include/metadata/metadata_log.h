@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "../storage_accelerator/file_metadata.h"
+
+// Durable metadata for MetadataManager: a write-ahead log of namespace and
+// attribute changes plus a checkpoint table. Each record goes out in one
+// write(), so a process crash keeps every change that returned. Records
+// carry a sequence number and a checksum; replay stops at a torn tail
+// left by a power loss and cuts it off.
+// The checkpoint uses the same record format. It holds the namespace as
+// creates in parent-first order, so a restart loads it and then replays
+// only the log records that are newer.
+class MetadataLog {
+public:
+    enum class RecordType : uint8_t {
+        CREATE = 1,
+        UNLINK,
+        RENAME,
+        ATTRIBUTES,  // Every field of an existing inode, inline contents included
+        NEXT_INO,
+    };
+
+    struct Record {
+        RecordType type = RecordType::CREATE;
+        std::string path;
+        std::string new_path;    // RENAME
+        uint32_t flags = 0;      // RENAME
+        bool directory = false;  // UNLINK
+        FileMetadata metadata;   // CREATE, ATTRIBUTES
+        uint64_t next_ino = 0;   // NEXT_INO
+    };
+
+    using Apply = std::function<void(const Record&)>;
+
+    // Log size at which a checkpoint becomes due
+    static constexpr size_t CHECKPOINT_BYTES = 64 * 1024 * 1024;
+
+    MetadataLog() = default;
+    ~MetadataLog();
+
+    MetadataLog(const MetadataLog&) = delete;
+    MetadataLog& operator=(const MetadataLog&) = delete;
+
+    // Open or create the log files in directory, passing each record of the
+    // checkpoint and then of the log tail to apply. 0 or a negative errno.
+    int open(const std::string& directory, const Apply& apply);
+
+    int append(const Record& record);
+    // ATTRIBUTES of the entry as it is now. The fields are read under the
+    // log's lock, so an inode's last record always holds its latest state.
+    int appendAttributes(const FileMetadata& metadata);
+
+    // Write the records table produces as the new checkpoint and empty the
+    // log. The caller keeps the namespace still meanwhile; table runs under
+    // the log's lock, so it must not take locks held around append.
+    int checkpoint(const std::function<void(const Apply& emit)>& table);
+    bool checkpointDue() const { return log_bytes_.load(std::memory_order_relaxed) >= CHECKPOINT_BYTES; }
+    int sync();
+
+private:
+    std::mutex mutex_;
+    std::string directory_;
+    int fd_ = -1;
+    uint64_t sequence_ = 0;  // Of the last record written
+    std::atomic<size_t> log_bytes_{0};
+
+    int appendLocked(const Record& record);
+    static void encode(const Record& record, uint64_t sequence, std::string& out);
+    // Parse the record at data; false if it is incomplete or corrupt
+    static bool decode(const char* data, size_t size, size_t& used, uint64_t& sequence,
+                       Record& record);
+};
@@ -1,25 +1,142 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
 #include <string>
 #include <vector>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include "../storage_accelerator/file_metadata.h"
+#include "metadata_log.h"
 
+struct DirectoryEntry {
+    std::string name;
+    std::shared_ptr<FileMetadata> metadata;
+};
+
+// Metadata is sharded by path hash. Each shard holds the entries whose path
+// hashes to it plus the child index of those paths that are directories,
+// so operations on unrelated files never share a lock. Compound namespace
+// changes (create, unlink, rename) are atomic here rather than in callers.
+// getMetadata returns the stored entry, which keeps its address across
+// renames; attribute updates go straight to its atomic fields.
 class MetadataManager {
 public:
+    static constexpr uint64_t ROOT_INO = 1;  // Matches FUSE_ROOT_ID
+    static constexpr size_t NUM_SHARDS = 64;
+
     MetadataManager();
     ~MetadataManager();
 
+    // Keep the namespace in directory: load what is there and log every
+    // create, unlink and rename from then on. Call on a fresh manager.
+    int open(const std::string& directory);
+    bool persistent() const { return log_ != nullptr; }
+    // Attributes are updated in place, so their owner logs them after a change
+    int logAttributes(const FileMetadata& metadata);
+    bool checkpointDue() const { return log_ && log_->checkpointDue(); }
+    int checkpoint();
+    int sync();
+
+    // A metadata entry without an inode number gets a fresh one; an entry
+    // that already has one (rename) keeps it and is re-pointed at path.
+    // Not logged, for building a namespace directly.
     void addMetadata(const std::string& path, const FileMetadata& metadata);
     void removeMetadata(const std::string& path);
     std::shared_ptr<FileMetadata> getMetadata(const std::string& path);
     bool exists(const std::string& path);
     std::vector<std::string> listDirectory(const std::string& path);
+    // Children with their entries, found by inode number rather than by
+    // building each child's path
+    std::vector<DirectoryEntry> listEntries(const std::string& path);
+    bool hasChildren(const std::string& path);
+
+    // Atomic namespace operations, returning 0 or a negative errno.
+    // createMetadata fails with -EEXIST or when the parent is not a directory;
+    // unlinkMetadata checks the entry type and, for directories, emptiness.
+    // An unlinked inode the kernel still looks up or holds open keeps its
+    // entry, without a path and with nlink 0, until the last forget or
+    // releaseHandle; removed and replaced are only set for an inode that
+    // nothing refers to any more, whose data can go.
+    int createMetadata(const std::string& path, const FileMetadata& metadata);
+    int unlinkMetadata(const std::string& path, bool directory,
+                       std::shared_ptr<FileMetadata>* removed = nullptr);
 
-    std::mutex mutex_;
+    // path followed by everything below it, parents before children
+    std::vector<std::string> listSubtree(const std::string& path);
+    // Move path and its whole subtree to new_path, keeping inode numbers.
+    // An existing new_path is replaced as rename(2) would, unless flags has
+    // RENAME_NOREPLACE; RENAME_EXCHANGE swaps the two instead. The entry a
+    // replace unlinked is handed back through replaced.
+    int renameMetadata(const std::string& path, const std::string& new_path,
+                       unsigned int flags = 0, std::shared_ptr<FileMetadata>* replaced = nullptr);
+
+    // Inode table; an empty path means the inode is unknown or unlinked
+    std::string getPath(uint64_t ino);
+    // The inode's entry, also while it is unlinked but still referenced
+    std::shared_ptr<FileMetadata> getMetadata(uint64_t ino);
+    void lookup(uint64_t ino);
+    uint64_t lookupCount(uint64_t ino);
+    // Open file handles, counted like kernel references
+    void openHandle(uint64_t ino);
+    // forget and releaseHandle return the entry of an unlinked inode when
+    // they drop its last reference, nullptr otherwise
+    std::shared_ptr<FileMetadata> forget(uint64_t ino, uint64_t nlookup);
+    std::shared_ptr<FileMetadata> releaseHandle(uint64_t ino);
+
+    static std::string parentOf(const std::string& path);
 
 private:
-    std::unordered_map<std::string, FileMetadata> metadata_map_;
-};
\ No newline at end of file
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<FileMetadata>> entries;
+        // Directory path -> child name -> inode number, kept in step with
+        // entries. Ordered so readdir offsets stay stable between calls.
+        std::unordered_map<std::string, std::map<std::string, uint64_t>> children;
+    };
+
+    struct Inode {
+        std::string path;
+        std::shared_ptr<FileMetadata> entry;
+    };
+
+    struct InodeShard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Inode> entries;
+        std::unordered_map<uint64_t, uint64_t> lookups;  // Kernel references
+        std::unordered_map<uint64_t, uint64_t> handles;  // Open files
+    };
+
+    Shard shards_[NUM_SHARDS];
+    InodeShard inode_shards_[NUM_SHARDS];
+    std::atomic<uint64_t> next_ino_{ROOT_INO + 1};
+
+    // Creates and unlinks share it, renames take it exclusively so that a
+    // subtree cannot change underneath them. Plain reads never touch it.
+    std::shared_mutex namespace_mutex_;
+
+    // Appended under the locks of the change it records, before applying it
+    std::unique_ptr<MetadataLog> log_;
+    void replay(const MetadataLog::Record& record);
+
+    Shard& shardFor(const std::string& path);
+    InodeShard& inodeShardFor(uint64_t ino);
+    static void lockShards(Shard& a, Shard& b,
+                           std::unique_lock<std::shared_mutex>& lock_a,
+                           std::unique_lock<std::shared_mutex>& lock_b);
+
+    // Callers hold the shard locks of path and of its parent. eraseLocked
+    // is true if the inode went with the name (see unlinkInode).
+    void insertLocked(const std::string& path, std::shared_ptr<FileMetadata> entry);
+    bool eraseLocked(const std::string& path);
+    // ino lost the name path: dropped from the table (true) unless still
+    // referenced, then kept without a path. False as well if ino has since
+    // moved to another path.
+    bool unlinkInode(uint64_t ino, const std::string& path);
+    // Drop an unlinked inode nothing refers to; caller holds its shard lock
+    std::shared_ptr<FileMetadata> reapLocked(InodeShard& inodes, uint64_t ino);
+
+    static std::string nameOf(const std::string& path);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+// Log-linear histogram in the style of HdrHistogram: every power of two is
+// split into 2^SUB_BUCKET_BITS equal buckets, so any recorded value is off
+// by at most 1/8 of itself. Recording is a couple of relaxed atomic adds.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    // Upper edge of the bucket holding the q-th quantile, 0 when empty
+    uint64_t percentile(double q) const;
+
+private:
+    std::atomic<uint64_t> buckets_[NUM_BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+
+    static size_t bucketFor(uint64_t value);
+    static uint64_t bucketUpper(size_t bucket);
+};
+
+// Counters and latency of one kind of operation
+struct OpStats {
+    std::atomic<uint64_t> ops{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> bytes{0};
+    LatencyHistogram latency;  // Nanoseconds
+
+    void record(ssize_t result, std::chrono::nanoseconds duration);
+};
+
+// Builds Prometheus text exposition format
+class PrometheusWriter {
+public:
+    void family(const std::string& name, const char* type, const std::string& help);
+    void sample(const std::string& name, const std::string& labels, double value);
+    // Summary with p50/p99/p999, _sum and _count, latency scaled to seconds
+    void summary(const std::string& name, const std::string& labels,
+                 const LatencyHistogram& latency);
+
+    const std::string& str() const { return out_; }
+
+private:
+    std::string out_;
+};
@@ -1,19 +1,48 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 #include "../storage_accelerator/storage_accelerator.h"
 #include "../logger/logger.h"
+#include "metrics.h"
 
+// Periodically exports the accelerator's metrics in Prometheus text format
+// to metrics_file (for a node_exporter textfile collector or a scraper
+// reading it directly) and logs throughput and tail latency.
 class Monitor {
 public:
-    Monitor(std::shared_ptr<StorageAccelerator> accelerator, Logger* logger);
+    Monitor(std::shared_ptr<StorageAccelerator> accelerator, Logger* logger,
+            const std::string& metrics_file = "",
+            std::chrono::milliseconds interval = std::chrono::seconds(5));
+    ~Monitor();
+
     void start();
     void stop();
 
+    std::string render();
+    // Replaces metrics_file atomically, so readers never see a partial file
+    bool writeMetrics();
+
 private:
     std::shared_ptr<StorageAccelerator> accelerator_;
     Logger* logger_;
-    bool running_;
+    std::string metrics_file_;
+    std::chrono::milliseconds interval_;
+
+    std::atomic<bool> running_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
     std::thread monitor_thread_;
 
+    // Previous sample, for per-interval rates
+    uint64_t last_read_bytes_ = 0;
+    uint64_t last_write_bytes_ = 0;
+    std::chrono::steady_clock::time_point last_sample_;
+
     void monitorLoop();
+    void logSummary();
 };
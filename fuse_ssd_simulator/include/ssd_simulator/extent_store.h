@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <sys/types.h>
+#include "slot_file.h"
+
+// Fixed-size slab allocator; slabs are recycled through a free list
+class BlockPool {
+public:
+    BlockPool(size_t block_size, size_t blocks_per_chunk = 256);
+
+    char* allocate();
+    void release(char* block);
+    size_t blocksInUse() const { return in_use_; }
+
+private:
+    size_t block_size_;
+    size_t blocks_per_chunk_;
+    size_t in_use_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::vector<char*> free_list_;
+};
+
+// Per-drive block map: (file, block index) -> slab. Only blocks that were
+// actually written take memory; unwritten blocks below the end of a file
+// read back as zeroes. Not thread-safe, the owning drive serializes access.
+// With a SlotFile the blocks live in its mapping instead of the pool, and
+// the map is rebuilt from the file's slot headers. A file's size is then
+// restored as the end of its last written byte, so the size of a file
+// extended by truncate alone does not survive a reopen.
+class ExtentStore {
+public:
+    explicit ExtentStore(size_t block_size);
+    ExtentStore(size_t block_size, std::unique_ptr<SlotFile> slots);
+    ~ExtentStore();
+
+    bool exists(const std::string& file) const;
+    ssize_t read(const std::string& file, char* buffer, size_t size, off_t offset) const;
+    ssize_t write(const std::string& file, const char* buffer, size_t size, off_t offset);
+    int truncate(const std::string& file, off_t size);
+    // Free every block of the file and forget it
+    int remove(const std::string& file);
+    // Free the whole blocks inside [offset, offset + size), like a TRIM.
+    // A file left without blocks is forgotten.
+    int discard(const std::string& file, off_t offset, size_t size);
+
+    size_t blocksInUse() const { return slots_ ? slots_->blocksInUse() : pool_.blocksInUse(); }
+    bool persistent() const { return slots_ != nullptr; }
+    int sync() { return slots_ ? slots_->sync() : 0; }
+
+    struct StoredBlock {
+        std::string file;
+        uint64_t index;
+    };
+    std::vector<StoredBlock> storedBlocks() const;
+
+private:
+    struct FileExtents {
+        off_t size = 0;
+        std::unordered_map<uint64_t, char*> blocks;
+    };
+
+    size_t block_size_;
+    BlockPool pool_;
+    std::unique_ptr<SlotFile> slots_;
+    std::unordered_map<std::string, FileExtents> files_;
+
+    char* allocateBlock(const std::string& file, uint64_t index);
+    void releaseBlock(char* block);
+    // Record how much of a block lies below the file's end
+    void setLength(char* block, size_t length);
+};
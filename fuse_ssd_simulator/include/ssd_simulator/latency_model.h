@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstddef>
+
+enum class IOType;
+
+// Service-time parameters for one class of operation
+struct OpLatency {
+    std::chrono::nanoseconds base{0};  // Fixed cost (command + flash access)
+    double bytes_per_second = 0.0;     // Transfer rate, 0 means unbounded
+};
+
+struct LatencyProfile {
+    OpLatency read{std::chrono::milliseconds(2)};
+    OpLatency write{std::chrono::milliseconds(3)};
+    OpLatency truncate{std::chrono::milliseconds(2)};
+    OpLatency other{std::chrono::milliseconds(1)};
+
+    // Extra latency for every request already in flight on the channel
+    std::chrono::nanoseconds queue_depth_penalty{0};
+
+    // Tail latency: with tail_probability a request takes tail_multiplier
+    // times longer; jitter_sigma adds log-normal noise to every request
+    double tail_probability = 0.0;
+    double tail_multiplier = 10.0;
+    double jitter_sigma = 0.0;
+
+    // Garbage collection: after gc_interval_bytes of physical writes
+    // (logical bytes times write_amplification) one write stalls for gc_stall
+    uint64_t gc_interval_bytes = 0;
+    std::chrono::nanoseconds gc_stall{0};
+    double write_amplification = 1.0;
+
+    // Fixed 2/3/2/1 ms per operation, the simulator's historical behaviour
+    static LatencyProfile legacy();
+    // Roughly a datacenter NVMe drive split into channels
+    static LatencyProfile nvme();
+};
+
+// Computes per-request service time. One instance per channel, so the
+// model keeps its own RNG and GC accounting without locking.
+class LatencyModel {
+public:
+    LatencyModel(const LatencyProfile& profile, uint64_t seed);
+
+    // Time the request occupies the channel bus (bandwidth term)
+    std::chrono::nanoseconds transferTime(IOType type, size_t size) const;
+    // Latency on top of the transfer: base, queue depth, tail and GC terms
+    std::chrono::nanoseconds accessTime(IOType type, size_t size, size_t queue_depth);
+
+    const LatencyProfile& profile() const { return profile_; }
+
+private:
+    const OpLatency& opLatency(IOType type) const;
+
+    LatencyProfile profile_;
+    std::mt19937_64 rng_;
+    uint64_t bytes_since_gc_;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Fixed-size block slots in a sparse, memory-mapped file, in place of
+// a drive's in-memory slabs. Every slot has a small header naming the file
+// and block it holds, so reopening the file finds the drive's contents by
+// scanning the headers instead of reloading any data. Block data is read
+// and written through the mapping and goes through the page cache like a
+// block device's would. Not thread-safe, the owning drive serializes access.
+class SlotFile {
+public:
+    static constexpr size_t MAX_NAME = 51;
+
+    // Map path, creating it with capacity slots if it does not exist yet.
+    // An existing file keeps the geometry it was created with.
+    // Throws std::runtime_error if the file cannot be opened or mapped.
+    SlotFile(const std::string& path, size_t block_size, size_t capacity);
+    ~SlotFile();
+
+    SlotFile(const SlotFile&) = delete;
+    SlotFile& operator=(const SlotFile&) = delete;
+
+    struct Slot {
+        std::string file;
+        uint64_t index;   // Block index within the file
+        uint32_t length;  // Bytes of the block below the file's end
+        char* data;
+    };
+    // Slots holding data, as found when the file was opened
+    std::vector<Slot> usedSlots() const;
+
+    // Zeroed block for (file, index), nullptr when every slot is taken or
+    // the name does not fit a header
+    char* allocate(const std::string& file, uint64_t index);
+    void release(char* block);
+    void setLength(char* block, uint32_t length);
+    uint32_t length(const char* block) const;
+
+    size_t blocksInUse() const { return capacity_ - free_.size(); }
+    size_t capacity() const { return capacity_; }
+    // Write dirty pages back to the file, for fsync
+    int sync();
+
+private:
+    struct Superblock;
+    struct SlotHeader;
+
+    std::string path_;
+    int fd_ = -1;
+    size_t block_size_;
+    size_t capacity_;
+    size_t mapped_size_ = 0;
+    char* base_ = nullptr;
+    SlotHeader* headers_ = nullptr;
+    char* data_ = nullptr;
+    std::vector<uint32_t> free_;  // Lowest slot last, so it is used first
+
+    size_t slotOf(const char* block) const;
+};
@@ -1,15 +1,21 @@
 #pragma once
 
 #include <string>
-#include <queue>
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include <unordered_map>
 #include <vector>
-#include <future>
+#include <chrono>
+#include <cstdint>
 #include <shared_mutex>
 #include "../logger/logger.h"
+#include "extent_store.h"
+#include "latency_model.h"
+#include "../utils/mpsc_ring.h"
+#include "../monitoring/metrics.h"
+#include "../utils/trace.h"
 
 // Forward declare the class
 class SSD_Simulator;
@@ -25,60 +31,177 @@ enum class IOType {
     RENAME,
     CHMOD,
     CHOWN,
-    UTIMENS
+    UTIMENS,
+    DISCARD   // Free the blocks of a range, for reclaiming migrated copies
 };
 
-struct IOPromise {
-    std::promise<ssize_t> promise;
-    std::chrono::steady_clock::time_point start_time;
-    
-    IOPromise() : start_time(std::chrono::steady_clock::now()) {}
+constexpr size_t NUM_IO_TYPES = static_cast<size_t>(IOType::DISCARD) + 1;
+const char* ioTypeName(IOType type);
+
+// Per-drive statistics, updated by the drive as requests complete
+struct DriveMetrics {
+    OpStats ops[NUM_IO_TYPES];           // Latency from submission to completion
+    std::atomic<int64_t> queue_depth{0};  // Submitted and not yet completed
+
+    OpStats& op(IOType type) { return ops[static_cast<size_t>(type)]; }
+};
+
+struct IOCompletion {
+    uint64_t user_data;
+    ssize_t result;
+    std::chrono::steady_clock::time_point completed;  // When the drive posted it
+};
+
+// Caller-owned completion queue. Drives post one IOCompletion per request
+// and callers reap them in batches. Destruction waits for every request
+// still in flight, so buffers borrowed by those requests stay valid.
+class IOCompletionQueue {
+public:
+    IOCompletionQueue() = default;
+    ~IOCompletionQueue();
+
+    IOCompletionQueue(const IOCompletionQueue&) = delete;
+    IOCompletionQueue& operator=(const IOCompletionQueue&) = delete;
+
+    void reserve(size_t count) { completed_.reserve(count); }
+
+    // Wait until at least min_complete completions are available (or the
+    // timeout expires), then move everything reaped so far into out
+    size_t reap(std::vector<IOCompletion>& out, size_t min_complete,
+                std::chrono::milliseconds timeout);
+    size_t inFlight();
+
+private:
+    friend class SSD_Simulator;
+
+    void submitted(size_t count);
+    void post(uint64_t user_data, ssize_t result);
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<IOCompletion> completed_;
+    size_t in_flight_ = 0;
+    size_t wanted_ = 0;
 };
 
 struct IORequest {
-    IOType type;
+    IOType type = IOType::READ;
     std::string path;
-    char* buffer;
-    size_t size;
-    off_t offset;
-    mode_t mode;
-    uid_t uid;
-    gid_t gid;
-    struct timespec ts[2];
-    std::string new_path; // For rename
-    unsigned int flags;   // For rename
-    std::shared_ptr<IOPromise> promise; // For operation completion
+    char* buffer = nullptr;       // Read destination
+    const char* data = nullptr;   // Write source, borrowed until completion
+    size_t size = 0;
+    off_t offset = 0;
+    mode_t mode = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    struct timespec ts[2] = {};
+    std::string new_path;   // For rename
+    unsigned int flags = 0; // For rename
+    IOCompletionQueue* completion = nullptr; // Receives the result
+    uint64_t user_data = 0;                  // Echoed back in the completion
+    std::chrono::steady_clock::time_point submitted;  // Set by the drive
 };
 
 // Now define the class
 class SSD_Simulator {
 public:
-    SSD_Simulator(int drive_id, Logger* logger);
+    // A backing_file keeps the drive's blocks in that file, which is created
+    // with backing_blocks slots or reopened with its contents. queue_size
+    // bounds the requests waiting on the drive, split across its channels.
+    SSD_Simulator(int drive_id, Logger* logger, size_t num_channels = DEFAULT_CHANNELS,
+                  const LatencyProfile& profile = LatencyProfile(),
+                  const std::string& backing_file = std::string(),
+                  size_t backing_blocks = DEFAULT_BACKING_BLOCKS,
+                  size_t block_size = DEFAULT_BLOCK_SIZE, size_t queue_size = DEFAULT_QUEUE_SIZE);
     ~SSD_Simulator();
 
-    void enqueueIO(const IORequest& request);
+    // Asynchronous submission; each request completes on its own queue
+    void enqueueIO(IORequest request);
+    void enqueueBatch(std::vector<IORequest>& requests);
+
+    // Blocking wrappers over enqueueIO
+    ssize_t submitAndWait(IORequest request);
     ssize_t readFile(const std::string& path, char* buffer, size_t size, off_t offset);
     ssize_t writeFile(const std::string& path, const char* buffer, size_t size, off_t offset);
     void truncate(const std::string& path, off_t size);
 
+    size_t numChannels() const { return channels_.size(); }
+    int driveId() const { return drive_id_; }
+    size_t blockSize() const { return block_size_; }
+    const DriveMetrics& metrics() const { return metrics_; }
+    size_t blocksInUse();
+    // Every block the drive holds, for rebuilding placement after a restart
+    std::vector<ExtentStore::StoredBlock> storedBlocks();
+    int sync();  // Backing file to disk, for fsync
+    // Keep every channel worker on cpus, e.g. the drive's NUMA node.
+    // 0 or the first negative errno.
+    int pinWorkers(const std::vector<int>& cpus);
+
     // Constants
-    static constexpr size_t BLOCK_SIZE = 4096;
-    static constexpr size_t MAX_QUEUE_SIZE = 1000;
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 4096;
+    static constexpr size_t DEFAULT_QUEUE_SIZE = 1000;
+    static constexpr size_t DEFAULT_CHANNELS = 8;
+    static constexpr size_t DEFAULT_BACKING_BLOCKS = 262144;  // 1 GiB
+    static constexpr size_t MIN_SPIN_ITERATIONS = 16;
+    static constexpr size_t MAX_SPIN_ITERATIONS = 4096;
+    static constexpr std::chrono::seconds IO_TIMEOUT{5};
+    static constexpr std::chrono::microseconds DEADLINE_SPIN_THRESHOLD{50};
 
 private:
+    // One internal channel (flash die/bus) with its own queue and worker.
+    // The worker spins for a while before parking; producers only touch
+    // the park mutex when the worker is actually asleep.
+    // Requests become due at their deadline instead of sleeping the worker,
+    // so everything admitted to a channel is in service concurrently.
+    struct InFlightIO {
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point admitted;  // Queue wait ends here
+        IORequest request;
+    };
+
+    struct LaterDeadline {
+        bool operator()(const InFlightIO& a, const InFlightIO& b) const {
+            return a.deadline > b.deadline;
+        }
+    };
+
+    struct Channel {
+        Channel(size_t queue_size, const LatencyProfile& profile, uint64_t seed)
+            : queue(queue_size), parked(false), spin_iterations(MIN_SPIN_ITERATIONS),
+              latency(profile, seed) {}
+
+        MpscRing<IORequest> queue;
+        std::thread worker;
+        std::atomic<bool> parked;
+        std::mutex park_mutex;
+        std::condition_variable park_cv;
+        size_t spin_iterations;
+
+        // Worker-only state
+        LatencyModel latency;
+        std::vector<InFlightIO> in_flight;  // Min-heap on deadline
+        std::chrono::steady_clock::time_point bus_free;
+    };
+
     int drive_id_;
+    size_t block_size_;
     Logger* logger_;
-    std::queue<IORequest> io_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable cv_;
-    bool stop_;
-    std::thread worker_thread_;
+    std::atomic<bool> stop_;
+    std::vector<std::unique_ptr<Channel>> channels_;
 
     // Use shared mutex for better read concurrency
     std::shared_mutex storage_mutex_;
-    std::unordered_map<std::string, std::vector<char>> storage_;
+    ExtentStore storage_;
+    DriveMetrics metrics_;
 
-    void processIO();
-    void simulateLatency(IOType type);
-    bool isQueueFull() const { return io_queue_.size() >= MAX_QUEUE_SIZE; }
+    static ExtentStore makeStore(const std::string& backing_file, size_t backing_blocks,
+                                 size_t block_size);
+    void processIO(Channel& channel);
+    void admitIO(Channel& channel, IORequest&& request);
+    void executeIO(IORequest& request);
+    void completeIO(const IORequest& request, ssize_t result);
+    size_t channelFor(const IORequest& request) const;
+    void wakeWorker(Channel& channel);
+    bool waitForWork(Channel& channel, std::chrono::steady_clock::time_point deadline);
+    static void cpuRelax();
 };
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <set>
+#include <cstdint>
+#include <cstddef>
+
+struct BlockCacheOptions {
+    size_t capacity = 64 * 1024 * 1024;  // Bytes of block data, 0 disables the cache
+    bool write_back = false;             // Hold writes until flush, fsync or release
+};
+
+// In-memory cache of file blocks in front of the drives, keyed by
+// (inode, block index) and sharded by that key. Each shard evicts with
+// CLOCK: hits set a slot's reference bit and the hand clears bits until it
+// finds a slot without one. Dirty slots are never evicted, they only turn
+// clean through a flush.
+// A slot may know only part of its block, e.g. after a write-back write to
+// a block that was never read. Reads of the rest miss, and the fill from
+// the drives keeps the bytes the cache already had.
+class BlockCache {
+public:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    BlockCache(size_t block_size, const BlockCacheOptions& options);
+
+    bool enabled() const { return slots_per_shard_ > 0; }
+    bool writeBack() const { return enabled() && write_back_; }
+
+    // Copy [offset, offset + size) of a block to out if all of it is cached
+    bool read(uint64_t file, uint64_t block, size_t offset, size_t size, char* out);
+    // Whole block present, without counting a hit or miss
+    bool cached(uint64_t file, uint64_t block);
+
+    // Taken before a block is read from the drives. fill only caches the
+    // data if no write reached the block's shard, and no invalidate a file
+    // of the file's index shard, in between.
+    uint64_t ticket(uint64_t file, uint64_t block);
+    // data is the whole block as read from the drives. Bytes the cache
+    // holds are newer and are copied over it before it is stored.
+    void fill(uint64_t file, uint64_t block, uint64_t ticket, char* data);
+
+    // Write-through: bring a cached copy in line once the drives have the write
+    void update(uint64_t file, uint64_t block, size_t offset, size_t size, const char* data);
+    // Write-back: keep the write as dirty data. False when no clean slot
+    // can be freed, or the block has dirty bytes these would leave a gap
+    // to; the caller then flushes or writes through.
+    bool write(uint64_t file, uint64_t block, size_t offset, size_t size, const char* data);
+
+    struct DirtyRange {
+        uint64_t block;
+        size_t offset;  // Within the block
+        std::vector<char> data;
+        uint64_t version;
+    };
+    // Copies of a file's dirty ranges in block order, for flushing
+    std::vector<DirtyRange> dirtyRanges(uint64_t file);
+    // The range reached the drives. It turns clean unless written again
+    // since it was copied.
+    void markClean(uint64_t file, const DirtyRange& range);
+    std::vector<uint64_t> dirtyFiles();
+
+    // Drop the file's blocks from first_block on, dirty or not. Fills of
+    // the file ticketed before this are rejected. Visits only the file's
+    // own blocks.
+    void invalidate(uint64_t file, uint64_t first_block = 0);
+
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    uint64_t evictions() const { return evictions_.load(std::memory_order_relaxed); }
+    size_t dirtyBlocks() const { return dirty_blocks_.load(std::memory_order_relaxed); }
+    size_t capacityBlocks() const { return slots_per_shard_ * NUM_SHARDS; }
+
+private:
+    struct Slot {
+        uint64_t file = 0;
+        uint64_t block = 0;
+        bool used = false;
+        bool referenced = false;
+        bool complete = false;     // Holds the whole block
+        uint32_t valid_begin = 0;  // Known bytes of an incomplete block
+        uint32_t valid_end = 0;
+        uint32_t dirty_begin = 0;  // Kept as one range, flushed as one write
+        uint32_t dirty_end = 0;
+        uint64_t version = 0;      // Bumped by every write
+        std::unique_ptr<char[]> data;
+
+        bool dirty() const { return dirty_end > dirty_begin; }
+    };
+
+    struct Key {
+        uint64_t file;
+        uint64_t block;
+        bool operator==(const Key& other) const { return file == other.file && block == other.block; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return mix(key.file, key.block); }
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, size_t, KeyHash> index;
+        std::vector<Slot> slots;
+        size_t hand = 0;
+        uint64_t writes = 0;  // Checked against fill tickets
+    };
+
+    // Dirty blocks per file, so a flush does not scan the whole cache.
+    // Taken after a block shard's mutex, never before.
+    struct DirtyShard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::set<uint64_t>> files;
+    };
+
+    // Cached blocks per file, so invalidate does not scan the whole cache.
+    // Taken after a block shard's mutex, never before, and never two at
+    // once. generation counts invalidations of the shard's files.
+    struct FileShard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::set<uint64_t>> files;
+        uint64_t generation = 0;
+    };
+
+    size_t block_size_;
+    size_t slots_per_shard_;
+    bool write_back_;
+    Shard shards_[NUM_SHARDS];
+    DirtyShard dirty_[NUM_SHARDS];
+    FileShard files_[NUM_SHARDS];
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<size_t> dirty_blocks_{0};
+
+    static size_t mix(uint64_t file, uint64_t block);
+    Shard& shardFor(uint64_t file, uint64_t block);
+    Slot* find(Shard& shard, uint64_t file, uint64_t block);
+    // Free slot or CLOCK victim, nullptr when every slot is dirty
+    Slot* allocate(Shard& shard, uint64_t file, uint64_t block);
+    // Drop a slot from its shard and the file index; caller holds the shard
+    void release(Shard& shard, Slot& slot);
+    void unindex(uint64_t file, uint64_t block);
+    // Grow the known bytes of an incomplete slot; false if that leaves a gap
+    bool extendValid(Slot& slot, size_t begin, size_t end);
+    void setDirty(Slot& slot, size_t begin, size_t end);
+    void clearDirty(Slot& slot);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Records which drive holds each block of each file, keyed by the file's
+// inode number so renames leave it untouched. A block here is one stripe
+// unit of the file, keyed by its start. The first write of a
+// block fixes its drive, whatever the load balancer picked at that moment;
+// later writes and all reads go to the same place. Overwrites must not be
+// balanced elsewhere, or a partial write would leave the rest of the block
+// behind on the old drive.
+class BlockMap {
+public:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    // Drive holding the block, or primary if it was never written
+    size_t locate(uint64_t file, off_t block_start, size_t primary);
+    // Drive holding the block, recording candidate if this is its first write
+    size_t place(uint64_t file, off_t block_start, size_t candidate);
+
+    // Forget blocks at or past size (truncate) or all of them (delete)
+    void truncate(uint64_t file, off_t size);
+    void erase(uint64_t file);
+
+    size_t blockCount(uint64_t file);
+    // Stripe unit of a file, fallback if none was set; erase forgets it
+    void setStripeUnit(uint64_t file, size_t unit);
+    size_t stripeUnit(uint64_t file, size_t fallback);
+    // Every drive holding at least one block of the file, ascending
+    std::vector<size_t> drivesOf(uint64_t file);
+
+    struct Location {
+        uint64_t file;
+        off_t block_start;
+        size_t drive;
+    };
+
+    // Point-in-time copy of every recorded block, for rebalancing
+    std::vector<Location> snapshot();
+    // Move a block's record from one drive to another, if it is still there
+    bool relocate(uint64_t file, off_t block_start, size_t from, size_t to);
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::unordered_map<off_t, size_t>> files;
+        std::unordered_map<uint64_t, size_t> units;
+    };
+
+    Shard shards_[NUM_SHARDS];
+
+    Shard& shardFor(uint64_t file);
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct DedupOptions {
+    bool enabled = false;
+    // Compare bytes before sharing a block whose fingerprint matches. XXH3
+    // is not collision resistant against crafted data, so this stays on
+    // unless every writer is trusted.
+    bool verify = true;
+};
+
+struct Fingerprint {
+    uint64_t high = 0;
+    uint64_t low = 0;
+
+    bool operator==(const Fingerprint& other) const {
+        return high == other.high && low == other.low;
+    }
+};
+
+// A stored block. Every stored block gets a fresh generation, so blocks
+// whose fingerprints collide are told apart and a name is never reused
+// while the delete of an earlier block may still be in flight.
+struct ContentKey {
+    Fingerprint fingerprint;
+    uint64_t generation = 0;
+
+    bool operator==(const ContentKey& other) const {
+        return fingerprint == other.fingerprint && generation == other.generation;
+    }
+};
+
+// Content-addressed block index for deduplication. Every file block points
+// at a stored block, and every stored block counts its references: the
+// file blocks pointing at it plus short-lived pins held by readers,
+// writers checking a match and migrations. Whoever drops the last
+// reference removes the block from the index and deletes it from its
+// drive, so nobody can be reading it then.
+// File pointers are sharded by inode and stored blocks by fingerprint;
+// only acquire holds both, file shard first.
+class DedupIndex {
+public:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    static Fingerprint fingerprint(const char* data, size_t size);
+    // Name of a stored block on its drive
+    static std::string objectName(const ContentKey& key);
+
+    struct Stored {
+        ContentKey key;
+        size_t drive;
+    };
+
+    // Pin the block a file block points at; false for a hole
+    bool acquire(uint64_t file, uint64_t block, Stored& out);
+    // Pin every published block with this fingerprint, for the caller to verify
+    std::vector<Stored> candidates(const Fingerprint& fingerprint);
+    // Pin a block by key, false if it is gone
+    bool pin(const ContentKey& key, size_t& drive);
+    // Drop a reference. True if it was the last one; drive then says where
+    // the caller has to delete the block.
+    bool release(const ContentKey& key, size_t& drive);
+
+    // Register a block about to be written, with one reference for the
+    // writer. It is no candidate for sharing until published.
+    ContentKey create(const Fingerprint& fingerprint, size_t drive);
+    void publish(const ContentKey& key);
+
+    // Point a file block at key, handing over one of the caller's
+    // references. Returns false for a block that was a hole, otherwise
+    // previous holds the reference now owed a release.
+    bool assign(uint64_t file, uint64_t block, const ContentKey& key, ContentKey& previous);
+    // Make a file block a hole, same contract for previous
+    bool clear(uint64_t file, uint64_t block, ContentKey& previous);
+    // Drop pointers at or past first_block, or all of them; each returned
+    // reference is owed a release
+    std::vector<ContentKey> truncate(uint64_t file, uint64_t first_block);
+    std::vector<ContentKey> erase(uint64_t file);
+    size_t blockCount(uint64_t file);
+
+    // Current drive of a pinned block
+    size_t driveOf(const ContentKey& key);
+    bool relocate(const ContentKey& key, size_t from, size_t to);
+    // Every published block, for rebalancing
+    std::vector<Stored> snapshot();
+
+    size_t uniqueBlocks() const { return unique_blocks_.load(std::memory_order_relaxed); }
+    size_t referencedBlocks() const { return referenced_blocks_.load(std::memory_order_relaxed); }
+
+private:
+    struct FingerprintHash {
+        size_t operator()(const Fingerprint& fingerprint) const { return fingerprint.low; }
+    };
+
+    struct Entry {
+        uint64_t generation;
+        size_t drive;
+        uint64_t references;
+        bool published;
+    };
+
+    struct ContentShard {
+        std::mutex mutex;
+        // Almost always one entry per fingerprint
+        std::unordered_map<Fingerprint, std::vector<Entry>, FingerprintHash> entries;
+    };
+
+    struct FileShard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::unordered_map<uint64_t, ContentKey>> files;
+    };
+
+    ContentShard content_shards_[NUM_SHARDS];
+    FileShard file_shards_[NUM_SHARDS];
+    std::atomic<uint64_t> next_generation_{0};
+    std::atomic<size_t> unique_blocks_{0};
+    std::atomic<size_t> referenced_blocks_{0};
+
+    ContentShard& contentShardFor(const Fingerprint& fingerprint);
+    FileShard& fileShardFor(uint64_t file);
+    // Entry of key in a locked shard, or nullptr
+    static Entry* find(ContentShard& shard, const ContentKey& key);
+};
@@ -2,15 +2,55 @@
 
 #include <sys/types.h>
 #include <ctime>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
 
+// The metadata store hands out the stored entry itself, so fields are
+// atomics that readers load and writers update in place without a lock.
+// Fields are independent; a reader may see one field updated before another.
 struct FileMetadata {
-    mode_t mode;
-    nlink_t nlink;
-    uid_t uid;
-    gid_t gid;
-    off_t size;
-    time_t atime;
-    time_t mtime;
-    time_t ctime;
-    // Additional metadata as needed
+    uint64_t ino = 0;  // Assigned by MetadataManager, stable across renames
+    std::atomic<mode_t> mode{0};
+    std::atomic<nlink_t> nlink{0};
+    std::atomic<uid_t> uid{0};
+    std::atomic<gid_t> gid{0};
+    std::atomic<off_t> size{0};
+    std::atomic<time_t> atime{0};
+    std::atomic<time_t> mtime{0};
+    std::atomic<time_t> ctime{0};
+    // Bytes of a file placed together on one drive, fixed before its first
+    // write. A directory's is inherited by new entries, 0 for the default.
+    std::atomic<uint64_t> stripe_unit{0};
+    // Contents of a small file kept with its metadata instead of on the
+    // drives, null for every other file. Replaced whole through
+    // std::atomic_load and std::atomic_store, so readers take no lock.
+    std::shared_ptr<const std::string> inline_data;
+
+    FileMetadata() = default;
+    FileMetadata(const FileMetadata& other) { *this = other; }
+
+    FileMetadata& operator=(const FileMetadata& other) {
+        ino = other.ino;
+        mode.store(other.mode.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        nlink.store(other.nlink.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        uid.store(other.uid.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        gid.store(other.gid.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        size.store(other.size.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        atime.store(other.atime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mtime.store(other.mtime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        ctime.store(other.ctime.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        stripe_unit.store(other.stripe_unit.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_store(&inline_data, std::atomic_load(&other.inline_data));
+        return *this;
+    }
+
+    // Grow size to at least end; concurrent writers never shrink it
+    void extendSize(off_t end) {
+        off_t current = size.load(std::memory_order_relaxed);
+        while (current < end &&
+               !size.compare_exchange_weak(current, end, std::memory_order_relaxed)) {
+        }
+    }
 };
@@ -5,27 +5,51 @@
 #include <chrono>
 #include "../logger/logger.h"
 
+// Tunables for drive selection. A drive is considered hot once the time a
+// new request is expected to wait there, queue depth times the drive's
+// smoothed service time, passes redirect_threshold.
+struct LoadBalancerOptions {
+    bool enabled = true;
+    double ewma_alpha = 0.2;  // Weight of the newest sample
+    std::chrono::microseconds redirect_threshold{100000};
+    // A redirect must beat the primary's expected wait by this factor
+    double redirect_margin = 0.5;
+};
+
 class LoadBalancer {
 public:
     struct DriveStats {
         std::atomic<size_t> pending_ops{0};
         std::atomic<uint64_t> total_bytes{0};
-        std::atomic<double> avg_latency{0.0};
+        std::atomic<double> avg_latency{0.0};     // EWMA, milliseconds
+        std::atomic<double> avg_throughput{0.0};  // EWMA, bytes per second
         std::chrono::steady_clock::time_point last_op;
 
         DriveStats() : last_op(std::chrono::steady_clock::now()) {}
     };
 
-    LoadBalancer(size_t num_drives, Logger* logger) 
-        : drive_stats_(num_drives), logger_(logger) {}
+    LoadBalancer(size_t num_drives, Logger* logger,
+                 const LoadBalancerOptions& options = LoadBalancerOptions())
+        : drive_stats_(num_drives), logger_(logger), options_(options) {}
 
+    // Power-of-two choices: a hot primary is compared against the better of
+    // two randomly sampled drives, never against all of them
     size_t selectDrive(size_t primary_drive, size_t size);
-    void recordOperation(size_t drive_id, size_t size, 
+    // Same, sampling only among the given drives (the current placement ring)
+    size_t selectDrive(size_t primary_drive, size_t size, const std::vector<size_t>& candidates);
+    void recordOperation(size_t drive_id, size_t size,
                         const std::chrono::nanoseconds& duration);
     void startOperation(size_t drive_id);
 
+    // Expected wait in milliseconds for a new request of size bytes
+    double expectedWait(size_t drive_id, size_t size) const;
+    const DriveStats& stats(size_t drive_id) const { return drive_stats_[drive_id]; }
+
 private:
-    static constexpr size_t MAX_PENDING_OPS = 1000;
     std::vector<DriveStats> drive_stats_;
     Logger* logger_;
-};
\ No newline at end of file
+    LoadBalancerOptions options_;
+
+    void updateAverage(std::atomic<double>& average, double sample);
+    size_t sampleDrive(size_t count);
+};
@@ -5,48 +5,387 @@
 #include <string>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 #include "ssd_simulator/ssd_simulator.h"
 #include "../hashing/hashing_module.h"
+#include "../hashing/consistent_hash_ring.h"
 #include "../metadata/metadata_manager.h"
 #include "load_balancer.h"
+#include "block_map.h"
+#include "block_cache.h"
+#include "dedup_index.h"
 #include "../logger/logger.h"
+#include "../monitoring/metrics.h"
+#include "../utils/trace.h"
+#include "../utils/thread_pool.h"
+#include "../utils/cpu_topology.h"
 #include "file_metadata.h"
 
+// Keep drive contents and metadata in directory, so a restart maps the
+// drive files and replays the metadata log instead of starting empty.
+// An empty directory keeps everything in memory.
+struct PersistenceOptions {
+    std::string directory;
+    size_t drive_blocks = SSD_Simulator::DEFAULT_BACKING_BLOCKS;  // Slots per new drive file
+};
+
+// Background work and thread placement. Pinning keeps each drive's channel
+// workers on one NUMA node, so the blocks they allocate stay local to it,
+// and spreads the pool's workers over the nodes.
+struct ThreadingOptions {
+    size_t pool_threads = 4;  // Flushes, readahead, checkpoints, migrations
+    bool pin_threads = false;
+};
+
+// Simulated drive geometry and timing. The block size is also the unit of
+// caching, deduplication and the largest inline file; a persistent drive
+// file must be reopened with the block size it was created with.
+struct DriveOptions {
+    size_t block_size = SSD_Simulator::DEFAULT_BLOCK_SIZE;  // A power of two
+    size_t channels = SSD_Simulator::DEFAULT_CHANNELS;
+    size_t queue_size = SSD_Simulator::DEFAULT_QUEUE_SIZE;  // Per drive, split across channels
+    LatencyProfile latency;
+};
+
+// Files up to inline_limit bytes keep their contents in their metadata
+// entry, so reading or writing them never reaches the drives. A file that
+// grows past it moves to the drives for good. At most one block; 0 keeps
+// every file on the drives.
+struct SmallFileOptions {
+    size_t inline_limit = 0;
+};
+
+// Every setting of an accelerator, as a config file or mount options give them.
+// A file's data is placed in stripe units: the blocks of one unit live on
+// one drive and travel as one request, so large files take fewer, larger
+// drive operations. Directories can set their own unit, which is inherited
+// by what is created in them; stripe_unit is the default, 0 meaning a block.
+struct AcceleratorConfig {
+    int num_drives = 16;
+    std::string hash_seed = "default_seed";
+    DriveOptions drives;
+    size_t stripe_unit = 0;
+    LoadBalancerOptions load_balancer;
+    BlockCacheOptions cache;
+    PersistenceOptions persistence;
+    ThreadingOptions threading;
+    DedupOptions dedup;
+    SmallFileOptions small_files;
+};
+
+// Per-open-file read state, kept in fuse_file_info::fh. Sequential reads
+// grow a readahead window that is prefetched into the block cache.
+struct ReadStream {
+    std::mutex mutex;
+    off_t next_offset = 0;   // Where a sequential reader reads next
+    uint64_t window = 0;     // Blocks to keep ahead, 0 while not sequential
+    uint64_t ahead_end = 0;  // First block not yet prefetched
+};
+
 class StorageAccelerator {
 public:
-    StorageAccelerator(int num_drives, const std::string& hash_seed);
+    // A persistent accelerator reopens the drives it finds in the directory,
+    // whatever num_drives says. Throws std::runtime_error for settings out
+    // of range or if the drives or the metadata cannot be loaded.
+    explicit StorageAccelerator(const AcceleratorConfig& config);
+    StorageAccelerator(int num_drives, const std::string& hash_seed,
+                       const BlockCacheOptions& cache_options = BlockCacheOptions(),
+                       const PersistenceOptions& persistence = PersistenceOptions(),
+                       const ThreadingOptions& threading = ThreadingOptions(),
+                       const DedupOptions& dedup = DedupOptions(),
+                       const SmallFileOptions& small_files = SmallFileOptions());
     ~StorageAccelerator();
 
     // File operations
     int createFile(const std::string& path, mode_t mode);
     int deleteFile(const std::string& path);
     int truncateFile(const std::string& path, off_t size);
-    ssize_t readFile(const std::string& path, char* buffer, size_t size, off_t offset);
+    ssize_t readFile(const std::string& path, char* buffer, size_t size, off_t offset,
+                     ReadStream* stream = nullptr);
     ssize_t writeFile(const std::string& path, const char* buffer, size_t size, off_t offset);
+    // The same by inode number, for the FUSE data path: no path is copied or hashed
+    ssize_t readFile(uint64_t ino, char* buffer, size_t size, off_t offset,
+                     ReadStream* stream = nullptr);
+    ssize_t writeFile(uint64_t ino, const char* buffer, size_t size, off_t offset);
 
     // Directory operations
     int createDirectory(const std::string& path, mode_t mode);
     int removeDirectory(const std::string& path);
     std::vector<std::string> listDirectory(const std::string& path);
+    std::vector<DirectoryEntry> listEntries(const std::string& path);
 
-    // Metadata operations
+    // Write a file's dirty cached blocks to the drives and wait for them,
+    // for flush and fsync. releaseFile does the same in the background and
+    // closes a handle openFile counted; an unlinked file keeps its data
+    // until its last handle and kernel reference are gone.
+    int flushFile(uint64_t ino);
+    void openFile(uint64_t ino);
+    void releaseFile(uint64_t ino);
+    int flushAll();
+    // fsync: flush, then put the drive files and metadata log on disk
+    int syncFile(uint64_t ino);
+
+    // Metadata operations. File data is placed by inode number, so a rename
+    // never moves it; flags takes RENAME_NOREPLACE or RENAME_EXCHANGE.
     int renameFile(const std::string& from, const std::string& to, unsigned int flags);
     int chmodFile(const std::string& path, mode_t mode);
     int chownFile(const std::string& path, uid_t uid, gid_t gid);
     int utimensFile(const std::string& path, const struct timespec ts[2]);
+    // By inode number for FUSE setattr, which also reaches unlinked files
+    int truncateFile(uint64_t ino, off_t size);
+    int chmodFile(uint64_t ino, mode_t mode);
+    int chownFile(uint64_t ino, uid_t uid, gid_t gid);
+    int utimensFile(uint64_t ino, const struct timespec ts[2]);
+    // unit is a multiple of the block size up to MAX_STRIPE_UNIT. A file
+    // takes one only while it holds no data; a directory's 0 restores the
+    // default for what is created in it.
+    int setStripeUnit(const std::string& path, size_t unit);
+    // A file's unit, or the one a directory hands to what is created in it
+    int getStripeUnit(const std::string& path, size_t& unit);
+    size_t defaultStripeUnit() const { return default_stripe_unit_; }
     std::shared_ptr<FileMetadata> getMetadata(const std::string& path);
+    std::shared_ptr<FileMetadata> getMetadata(uint64_t ino);  // nullptr once unlinked
+
+    // Inode table for the low-level FUSE front end
+    std::string getPath(uint64_t ino);
+    void lookupInode(uint64_t ino);
+    void forgetInode(uint64_t ino, uint64_t nlookup);
+
+    // Drive pool. Placement follows a consistent-hash ring, so a change only
+    // remaps the blocks next to the affected drive; those are migrated in
+    // the background while I/O continues.
+    int addDrive();                   // New drive id, or -ENOSPC
+    int removeDrive(size_t drive);    // -ENOENT, or -EBUSY for the last drive
+    std::vector<size_t> activeDrives();
+    void waitForRebalance();
+
+    // Unlinked files with many blocks are freed in the background
+    void waitForReclaim();
+    size_t blocksInUse();  // Data blocks held across all drives
+
+    void waitForReadahead();
+    uint64_t readaheadBlocks() const { return readahead_blocks_.load(std::memory_order_relaxed); }
+
+    // Prometheus text for file operations and every drive in the pool
+    void exportMetrics(PrometheusWriter& writer);
+    const OpStats& readStats() const { return read_stats_; }
+    const OpStats& writeStats() const { return write_stats_; }
+    const BlockCache& cache() const { return cache_; }
+    const DedupIndex& dedup() const { return dedup_index_; }
+    uint64_t dedupHits() const { return dedup_hits_.load(std::memory_order_relaxed); }
+    uint64_t inlineSpills() const { return inline_spills_.load(std::memory_order_relaxed); }
+
+    static constexpr size_t MIN_BLOCK_SIZE = 512;
+    static constexpr size_t MAX_BLOCK_SIZE = 1024 * 1024;
+    static constexpr size_t MAX_STRIPE_UNIT = 64 * 1024 * 1024;
+    static constexpr size_t MAX_DRIVES = 256;
 
 private:
-    static constexpr size_t BLOCK_SIZE = 4096;
-    
-    int num_drives_;
+    static constexpr size_t NUM_MIGRATION_LOCKS = 64;
+    // Upper bound on blocks in flight per drive for one scatter/gather wave
+    static constexpr size_t MAX_BLOCKS_PER_DRIVE_WAVE = 64;
+    // Unlinked files larger than this are handed to the reclaimer
+    static constexpr size_t RECLAIM_SYNC_BLOCKS = 256;
+    static constexpr size_t NUM_FLUSH_LOCKS = 64;
+    // Readahead starts at the kernel's usual 128 KiB request and doubles
+    static constexpr uint64_t READAHEAD_MIN_BLOCKS = 32;
+    static constexpr uint64_t READAHEAD_MAX_BLOCKS = 1024;
+    // Rebalance migrations handed to one pool task
+    static constexpr size_t MIGRATION_BATCH = 64;
+    static constexpr size_t NUM_CONTENT_LOCKS = 64;
+    static constexpr size_t NUM_INLINE_LOCKS = 64;
+
+    // Declared first so it outlives the drives and balancer that log to it
+    Logger logger_;
+    PersistenceOptions persistence_;
+    ThreadingOptions threading_;
+    DriveOptions drive_options_;
+    size_t block_size_;
+    size_t default_stripe_unit_;
+    CpuTopology topology_;
+    std::atomic<int> num_drives_;
     std::unique_ptr<HashingModule> hashing_module_;
     std::unique_ptr<LoadBalancer> load_balancer_;
     std::vector<std::unique_ptr<SSD_Simulator>> drives_;
     std::unique_ptr<MetadataManager> metadata_manager_;
-    Logger logger_;
+    BlockMap block_map_;  // Where each written block actually lives
+    BlockCache cache_;
+    OpStats read_stats_;   // End-to-end readFile/writeFile
+    OpStats write_stats_;
+
+    // Current placement ring, replaced as a whole when the pool changes.
+    // pool_mutex_ also guards the drive slots being filled or released.
+    std::mutex pool_mutex_;
+    std::shared_ptr<const ConsistentHashRing> ring_;
+
+    // I/O holds a file's lock shared, a block migration holds it exclusively
+    std::shared_mutex migration_locks_[NUM_MIGRATION_LOCKS];
+
+    struct RebalanceJob {
+        std::shared_ptr<const ConsistentHashRing> old_ring;
+        std::shared_ptr<const ConsistentHashRing> new_ring;
+        int removed_drive = -1;
+    };
+    std::mutex rebalance_mutex_;
+    std::condition_variable rebalance_cv_;
+    std::deque<RebalanceJob> rebalance_jobs_;
+    bool rebalance_busy_ = false;
+    bool rebalance_stop_ = false;
+    std::thread rebalancer_;
+
+    // Inode numbers are never reused, so an unlinked file's blocks can be
+    // freed at leisure
+    std::mutex reclaim_mutex_;
+    std::condition_variable reclaim_cv_;
+    std::deque<uint64_t> reclaim_jobs_;
+    bool reclaim_busy_ = false;
+    bool reclaim_stop_ = false;
+    std::thread reclaimer_;
+
+    // Flushes of one file run one at a time, so an older copy of a block
+    // never reaches the drives after a newer one
+    std::mutex flush_locks_[NUM_FLUSH_LOCKS];
+    std::atomic<bool> flush_all_queued_{false};
+    std::atomic<bool> checkpoint_queued_{false};
+
+    std::mutex readahead_mutex_;
+    std::condition_variable readahead_cv_;
+    size_t readahead_pending_ = 0;
+    std::atomic<uint64_t> readahead_blocks_{0};
+
+    // With dedup on, file data lives in the index's stored blocks instead of
+    // per-file objects. Reads and verifications hold a stored block's lock
+    // shared, its migration holds it exclusively.
+    DedupOptions dedup_options_;
+    DedupIndex dedup_index_;
+    std::shared_mutex content_locks_[NUM_CONTENT_LOCKS];
+    std::atomic<uint64_t> dedup_hits_{0};        // Blocks written as a reference
+    std::atomic<uint64_t> dedup_collisions_{0};  // Fingerprint matches with other bytes
+
+    // Writers of an inline file take its lock; readers load the contents
+    size_t inline_limit_;
+    std::mutex inline_locks_[NUM_INLINE_LOCKS];
+    std::atomic<uint64_t> inline_spills_{0};  // Files moved to the drives
+
+    // Flushes after release, checkpoints, readahead, rebalance migrations
+    std::unique_ptr<ThreadPool> pool_;
+
+    bool persistent() const { return !persistence_.directory.empty(); }
+    std::string driveFile(size_t drive) const;
+    std::unique_ptr<SSD_Simulator> makeDrive(size_t drive);
+    // Drive ids with a file in the persistence directory, ascending
+    std::vector<size_t> existingDrives();
+    // Rebuild the block map from what the reopened drives hold
+    void restoreBlocks();
+    void persistAttributes(const std::string& path, const FileMetadata& metadata);
+    void maybeCheckpoint();
+
+    std::shared_ptr<const ConsistentHashRing> placementRing();
+    size_t stripeUnitOf(uint64_t file_id);
+    // Unit for something created at path: its directory's, or the default
+    size_t inheritedStripeUnit(const std::string& path);
+    std::shared_mutex& migrationLockFor(uint64_t file_id);
+    std::mutex& flushLockFor(uint64_t file_id);
+    int flushLocked(uint64_t file_id);
+    // Name of a file's data on the drives, independent of its path
+    static std::string dataObject(uint64_t file_id);
+    // Drop the data of an unlinked file from the drives, now or in the background
+    void releaseData(const std::string& path, uint64_t file_id);
+    // Release the data of an unlinked inode the metadata manager let go of
+    void releaseUnlinked(const std::shared_ptr<FileMetadata>& entry);
+    void reclaimLoop();
+    // Send a DELETE or TRUNCATE to every drive holding blocks of the file
+    // in parallel. Caller holds the file's migration lock exclusively.
+    ssize_t fanOut(IOType type, uint64_t file_id, off_t size);
+    // Install a new ring and queue the migration it implies
+    void publishRing(std::shared_ptr<const ConsistentHashRing> ring, int removed_drive);
+    void rebalanceLoop();
+    void rebalance(const RebalanceJob& job);
+    // reclaim_source discards the copy left behind on the old drive
+    void migrateBlock(const BlockMap::Location& block, size_t to, bool reclaim_source);
+    size_t fileBlocks(uint64_t file_id);
+
+    struct DriveRequest {
+        size_t drive;
+        IORequest request;
+    };
+    // Submit requests to their drives in one batch and wait for every one.
+    // results[i] is the result of requests[i]; false if the drives timed out.
+    bool submitBatch(std::vector<DriveRequest>& requests, std::vector<ssize_t>& results);
+    // After a timed out reap, close out every operation started on the load
+    // balancer: drives[i] took request i, the unreaped ones count as taking
+    // the whole wait
+    void recordTimedOut(const std::vector<size_t>& drives,
+                        const std::vector<IOCompletion>& completions,
+                        std::chrono::steady_clock::time_point start_time);
+
+    // Deduplicated I/O. dedupWave takes the file's migration lock, shared,
+    // or exclusively for a write with partial blocks, which are read,
+    // merged and stored whole. The others expect the lock held.
+    std::shared_mutex& contentLockFor(const ContentKey& key);
+    ssize_t dedupWave(IOType type, const std::string& path, uint64_t file_id, char* read_buffer,
+                      const char* write_data, size_t size, off_t offset);
+    ssize_t dedupRead(const std::string& path, uint64_t file_id, char* buffer, size_t size,
+                      off_t offset);
+    ssize_t dedupWrite(const std::string& path, uint64_t file_id, const char* data, size_t size,
+                       off_t offset);
+    ssize_t dedupFanOut(IOType type, uint64_t file_id, off_t size);
+    // Drop references, deleting the stored blocks nothing points at any more
+    void releaseContent(const std::vector<ContentKey>& keys);
+    void migrateContent(const DedupIndex::Stored& stored, size_t to);
+
+    // Writes and truncates of inline files; true when done here, with the
+    // outcome in result. False sends the caller to the drives: the file is
+    // not inline, or the change outgrows the limit and the contents were
+    // just moved there.
+    std::mutex& inlineLockFor(uint64_t file_id);
+    bool writeInline(const std::string& path, FileMetadata& metadata, const char* data, size_t size,
+                     off_t offset, ssize_t& result);
+    bool truncateInline(const std::string& path, FileMetadata& metadata, off_t size, int& result);
+    // Move the contents to the drives; caller holds the inline lock
+    int spillInline(const std::string& path, FileMetadata& metadata, const std::string& contents);
+
+    // Bodies of readFile and writeFile once the entry is found; path, or
+    // the data object name when called by inode, only appears in log messages
+    ssize_t readData(const std::string& path, const std::shared_ptr<FileMetadata>& metadata,
+                     char* buffer, size_t size, off_t offset, ReadStream* stream);
+    ssize_t writeData(const std::string& path, const std::shared_ptr<FileMetadata>& metadata,
+                      const char* data, size_t size, off_t offset);
+    // The same split for the attribute changes
+    int truncateEntry(const std::string& path, FileMetadata& metadata, off_t size);
+    int chmodEntry(const std::string& path, FileMetadata& metadata, mode_t mode);
+    int chownEntry(const std::string& path, FileMetadata& metadata, uid_t uid, gid_t gid);
+    int utimensEntry(const std::string& path, FileMetadata& metadata, const struct timespec ts[2]);
+
+    // Serve what the cache has and fetch missing blocks whole, in runs
+    ssize_t readCached(const std::string& path, uint64_t file_id, char* buffer, size_t size,
+                       off_t offset);
+    struct BlockTicket {
+        uint64_t block;
+        uint64_t ticket;
+    };
+    // Read count consecutive blocks into fetched and cache them
+    ssize_t fetchRun(const std::string& path, uint64_t file_id, const BlockTicket* run,
+                     size_t count, std::vector<char>& fetched);
+    // Update the stream after a read and queue the next window if it is due
+    void readahead(ReadStream& stream, const std::string& path, uint64_t file_id, off_t offset,
+                   size_t bytes, off_t file_size);
+    void prefetch(const std::string& path, uint64_t file_id, uint64_t first_block,
+                  uint64_t end_block);
+    // Absorb a write into the cache, writing through whatever does not fit
+    ssize_t writeBack(const std::string& path, uint64_t file_id, const char* data, size_t size,
+                      off_t offset);
+    void updateCache(uint64_t file_id, const char* data, size_t size, off_t offset);
 
-    int getDriveIndex(const std::string& path);
-    SSD_Simulator* getDrive(const std::string& path);
-    SSD_Simulator* selectDrive(const std::string& path, size_t size);
+    // Split [offset, offset + size) into block-aligned requests, fan them out
+    // to their drives in one batch and wait on a single completion queue.
+    // Reads fill read_buffer, writes borrow write_data until completion.
+    // path is only used in log messages.
+    ssize_t transferBlocks(IOType type, const std::string& path, uint64_t file_id, char* read_buffer,
+                           const char* write_data, size_t size, off_t offset);
+    ssize_t transferWave(IOType type, const std::string& path, uint64_t file_id, char* read_buffer,
+                         const char* write_data, size_t size, off_t offset);
 };
\ No newline at end of file
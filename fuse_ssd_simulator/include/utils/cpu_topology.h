@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+// NUMA layout of the CPUs this process may run on. Read from sysfs, so no
+// libnuma is needed; a machine without node information is one node.
+class CpuTopology {
+public:
+    // Nodes without any allowed CPU (memory-only nodes) are left out
+    static CpuTopology detect();
+    explicit CpuTopology(std::vector<std::vector<int>> nodes);
+
+    size_t nodeCount() const { return nodes_.size(); }
+    const std::vector<int>& nodeCpus(size_t node) const { return nodes_[node]; }
+
+    // Drives are dealt round-robin over the nodes. A drive's channel
+    // workers run there, so the blocks they allocate are local to it.
+    size_t nodeOfDrive(size_t drive) const { return drive % nodes_.size(); }
+    // One CPU set per pool worker, whole nodes taken in turn
+    std::vector<std::vector<int>> spread(size_t workers) const;
+
+    // "0-3,8,10-11" as in sysfs cpulist files; empty if malformed
+    static std::vector<int> parseCpuList(const std::string& list);
+
+private:
+    std::vector<std::vector<int>> nodes_;
+};
+
+// Restrict a thread to cpus. 0 or a negative errno; an empty set is a no-op.
+int pinThread(std::thread& thread, const std::vector<int>& cpus);
+int pinCurrentThread(const std::vector<int>& cpus);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free multi-producer/single-consumer ring. Each slot carries a
+// sequence number (Vyukov style) so producers claim slots with a single CAS
+// and the consumer never takes a lock. Capacity is rounded up to a power of
+// two; values are moved in and out, never copied.
+template<typename T>
+class MpscRing {
+public:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    explicit MpscRing(size_t min_capacity)
+        : capacity_(roundUpPowerOfTwo(min_capacity)),
+          mask_(capacity_ - 1),
+          slots_(new Slot[capacity_]) {
+        for (size_t i = 0; i < capacity_; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Any thread. Returns false when the ring is full.
+    bool tryPush(T&& value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots_[pos & mask_];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only
+    bool tryPop(T& out) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[pos & mask_];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0) {
+            return false;
+        }
+
+        out = std::move(slot.value);
+        slot.sequence.store(pos + capacity_, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer thread only
+    bool empty() const {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        size_t sequence = slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+        return static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1) < 0;
+    }
+
+    // Approximate when called concurrently with producers
+    size_t size() const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t roundUpPowerOfTwo(size_t value) {
+        size_t result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+
+    // Producer and consumer cursors live on separate cache lines
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+};
@@ -2,16 +2,23 @@
 
 #include <vector>
 #include <thread>
-#include <queue>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <atomic>
 
+// Work-stealing pool. Every worker has its own queue: tasks submitted from
+// a worker go to that worker's queue, others are dealt out round-robin,
+// and an idle worker steals from the busiest end of another's queue, so
+// no single lock is shared by every submission. Queued tasks still run
+// when the pool is destroyed.
 class ThreadPool {
 public:
-    ThreadPool(size_t threads);
+    // Worker i is pinned to worker_cpus[i % size] when that is not empty
+    ThreadPool(size_t threads, const std::vector<std::vector<int>>& worker_cpus = {});
     ~ThreadPool();
 
     // Submit a job to the thread pool
@@ -19,17 +26,32 @@ public:
     auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::invoke_result<F, Args...>::type>;
 
+    size_t size() const { return workers_.size(); }
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
 private:
-    // Workers
-    std::vector<std::thread> workers_;
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
 
-    // Task queue
-    std::queue<std::function<void()>> tasks_;
+    // Workers
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_worker_{0};
 
-    // Synchronization
-    std::mutex queue_mutex_;
+    // Idle workers sleep here; pending_ counts tasks queued and not taken
+    std::mutex sleep_mutex_;
     std::condition_variable condition_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> sleepers_{0};
     std::atomic<bool> stop_;
+    std::atomic<uint64_t> steals_{0};
+
+    void push(std::function<void()> task);
+    // Own queue first, oldest task first; then the newest of another's
+    bool take(size_t self, std::function<void()>& task);
+    void workerLoop(size_t self);
 };
 
 // Implementation of enqueue in the header
@@ -43,16 +65,6 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     );
 
     std::future<return_type> res = task->get_future();
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-
-        // Don't allow enqueueing after stopping the pool
-        if (stop_) {
-            throw std::runtime_error("enqueue on stopped ThreadPool");
-        }
-
-        tasks_.emplace([task](){ (*task)(); });
-    }
-    condition_.notify_one();
+    push([task](){ (*task)(); });
     return res;
 }
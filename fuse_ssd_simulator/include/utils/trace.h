@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Per-operation tracing. Each thread appends complete spans to its own
+// fixed-size buffer without locking; dump() writes everything recorded so
+// far as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// The TRACE_* macros compile to nothing unless FUSE_SSD_TRACING is defined,
+// so trace points cost nothing in normal builds.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+    // category and name must be string literals, they are stored as is
+    static void record(const char* category, const char* name,
+                       Clock::time_point start, Clock::time_point end, uint64_t arg = 0);
+    static bool dump(const std::string& path);
+
+    static size_t recorded();
+    static size_t dropped();  // Spans lost to full buffers
+};
+
+class TraceScope {
+public:
+    TraceScope(const char* category, const char* name, uint64_t arg = 0)
+        : category_(category), name_(name), arg_(arg), start_(Tracer::Clock::now()) {}
+    ~TraceScope() { Tracer::record(category_, name_, start_, Tracer::Clock::now(), arg_); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* category_;
+    const char* name_;
+    uint64_t arg_;
+    Tracer::Clock::time_point start_;
+};
+
+#if defined(FUSE_SSD_TRACING)
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Span covering the rest of the enclosing scope
+#define TRACE_SCOPE(category, name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+#define TRACE_SCOPE_ARG(category, name, arg) \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(category, name, arg)
+// Span measured elsewhere, e.g. queue wait between two threads
+#define TRACE_SPAN(category, name, start, end, arg) Tracer::record(category, name, start, end, arg)
+// Timestamp that only exists in tracing builds, for use in TRACE_SPAN
+#define TRACE_NOW(var) auto var = Tracer::Clock::now()
+#define TRACE_DUMP(path) Tracer::dump(path)
+#else
+#define TRACE_SCOPE(category, name) do {} while (0)
+#define TRACE_SCOPE_ARG(category, name, arg) do {} while (0)
+#define TRACE_SPAN(category, name, start, end, arg) do {} while (0)
+#define TRACE_NOW(var) do {} while (0)
+#define TRACE_DUMP(path) do {} while (0)
+#endif
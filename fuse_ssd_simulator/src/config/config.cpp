@@ -0,0 +1,301 @@
+#include "config/config.h"
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool parseUnsigned(const std::string& text, uint64_t& out) {
+    if (text.empty() || text[0] < '0' || text[0] > '9') {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+bool parseDouble(const std::string& text, double& out) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    double value = strtod(text.c_str(), &end);
+    if (errno != 0 || *end != '\0' || !(value >= 0)) {
+        return false;
+    }
+    out = value;
+    return true;
+}
+
+bool parseBool(const std::string& text, bool& out) {
+    if (text.empty() || text == "1" || text == "true" || text == "on" || text == "yes") {
+        out = true;
+        return true;
+    }
+    if (text == "0" || text == "false" || text == "off" || text == "no") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+bool parseSize(const std::string& text, uint64_t& out) {
+    if (text.empty()) {
+        return false;
+    }
+    uint64_t scale = 1;
+    std::string digits = text;
+    switch (text.back()) {
+    case 'K': case 'k': scale = 1ULL << 10; break;
+    case 'M': case 'm': scale = 1ULL << 20; break;
+    case 'G': case 'g': scale = 1ULL << 30; break;
+    default: break;
+    }
+    if (scale > 1) {
+        digits.pop_back();
+    }
+
+    uint64_t value = 0;
+    if (!parseUnsigned(digits, value) || value > UINT64_MAX / scale) {
+        return false;
+    }
+    out = value * scale;
+    return true;
+}
+
+int applyConfigOption(AcceleratorConfig& config, const std::string& key,
+                      const std::string& value, std::string& error) {
+    uint64_t number = 0;
+    double real = 0;
+    bool flag = false;
+    auto invalid = [&](const std::string& expected) {
+        error = "invalid value '" + value + "' for " + key + ", expected " + expected;
+        return -EINVAL;
+    };
+    auto microseconds = [](uint64_t us) { return std::chrono::microseconds(us); };
+
+    if (key == "drives") {
+        if (!parseUnsigned(value, number) || number == 0 ||
+            number > StorageAccelerator::MAX_DRIVES) {
+            return invalid("1 to " + std::to_string(StorageAccelerator::MAX_DRIVES));
+        }
+        config.num_drives = static_cast<int>(number);
+    } else if (key == "seed") {
+        config.hash_seed = value;
+    } else if (key == "block_size") {
+        if (!parseSize(value, number) || (number & (number - 1)) != 0 ||
+            number < StorageAccelerator::MIN_BLOCK_SIZE ||
+            number > StorageAccelerator::MAX_BLOCK_SIZE) {
+            return invalid("a power of two from " + std::to_string(StorageAccelerator::MIN_BLOCK_SIZE) +
+                           " to " + std::to_string(StorageAccelerator::MAX_BLOCK_SIZE));
+        }
+        config.drives.block_size = number;
+    } else if (key == "channels") {
+        if (!parseUnsigned(value, number) || number == 0) {
+            return invalid("a positive count");
+        }
+        config.drives.channels = number;
+    } else if (key == "queue_size") {
+        if (!parseUnsigned(value, number) || number == 0) {
+            return invalid("a positive count");
+        }
+        config.drives.queue_size = number;
+    } else if (key == "latency_profile") {
+        if (value == "legacy") {
+            config.drives.latency = LatencyProfile::legacy();
+        } else if (value == "nvme") {
+            config.drives.latency = LatencyProfile::nvme();
+        } else {
+            return invalid("legacy or nvme");
+        }
+    } else if (key == "read_latency_us" || key == "write_latency_us") {
+        if (!parseUnsigned(value, number)) {
+            return invalid("microseconds");
+        }
+        (key[0] == 'r' ? config.drives.latency.read : config.drives.latency.write).base =
+            microseconds(number);
+    } else if (key == "read_bandwidth" || key == "write_bandwidth") {
+        if (!parseSize(value, number)) {
+            return invalid("bytes per second");
+        }
+        (key[0] == 'r' ? config.drives.latency.read : config.drives.latency.write)
+            .bytes_per_second = static_cast<double>(number);
+    } else if (key == "queue_depth_penalty_us") {
+        if (!parseUnsigned(value, number)) {
+            return invalid("microseconds");
+        }
+        config.drives.latency.queue_depth_penalty = microseconds(number);
+    } else if (key == "stripe_unit") {
+        // Whether it is a multiple of the block size depends on the final block_size
+        if (!parseSize(value, number) || number > StorageAccelerator::MAX_STRIPE_UNIT) {
+            return invalid("a size up to " + std::to_string(StorageAccelerator::MAX_STRIPE_UNIT));
+        }
+        config.stripe_unit = number;
+    } else if (key == "load_balancing") {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        config.load_balancer.enabled = flag;
+    } else if (key == "redirect_threshold_us") {
+        if (!parseUnsigned(value, number)) {
+            return invalid("microseconds");
+        }
+        config.load_balancer.redirect_threshold = microseconds(number);
+    } else if (key == "redirect_margin") {
+        if (!parseDouble(value, real)) {
+            return invalid("a non-negative number");
+        }
+        config.load_balancer.redirect_margin = real;
+    } else if (key == "cache_size") {
+        if (!parseSize(value, number)) {
+            return invalid("a size");
+        }
+        config.cache.capacity = number;
+    } else if (key == "write_back") {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        config.cache.write_back = flag;
+    } else if (key == "persist_dir") {
+        config.persistence.directory = value;
+    } else if (key == "drive_blocks") {
+        if (!parseUnsigned(value, number) || number == 0) {
+            return invalid("a positive count");
+        }
+        config.persistence.drive_blocks = number;
+    } else if (key == "pool_threads") {
+        if (!parseUnsigned(value, number) || number == 0) {
+            return invalid("a positive count");
+        }
+        config.threading.pool_threads = number;
+    } else if (key == "pin_threads") {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        config.threading.pin_threads = flag;
+    } else if (key == "dedup") {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        config.dedup.enabled = flag;
+    } else if (key == "dedup_verify") {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        config.dedup.verify = flag;
+    } else if (key == "inline_limit") {
+        if (!parseSize(value, number)) {
+            return invalid("a size");
+        }
+        config.small_files.inline_limit = number;
+    } else {
+        error = "unknown setting " + key;
+        return -ENOENT;
+    }
+    return 0;
+}
+
+int applyFuseOption(FuseCacheOptions& options, const std::string& key,
+                    const std::string& value, std::string& error) {
+    uint64_t number = 0;
+    double real = 0;
+    bool flag = false;
+    auto invalid = [&](const std::string& expected) {
+        error = "invalid value '" + value + "' for " + key + ", expected " + expected;
+        return -EINVAL;
+    };
+    auto timeout = [&](double& field) {
+        if (!parseDouble(value, real)) {
+            return invalid("seconds");
+        }
+        field = real;
+        return 0;
+    };
+    auto toggle = [&](bool& field) {
+        if (!parseBool(value, flag)) {
+            return invalid("on or off");
+        }
+        field = flag;
+        return 0;
+    };
+    auto size = [&](unsigned int& field) {
+        if (!parseSize(value, number) || number > UINT_MAX) {
+            return invalid("a size");
+        }
+        field = static_cast<unsigned int>(number);
+        return 0;
+    };
+
+    if (key == "attr_timeout") {
+        return timeout(options.attr_timeout);
+    } else if (key == "entry_timeout") {
+        return timeout(options.entry_timeout);
+    } else if (key == "negative_timeout") {
+        return timeout(options.negative_timeout);
+    } else if (key == "keep_cache") {
+        return toggle(options.keep_cache);
+    } else if (key == "auto_cache") {
+        return toggle(options.auto_cache);
+    } else if (key == "writeback_cache") {
+        return toggle(options.writeback_cache);
+    } else if (key == "max_write") {
+        return size(options.max_write);
+    } else if (key == "max_read") {
+        return size(options.max_read);
+    } else if (key == "max_background") {
+        return size(options.max_background);
+    } else if (key == "congestion_threshold") {
+        return size(options.congestion_threshold);
+    }
+    error = "unknown setting " + key;
+    return -ENOENT;
+}
+
+int loadConfigFile(AcceleratorConfig& config, const std::string& path, std::string& error,
+                   FuseCacheOptions* fuse_options) {
+    std::ifstream file(path);
+    if (!file) {
+        int ret = errno ? -errno : -ENOENT;
+        error = "cannot open " + path + ": " + strerror(-ret);
+        return ret;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        size_t equals = line.find('=');
+        std::string key = trim(line.substr(0, equals));
+        std::string value = equals == std::string::npos ? "" : trim(line.substr(equals + 1));
+        int ret = applyConfigOption(config, key, value, error);
+        if (ret == -ENOENT && fuse_options) {
+            ret = applyFuseOption(*fuse_options, key, value, error);
+        }
+        if (ret < 0) {
+            error = path + ":" + std::to_string(number) + ": " + error;
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
@@ -1,18 +1,24 @@
 #include "fuse_interface.h"
+#include "utils/trace.h"
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/mount.h>
-#include <fuse.h>
 #include <errno.h>
 
 // Initialize static members
 StorageAccelerator* FuseInterface::static_accelerator_ = nullptr;
 Logger* FuseInterface::static_logger_ = nullptr;
+FuseCacheOptions FuseInterface::cache_options_;
 
-FuseInterface::FuseInterface(const std::string& mount_point, std::shared_ptr<StorageAccelerator> accelerator)
+FuseInterface::FuseInterface(const std::string& mount_point, std::shared_ptr<StorageAccelerator> accelerator,
+                             const FuseCacheOptions& cache_options)
     : mount_point_(mount_point), accelerator_(accelerator) {
     static_accelerator_ = accelerator_.get();
+    cache_options_ = cache_options;
     static_logger_ = new Logger("FUSE_Interface");
 }
 
@@ -30,118 +36,503 @@ void FuseInterface::cleanup() {
         delete static_logger_;
         static_logger_ = nullptr;
     }
-    
+
     static_accelerator_ = nullptr;
 }
 
-int FuseInterface::getattr_callback(const char* path, struct stat* stbuf, struct fuse_file_info* fi) {
-    static_logger_->debug("getattr: " + std::string(path));
-    memset(stbuf, 0, sizeof(struct stat));
+std::string FuseInterface::childPath(const std::string& parent, const char* name) {
+    if (parent == "/") {
+        return parent + name;
+    }
+    return parent + "/" + name;
+}
+
+std::string FuseInterface::resolve(fuse_req_t req, fuse_ino_t ino) {
+    std::string path = static_accelerator_->getPath(ino);
+    if (path.empty()) {
+        fuse_reply_err(req, ENOENT);
+    }
+    return path;
+}
 
-    if (strcmp(path, "/") == 0) {
-        stbuf->st_mode = S_IFDIR | 0755;
-        stbuf->st_nlink = 2;
-        return 0;
+std::string FuseInterface::resolve(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    std::string parent_path = resolve(req, parent);
+    if (parent_path.empty()) {
+        return parent_path;
     }
+    return childPath(parent_path, name);
+}
+
+void FuseInterface::fillStat(const FileMetadata& metadata, struct stat* stbuf) {
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = metadata.ino;
+    stbuf->st_mode = metadata.mode;
+    stbuf->st_nlink = metadata.nlink;
+    stbuf->st_size = metadata.size;
+    stbuf->st_uid = metadata.uid;
+    stbuf->st_gid = metadata.gid;
+    stbuf->st_atime = metadata.atime;
+    stbuf->st_mtime = metadata.mtime;
+    stbuf->st_ctime = metadata.ctime;
+}
+
+void FuseInterface::fillEntry(const FileMetadata& metadata, struct fuse_entry_param* entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->ino = metadata.ino;
+    entry->attr_timeout = cache_options_.attr_timeout;
+    entry->entry_timeout = cache_options_.entry_timeout;
+    fillStat(metadata, &entry->attr);
+}
 
+void FuseInterface::replyEntry(fuse_req_t req, const std::string& path, bool negative) {
     auto metadata = static_accelerator_->getMetadata(path);
     if (!metadata) {
-        return -ENOENT;
+        if (!negative || cache_options_.negative_timeout <= 0) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        // Inode 0 caches the miss in the kernel for negative_timeout
+        struct fuse_entry_param entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.entry_timeout = cache_options_.negative_timeout;
+        fuse_reply_entry(req, &entry);
+        return;
     }
 
-    stbuf->st_mode = metadata->mode;
-    stbuf->st_nlink = metadata->nlink;
-    stbuf->st_size = metadata->size;
-    stbuf->st_uid = metadata->uid;
-    stbuf->st_gid = metadata->gid;
-    stbuf->st_atime = metadata->atime;
-    stbuf->st_mtime = metadata->mtime;
-    stbuf->st_ctime = metadata->ctime;
+    struct fuse_entry_param entry;
+    fillEntry(*metadata, &entry);
 
-    return 0;
+    // Every entry reply is one kernel reference, dropped again by forget
+    static_accelerator_->lookupInode(metadata->ino);
+    if (fuse_reply_entry(req, &entry) != 0) {
+        static_accelerator_->forgetInode(metadata->ino, 1);
+    }
 }
 
-int FuseInterface::readdir_callback(const char* path, void* buf, fuse_fill_dir_t filler,
-                                  off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
-    static_logger_->debug("readdir: " + std::string(path));
-    
-    filler(buf, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
-    filler(buf, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+void FuseInterface::init_callback(void* userdata, struct fuse_conn_info* conn) {
+    if (cache_options_.max_write > 0) {
+        conn->max_write = cache_options_.max_write;
+    }
+    if (cache_options_.max_read > 0) {
+        conn->max_read = cache_options_.max_read;
+    }
+    conn->max_background = cache_options_.max_background;
+    conn->congestion_threshold = std::min(cache_options_.congestion_threshold,
+                                          cache_options_.max_background);
 
-    auto entries = static_accelerator_->listDirectory(path);
-    for (const auto& entry : entries) {
-        filler(buf, entry.c_str(), nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    if (cache_options_.writeback_cache && (conn->capable & FUSE_CAP_WRITEBACK_CACHE)) {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    }
+    if (cache_options_.auto_cache && (conn->capable & FUSE_CAP_AUTO_INVAL_DATA)) {
+        conn->want |= FUSE_CAP_AUTO_INVAL_DATA;
     }
 
-    return 0;
+    // Let the kernel splice request and reply payloads through pipes
+    // instead of copying them through /dev/fuse
+    if (conn->capable & FUSE_CAP_SPLICE_READ) {
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    }
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE) {
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    }
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE) {
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+    }
 }
 
-int FuseInterface::open_callback(const char* path, struct fuse_file_info* fi) {
-    static_logger_->info("Opening file: " + std::string(path));
-    auto metadata = static_accelerator_->getMetadata(path);
+void FuseInterface::lookup_callback(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    TRACE_SCOPE("fuse", "lookup");
+    std::string path = resolve(req, parent, name);
+    if (path.empty()) {
+        return;
+    }
+    LOG_DEBUG(*static_logger_, "lookup: " + path);
+    replyEntry(req, path, true);
+}
+
+void FuseInterface::forget_callback(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    TRACE_SCOPE("fuse", "forget");
+    static_accelerator_->forgetInode(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+void FuseInterface::forget_multi_callback(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+    TRACE_SCOPE("fuse", "forget_multi");
+    for (size_t i = 0; i < count; i++) {
+        static_accelerator_->forgetInode(forgets[i].ino, forgets[i].nlookup);
+    }
+    fuse_reply_none(req);
+}
+
+void FuseInterface::getattr_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "getattr");
+    LOG_DEBUG(*static_logger_, "getattr: inode " + std::to_string(ino));
+
+    auto metadata = static_accelerator_->getMetadata(ino);
+    if (!metadata) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stat stbuf;
+    fillStat(*metadata, &stbuf);
+    fuse_reply_attr(req, &stbuf, cache_options_.attr_timeout);
+}
+
+void FuseInterface::setattr_callback(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                                     int to_set, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "setattr");
+    auto metadata = static_accelerator_->getMetadata(ino);
+    if (!metadata) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    int ret = 0;
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        ret = static_accelerator_->chmodFile(ino, attr->st_mode);
+    }
+    if (ret == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
+        uid_t uid = (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : metadata->uid.load();
+        gid_t gid = (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : metadata->gid.load();
+        ret = static_accelerator_->chownFile(ino, uid, gid);
+    }
+    if (ret == 0 && (to_set & FUSE_SET_ATTR_SIZE)) {
+        ret = static_accelerator_->truncateFile(ino, attr->st_size);
+    }
+    if (ret == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        struct timespec ts[2] = {};
+        ts[0].tv_sec = metadata->atime;
+        ts[1].tv_sec = metadata->mtime;
+        time_t now = time(nullptr);
+        if (to_set & FUSE_SET_ATTR_ATIME) {
+            ts[0] = attr->st_atim;
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+                ts[0].tv_sec = now;
+            }
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME) {
+            ts[1] = attr->st_mtim;
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+                ts[1].tv_sec = now;
+            }
+        }
+        ret = static_accelerator_->utimensFile(ino, ts);
+    }
+
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    getattr_callback(req, ino, fi);
+}
+
+void FuseInterface::readdir_callback(fuse_req_t req, fuse_ino_t ino, size_t size,
+                                     off_t offset, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "readdir");
+    std::string path = resolve(req, ino);
+    if (path.empty()) {
+        return;
+    }
+    LOG_DEBUG(*static_logger_, "readdir: " + path);
+
+    auto entries = static_accelerator_->listEntries(path);
+    std::vector<char> buf(size);
+    size_t used = 0;
+
+    // Offsets are entry indices: 0 and 1 are "." and ".."
+    for (size_t i = offset; i < entries.size() + 2; i++) {
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(stbuf));
+        const char* name;
+        if (i < 2) {
+            name = i == 0 ? "." : "..";
+            stbuf.st_ino = ino;
+            stbuf.st_mode = S_IFDIR;
+        } else {
+            // Entries removed while listing are already left out
+            name = entries[i - 2].name.c_str();
+            stbuf.st_ino = entries[i - 2].metadata->ino;
+            stbuf.st_mode = entries[i - 2].metadata->mode;
+        }
+
+        size_t entry_size = fuse_add_direntry(req, buf.data() + used, size - used,
+                                              name, &stbuf, i + 1);
+        if (entry_size > size - used) {
+            break;
+        }
+        used += entry_size;
+    }
+
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+void FuseInterface::open_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "open");
+    LOG_INFO(*static_logger_, "Opening inode: " + std::to_string(ino));
+
+    auto metadata = static_accelerator_->getMetadata(ino);
     if (!metadata) {
-        return -ENOENT;
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if ((metadata->mode & S_IFMT) == S_IFDIR) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    // Freed in release, which does not come if the reply never arrived.
+    // The handle keeps the file's data alive across an unlink.
+    fi->fh = reinterpret_cast<uint64_t>(new ReadStream());
+    fi->keep_cache = cache_options_.keep_cache;
+    static_accelerator_->openFile(ino);
+    if (fuse_reply_open(req, fi) != 0) {
+        static_accelerator_->releaseFile(ino);
+        delete reinterpret_cast<ReadStream*>(fi->fh);
     }
-    return 0;
 }
 
-int FuseInterface::read_callback(const char* path, char* buf, size_t size,
-                               off_t offset, struct fuse_file_info* fi) {
-    return static_accelerator_->readFile(path, buf, size, offset);
+void FuseInterface::read_callback(fuse_req_t req, fuse_ino_t ino, size_t size,
+                                  off_t offset, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "read");
+    // Data requests go by inode, which outlives an unlink while it is open
+    std::vector<char> buffer(size);
+    ssize_t bytes = static_accelerator_->readFile(ino, buffer.data(), size, offset,
+                                                  reinterpret_cast<ReadStream*>(fi->fh));
+    if (bytes < 0) {
+        fuse_reply_err(req, -bytes);
+        return;
+    }
+
+    // Drives gather straight into the reply buffer, which the kernel can
+    // then take by splice instead of another copy
+    struct fuse_bufvec bufvec = FUSE_BUFVEC_INIT(static_cast<size_t>(bytes));
+    bufvec.buf[0].mem = buffer.data();
+    fuse_reply_data(req, &bufvec, FUSE_BUF_SPLICE_MOVE);
 }
 
-int FuseInterface::write_callback(const char* path, const char* buf, size_t size,
-                                off_t offset, struct fuse_file_info* fi) {
-    static_logger_->info("Writing to file: " + std::string(path) + 
-                        " size: " + std::to_string(size));
-    return static_accelerator_->writeFile(path, buf, size, offset);
+void FuseInterface::write_callback(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size,
+                                   off_t offset, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "write");
+    LOG_DEBUG(*static_logger_, "Writing to inode: " + std::to_string(ino) +
+              " size: " + std::to_string(size));
+
+    ssize_t written = static_accelerator_->writeFile(ino, buf, size, offset);
+    if (written < 0) {
+        fuse_reply_err(req, -written);
+        return;
+    }
+    fuse_reply_write(req, written);
+}
+
+void FuseInterface::write_buf_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* buf,
+                                       off_t offset, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "write_buf");
+    off_t pos = offset;
+    ssize_t error = 0;
+    std::vector<char> scratch;
+
+    for (size_t i = buf->idx; i < buf->count; i++) {
+        const struct fuse_buf& segment = buf->buf[i];
+        size_t skip = (i == buf->idx) ? buf->off : 0;
+        if (segment.size <= skip) {
+            continue;
+        }
+        size_t len = segment.size - skip;
+        const char* data;
+
+        if (!(segment.flags & FUSE_BUF_IS_FD)) {
+            // Memory segments are striped to the drives in place
+            data = static_cast<const char*>(segment.mem) + skip;
+        } else {
+            // Spliced pipe data has to land in memory once before striping
+            scratch.resize(len);
+            struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+            dst.buf[0].mem = scratch.data();
+            struct fuse_bufvec src = FUSE_BUFVEC_INIT(segment.size);
+            src.buf[0] = segment;
+            src.off = skip;
+
+            ssize_t copied = fuse_buf_copy(&dst, &src, static_cast<fuse_buf_copy_flags>(0));
+            if (copied < 0) {
+                error = copied;
+                break;
+            }
+            len = static_cast<size_t>(copied);
+            data = scratch.data();
+        }
+
+        ssize_t written = static_accelerator_->writeFile(ino, data, len, pos);
+        if (written < 0) {
+            error = written;
+            break;
+        }
+        pos += written;
+        if (static_cast<size_t>(written) < len) {
+            break;
+        }
+    }
+
+    if (pos == offset && error < 0) {
+        fuse_reply_err(req, -error);
+        return;
+    }
+    fuse_reply_write(req, pos - offset);
 }
 
-int FuseInterface::create_callback(const char* path, mode_t mode,
-                                 struct fuse_file_info* fi) {
-    static_logger_->info("Creating file: " + std::string(path) + 
+void FuseInterface::create_callback(fuse_req_t req, fuse_ino_t parent, const char* name,
+                                    mode_t mode, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "create");
+    std::string path = resolve(req, parent, name);
+    if (path.empty()) {
+        return;
+    }
+    static_logger_->info("Creating file: " + path +
                         " with mode: " + std::to_string(mode));
+
     int ret = static_accelerator_->createFile(path, mode);
-    if (ret == 0) {
-        return open_callback(path, fi);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    auto metadata = static_accelerator_->getMetadata(path);
+    if (!metadata) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct fuse_entry_param entry;
+    fillEntry(*metadata, &entry);
+    fi->fh = reinterpret_cast<uint64_t>(new ReadStream());
+    fi->keep_cache = cache_options_.keep_cache;
+
+    static_accelerator_->lookupInode(metadata->ino);
+    static_accelerator_->openFile(metadata->ino);
+    if (fuse_reply_create(req, &entry, fi) != 0) {
+        static_accelerator_->releaseFile(metadata->ino);
+        static_accelerator_->forgetInode(metadata->ino, 1);
+        delete reinterpret_cast<ReadStream*>(fi->fh);
     }
-    return ret;
 }
 
-int FuseInterface::unlink_callback(const char* path) {
-    static_logger_->info("Deleting file: " + std::string(path));
-    return static_accelerator_->deleteFile(path);
+void FuseInterface::unlink_callback(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    TRACE_SCOPE("fuse", "unlink");
+    std::string path = resolve(req, parent, name);
+    if (path.empty()) {
+        return;
+    }
+    static_logger_->info("Deleting file: " + path);
+    fuse_reply_err(req, -static_accelerator_->deleteFile(path));
 }
 
-int FuseInterface::truncate_callback(const char* path, off_t size,
-                                   struct fuse_file_info* fi) {
-    return static_accelerator_->truncateFile(path, size);
+void FuseInterface::mkdir_callback(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+    TRACE_SCOPE("fuse", "mkdir");
+    std::string path = resolve(req, parent, name);
+    if (path.empty()) {
+        return;
+    }
+    static_logger_->info("Creating directory: " + path);
+
+    int ret = static_accelerator_->createDirectory(path, mode);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    replyEntry(req, path);
 }
 
-int FuseInterface::mkdir_callback(const char* path, mode_t mode) {
-    static_logger_->info("Creating directory: " + std::string(path));
-    return static_accelerator_->createDirectory(path, mode);
+void FuseInterface::rmdir_callback(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    TRACE_SCOPE("fuse", "rmdir");
+    std::string path = resolve(req, parent, name);
+    if (path.empty()) {
+        return;
+    }
+    fuse_reply_err(req, -static_accelerator_->removeDirectory(path));
 }
 
-int FuseInterface::rmdir_callback(const char* path) {
-    return static_accelerator_->removeDirectory(path);
+void FuseInterface::rename_callback(fuse_req_t req, fuse_ino_t parent, const char* name,
+                                    fuse_ino_t newparent, const char* newname, unsigned int flags) {
+    TRACE_SCOPE("fuse", "rename");
+    std::string from = resolve(req, parent, name);
+    if (from.empty()) {
+        return;
+    }
+    std::string to = resolve(req, newparent, newname);
+    if (to.empty()) {
+        return;
+    }
+    fuse_reply_err(req, -static_accelerator_->renameFile(from, to, flags));
 }
 
-int FuseInterface::rename_callback(const char* from, const char* to, unsigned int flags) {
-    return static_accelerator_->renameFile(from, to, flags);
+// Dirty blocks in the accelerator's write-back cache reach the drives on
+// close (flush) and fsync; release only queues them, nobody waits on it
+void FuseInterface::flush_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "flush");
+    fuse_reply_err(req, -static_accelerator_->flushFile(ino));
 }
 
-int FuseInterface::chmod_callback(const char* path, mode_t mode, struct fuse_file_info* fi) {
-    return static_accelerator_->chmodFile(path, mode);
+void FuseInterface::release_callback(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "release");
+    static_accelerator_->releaseFile(ino);
+    delete reinterpret_cast<ReadStream*>(fi->fh);
+    fuse_reply_err(req, 0);
 }
 
-int FuseInterface::chown_callback(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi) {
-    return static_accelerator_->chownFile(path, uid, gid);
+void FuseInterface::fsync_callback(fuse_req_t req, fuse_ino_t ino, int datasync,
+                                   struct fuse_file_info* fi) {
+    TRACE_SCOPE("fuse", "fsync");
+    fuse_reply_err(req, -static_accelerator_->syncFile(ino));
 }
 
-int FuseInterface::utimens_callback(const char* path, const struct timespec ts[2],
-                                  struct fuse_file_info* fi) {
-    return static_accelerator_->utimensFile(path, ts);
+void FuseInterface::setxattr_callback(fuse_req_t req, fuse_ino_t ino, const char* name,
+                                      const char* value, size_t size, int flags) {
+    TRACE_SCOPE("fuse", "setxattr");
+    if (strcmp(name, STRIPE_UNIT_XATTR) != 0) {
+        fuse_reply_err(req, ENOTSUP);
+        return;
+    }
+    std::string path = resolve(req, ino);
+    if (path.empty()) {
+        return;
+    }
+
+    std::string text(value, size);
+    char* end = nullptr;
+    unsigned long long unit = strtoull(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0') {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    fuse_reply_err(req, -static_accelerator_->setStripeUnit(path, unit));
+}
+
+void FuseInterface::getxattr_callback(fuse_req_t req, fuse_ino_t ino, const char* name, size_t size) {
+    TRACE_SCOPE("fuse", "getxattr");
+    if (strcmp(name, STRIPE_UNIT_XATTR) != 0) {
+        fuse_reply_err(req, ENODATA);
+        return;
+    }
+    std::string path = resolve(req, ino);
+    if (path.empty()) {
+        return;
+    }
+
+    size_t unit = 0;
+    int ret = static_accelerator_->getStripeUnit(path, unit);
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    // A zero size asks how large the value is
+    std::string text = std::to_string(unit);
+    if (size == 0) {
+        fuse_reply_xattr(req, text.size());
+    } else if (size < text.size()) {
+        fuse_reply_err(req, ERANGE);
+    } else {
+        fuse_reply_buf(req, text.data(), text.size());
+    }
 }
 
 void FuseInterface::run(int argc, char* argv[]) {
@@ -160,7 +551,7 @@ void FuseInterface::run(int argc, char* argv[]) {
     // Add allow_other and default_permissions if not already present
     bool has_allow_other = false;
     bool has_default_permissions = false;
-    
+
     for (int i = 0; i < args.argc; i++) {
         if (strstr(args.argv[i], "allow_other")) has_allow_other = true;
         if (strstr(args.argv[i], "default_permissions")) has_default_permissions = true;
@@ -170,7 +561,7 @@ void FuseInterface::run(int argc, char* argv[]) {
         fuse_opt_add_arg(&args, "-o");
         fuse_opt_add_arg(&args, "allow_other");
     }
-    
+
     if (!has_default_permissions) {
         fuse_opt_add_arg(&args, "-o");
         fuse_opt_add_arg(&args, "default_permissions");
@@ -179,26 +570,68 @@ void FuseInterface::run(int argc, char* argv[]) {
     // Set default umask to allow read/write for all users
     umask(0);
 
-    struct fuse_operations operations = {};
+    // The kernel only honours max_read when it is also a mount option
+    std::string max_read_option;
+    if (cache_options_.max_read > 0) {
+        max_read_option = "max_read=" + std::to_string(cache_options_.max_read);
+        fuse_opt_add_arg(&args, "-o");
+        fuse_opt_add_arg(&args, max_read_option.c_str());
+    }
+
+    struct fuse_cmdline_opts opts;
+    if (fuse_parse_cmdline(&args, &opts) != 0 || opts.mountpoint == nullptr) {
+        static_logger_->error("Failed to parse FUSE command line");
+        fuse_opt_free_args(&args);
+        return;
+    }
+
+    struct fuse_lowlevel_ops operations = {};
+    operations.init = init_callback;
+    operations.lookup = lookup_callback;
+    operations.forget = forget_callback;
+    operations.forget_multi = forget_multi_callback;
     operations.getattr = getattr_callback;
+    operations.setattr = setattr_callback;
     operations.readdir = readdir_callback;
     operations.open = open_callback;
     operations.read = read_callback;
     operations.write = write_callback;
+    operations.write_buf = write_buf_callback;
     operations.create = create_callback;
     operations.unlink = unlink_callback;
-    operations.truncate = truncate_callback;
     operations.mkdir = mkdir_callback;
     operations.rmdir = rmdir_callback;
     operations.rename = rename_callback;
-    operations.chmod = chmod_callback;
-    operations.chown = chown_callback;
-    operations.utimens = utimens_callback;
+    operations.flush = flush_callback;
+    operations.release = release_callback;
+    operations.fsync = fsync_callback;
+    operations.setxattr = setxattr_callback;
+    operations.getxattr = getxattr_callback;
+
+    int ret = 1;
+    struct fuse_session* session = fuse_session_new(&args, &operations, sizeof(operations), nullptr);
+    if (session != nullptr) {
+        if (fuse_set_signal_handlers(session) == 0) {
+            if (fuse_session_mount(session, opts.mountpoint) == 0) {
+                fuse_daemonize(opts.foreground);
+                // Workers are started as requests queue up; past
+                // max_idle_threads idle ones exit again
+                struct fuse_loop_config loop_config = {};
+                loop_config.clone_fd = opts.clone_fd;
+                loop_config.max_idle_threads = opts.max_idle_threads;
+                ret = opts.singlethread ? fuse_session_loop(session)
+                                        : fuse_session_loop_mt(session, &loop_config);
+                fuse_session_unmount(session);
+            }
+            fuse_remove_signal_handlers(session);
+        }
+        fuse_session_destroy(session);
+    }
 
-    int ret = fuse_main(args.argc, args.argv, &operations, nullptr);
+    free(opts.mountpoint);
     fuse_opt_free_args(&args);
 
     if (ret != 0) {
         static_logger_->error("FUSE main loop failed with error code: " + std::to_string(ret));
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,46 @@
+#include "hashing/consistent_hash_ring.h"
+#include "hashing/xxhash.h"
+#include <algorithm>
+
+ConsistentHashRing::ConsistentHashRing(size_t vnodes_per_drive)
+    : vnodes_(std::max<size_t>(vnodes_per_drive, 1)) {
+}
+
+void ConsistentHashRing::addDrive(size_t drive) {
+    if (contains(drive)) {
+        return;
+    }
+
+    // Point positions depend only on (drive, vnode), never on the other
+    // drives, which is what keeps unrelated keys in place
+    for (uint64_t vnode = 0; vnode < vnodes_; vnode++) {
+        uint64_t key[2] = {static_cast<uint64_t>(drive), vnode};
+        points_.emplace_back(XXH64(key, sizeof(key), 0), drive);
+    }
+    std::sort(points_.begin(), points_.end());
+    drives_.insert(std::upper_bound(drives_.begin(), drives_.end(), drive), drive);
+}
+
+void ConsistentHashRing::removeDrive(size_t drive) {
+    points_.erase(std::remove_if(points_.begin(), points_.end(),
+                                 [drive](const std::pair<uint64_t, size_t>& point) {
+                                     return point.second == drive;
+                                 }),
+                  points_.end());
+    drives_.erase(std::remove(drives_.begin(), drives_.end(), drive), drives_.end());
+}
+
+bool ConsistentHashRing::contains(size_t drive) const {
+    return std::binary_search(drives_.begin(), drives_.end(), drive);
+}
+
+size_t ConsistentHashRing::locate(uint64_t hash) const {
+    auto it = std::lower_bound(points_.begin(), points_.end(), hash,
+                               [](const std::pair<uint64_t, size_t>& point, uint64_t value) {
+                                   return point.first < value;
+                               });
+    if (it == points_.end()) {
+        it = points_.begin();  // Wrap around
+    }
+    return it->second;
+}
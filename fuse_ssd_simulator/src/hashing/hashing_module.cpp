@@ -1,4 +1,6 @@
 #include "hashing/hashing_module.h"
+// Inline XXH3 here so the per-block hashing loop is not a call per key
+#define XXH_INLINE_ALL
 #include "hashing/xxhash.h"
 
 HashingModule::HashingModule(const std::string& seed_str) {
@@ -9,3 +11,21 @@ HashingModule::HashingModule(const std::string& seed_str) {
 uint64_t HashingModule::hash(const std::string& input) const {
     return XXH64(input.c_str(), input.length(), seed_);
 }
+
+uint64_t HashingModule::fileKey(uint64_t file_id) const {
+    return XXH3_64bits_withSeed(&file_id, sizeof(file_id), seed_);
+}
+
+uint64_t HashingModule::hashBlock(uint64_t file_key, uint64_t block_index) const {
+    uint64_t key[2] = {file_key, block_index};
+    return XXH3_64bits_withSeed(key, sizeof(key), seed_);
+}
+
+void HashingModule::hashBlocks(uint64_t file_key, uint64_t first_block, size_t count,
+                               uint64_t* out) const {
+    // 16-byte inputs take XXH3's short-key path, a handful of multiplies each
+    uint64_t key[2] = {file_key, first_block};
+    for (size_t i = 0; i < count; i++, key[1]++) {
+        out[i] = XXH3_64bits_withSeed(key, sizeof(key), seed_);
+    }
+}
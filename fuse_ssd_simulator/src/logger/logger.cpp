@@ -1,78 +1,374 @@
 #include "logger/logger.h"
+#include "utils/mpsc_ring.h"
 #include <iostream>
+#include <fstream>
 #include <chrono>
 #include <ctime>
-#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
 
-std::unique_ptr<std::ofstream> Logger::global_log_stream_ = nullptr;
-std::mutex Logger::global_log_mutex_;
+std::atomic<int> Logger::min_level_{INFO};
 
-Logger::Logger(const std::string& component)
-    : component_(component) {
-}
+namespace {
 
-Logger::~Logger() {
+struct LogRecord {
+    std::chrono::system_clock::time_point time;
+    LogLevel level = INFO;
+    std::string component;
+    std::string message;
+};
+
+// One ring per logging thread. The owning thread is the only producer and
+// the writer thread the only consumer.
+struct ThreadBuffer {
+    static constexpr size_t RING_CAPACITY = 1024;
+
+    ThreadBuffer() : ring(RING_CAPACITY) {}
+
+    MpscRing<LogRecord> ring;
+    std::atomic<bool> retired{false};
+};
+
+class LogBackend {
+public:
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{5};
+
+    // Never destroyed: components log from static destructors, after which
+    // records are written synchronously instead
+    static LogBackend& instance() {
+        static LogBackend* backend = new LogBackend();
+        return *backend;
+    }
+
+    void open(const std::string& log_file);
+    void push(LogRecord&& record);
+    void flush();
+
+private:
+    LogBackend();
+
+    std::shared_ptr<ThreadBuffer> localBuffer();
+    void startWriter();
+    void run();
+    size_t drain(std::vector<LogRecord>& records);
+    void write(std::vector<LogRecord>& records);
+    void shutdown();
+
+    static void format(const LogRecord& record, std::string& out);
+    static void prepareFork();
+    static void parentAfterFork();
+    static void childAfterFork();
+
+    std::mutex buffers_mutex_;  // Thread registration only
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+
+    std::mutex io_mutex_;  // Held while draining and writing
+    std::unique_ptr<std::ofstream> file_;
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable flushed_cv_;
+    std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> written_{0};
+
+    std::thread* writer_ = nullptr;
+    std::atomic<bool> writer_running_{false};
+    std::atomic<bool> stopped_{false};
+};
+
+struct ThreadHandle {
+    std::shared_ptr<ThreadBuffer> buffer;
+    ~ThreadHandle() {
+        if (buffer) {
+            buffer->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadHandle thread_handle;
+
+LogBackend::LogBackend() {
+    startWriter();
+    pthread_atfork(prepareFork, parentAfterFork, childAfterFork);
+    std::atexit([]() { instance().shutdown(); });
 }
 
-void Logger::init(const std::string& log_file) {
-    std::lock_guard<std::mutex> lock(global_log_mutex_);
-    if (!global_log_stream_) {
-        global_log_stream_ = std::make_unique<std::ofstream>(log_file, std::ios::out | std::ios::app);
-        if (!global_log_stream_->is_open()) {
+void LogBackend::open(const std::string& log_file) {
+    std::lock_guard<std::mutex> lock(io_mutex_);
+    if (!file_) {
+        file_ = std::make_unique<std::ofstream>(log_file, std::ios::out | std::ios::app);
+        if (!file_->is_open()) {
             std::cerr << "Failed to open log file: " << log_file << std::endl;
             exit(1);
         }
     }
 }
 
-void Logger::info(const std::string& message) {
-    log(INFO, message);
+std::shared_ptr<ThreadBuffer> LogBackend::localBuffer() {
+    if (!thread_handle.buffer) {
+        thread_handle.buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers_.push_back(thread_handle.buffer);
+    }
+    return thread_handle.buffer;
+}
+
+void LogBackend::startWriter() {
+    writer_running_.store(true, std::memory_order_release);
+    writer_ = new std::thread(&LogBackend::run, this);
 }
 
-void Logger::debug(const std::string& message) {
-    log(DEBUG, message);
+void LogBackend::push(LogRecord&& record) {
+    if (stopped_.load(std::memory_order_acquire)) {
+        std::vector<LogRecord> records;
+        records.push_back(std::move(record));
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        write(records);
+        return;
+    }
+
+    // A forked child has no writer thread until the first record after fork
+    if (!writer_running_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        if (!writer_running_.load(std::memory_order_relaxed)) {
+            startWriter();
+        }
+    }
+
+    LogLevel level = record.level;
+    auto buffer = localBuffer();
+    while (!buffer->ring.tryPush(std::move(record))) {
+        // Full ring: apply back-pressure rather than drop the message
+        wake_cv_.notify_one();
+        std::this_thread::yield();
+    }
+    pushed_.fetch_add(1, std::memory_order_release);
+
+    // Errors are written promptly instead of waiting for the next interval
+    if (level == ERROR) {
+        wake_cv_.notify_one();
+    }
 }
 
-void Logger::error(const std::string& message) {
-    log(ERROR, message);
+void LogBackend::flush() {
+    if (stopped_.load(std::memory_order_acquire)) {
+        return;
+    }
+    uint64_t target = pushed_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_cv_.notify_one();
+    flushed_cv_.wait(lock, [&]() {
+        return written_.load(std::memory_order_acquire) >= target;
+    });
 }
 
-void Logger::log(LogLevel level, const std::string& message) {
-    std::lock_guard<std::mutex> lock(global_log_mutex_);
-    
-    // Get current time with milliseconds
-    auto now = std::chrono::system_clock::now();
-    auto now_c = std::chrono::system_clock::to_time_t(now);
+size_t LogBackend::drain(std::vector<LogRecord>& records) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        // Threads that have exited and been fully drained are dropped
+        buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(),
+                                      [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                                          return buffer->retired.load(std::memory_order_acquire) &&
+                                                 buffer->ring.empty();
+                                      }),
+                       buffers_.end());
+        buffers = buffers_;
+    }
+
+    size_t count = 0;
+    LogRecord record;
+    for (auto& buffer : buffers) {
+        while (buffer->ring.tryPop(record)) {
+            records.push_back(std::move(record));
+            count++;
+        }
+    }
+    return count;
+}
+
+void LogBackend::write(std::vector<LogRecord>& records) {
+    // Rings are drained one thread at a time, restore global order
+    std::stable_sort(records.begin(), records.end(),
+                     [](const LogRecord& a, const LogRecord& b) { return a.time < b.time; });
+
+    std::string batch;
+    batch.reserve(records.size() * 128);
+    for (const auto& record : records) {
+        format(record, batch);
+    }
+
+    // One write and one flush per batch, not per message
+    std::cout.write(batch.data(), batch.size());
+    std::cout.flush();
+    if (file_ && file_->is_open()) {
+        file_->write(batch.data(), batch.size());
+        file_->flush();
+    }
+}
+
+void LogBackend::run() {
+    std::vector<LogRecord> records;
+    while (true) {
+        size_t count;
+        {
+            std::lock_guard<std::mutex> lock(io_mutex_);
+            records.clear();
+            count = drain(records);
+            if (count > 0) {
+                write(records);
+            }
+        }
+
+        if (count > 0) {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                written_.fetch_add(count, std::memory_order_release);
+            }
+            flushed_cv_.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        if (!writer_running_.load(std::memory_order_relaxed)) {
+            break;
+        }
+        wake_cv_.wait_for(lock, FLUSH_INTERVAL);
+    }
+}
+
+void LogBackend::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        if (!writer_running_.load(std::memory_order_relaxed)) {
+            stopped_.store(true, std::memory_order_release);
+            return;
+        }
+        writer_running_.store(false, std::memory_order_relaxed);
+    }
+    wake_cv_.notify_one();
+    writer_->join();
+    delete writer_;
+    writer_ = nullptr;
+
+    // Later records are written inline; pick up anything that raced in
+    stopped_.store(true, std::memory_order_release);
+    std::vector<LogRecord> records;
+    std::lock_guard<std::mutex> lock(io_mutex_);
+    if (drain(records) > 0) {
+        write(records);
+    }
+}
+
+void LogBackend::format(const LogRecord& record, std::string& out) {
+    auto now_c = std::chrono::system_clock::to_time_t(record.time);
     auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-        now.time_since_epoch()) % 1000;
+        record.time.time_since_epoch()) % 1000;
 
-    // Format time string
-    std::stringstream time_str;
-    time_str << std::put_time(std::localtime(&now_c), "%Y-%m-%d %H:%M:%S")
-             << '.' << std::setfill('0') << std::setw(3) << now_ms.count();
+    struct tm local_time;
+    localtime_r(&now_c, &local_time);
+    char time_str[32];
+    size_t length = strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local_time);
+    snprintf(time_str + length, sizeof(time_str) - length, ".%03d", static_cast<int>(now_ms.count()));
 
-    // Convert LogLevel to string
-    std::string level_str;
-    switch (level) {
+    const char* level_str;
+    switch (record.level) {
         case INFO:  level_str = "INFO "; break;
         case DEBUG: level_str = "DEBUG"; break;
         case ERROR: level_str = "ERROR"; break;
         default:    level_str = "?????"; break;
     }
 
-    // Format the log message
-    std::stringstream log_stream;
-    log_stream << "[" << time_str.str() << "] "
-               << "[" << component_ << "] "
-               << "[" << level_str << "] "
-               << message;
+    out += "[";
+    out += time_str;
+    out += "] [";
+    out += record.component;
+    out += "] [";
+    out += level_str;
+    out += "] ";
+    out += record.message;
+    out += '\n';
+}
+
+// The writer must not hold a lock or be halfway through a ring across fork
+void LogBackend::prepareFork() {
+    LogBackend& backend = instance();
+    backend.io_mutex_.lock();
+    backend.buffers_mutex_.lock();
+    backend.wake_mutex_.lock();
+}
+
+void LogBackend::parentAfterFork() {
+    LogBackend& backend = instance();
+    backend.wake_mutex_.unlock();
+    backend.buffers_mutex_.unlock();
+    backend.io_mutex_.unlock();
+}
+
+void LogBackend::childAfterFork() {
+    LogBackend& backend = instance();
+    // Only the forking thread survives; its writer is restarted lazily
+    backend.writer_ = nullptr;
+    backend.writer_running_.store(false, std::memory_order_relaxed);
+    for (auto& buffer : backend.buffers_) {
+        if (buffer != thread_handle.buffer) {
+            buffer->retired.store(true, std::memory_order_relaxed);
+        }
+    }
+    backend.wake_mutex_.unlock();
+    backend.buffers_mutex_.unlock();
+    backend.io_mutex_.unlock();
+}
+
+}  // namespace
+
+Logger::Logger(const std::string& component)
+    : component_(component) {
+}
+
+Logger::~Logger() {
+}
 
-    // Write to console
-    std::cout << log_stream.str() << std::endl;
+void Logger::init(const std::string& log_file) {
+    LogBackend::instance().open(log_file);
+}
 
-    // Write to log file if available
-    if (global_log_stream_ && global_log_stream_->is_open()) {
-        (*global_log_stream_) << log_stream.str() << std::endl;
-        global_log_stream_->flush();  // Ensure it's written immediately
+void Logger::setLevel(LogLevel level) {
+    min_level_.store(level, std::memory_order_relaxed);
+}
+
+void Logger::flush() {
+    LogBackend::instance().flush();
+}
+
+void Logger::info(std::string message) {
+    log(INFO, std::move(message));
+}
+
+void Logger::debug(std::string message) {
+    log(DEBUG, std::move(message));
+}
+
+void Logger::error(std::string message) {
+    log(ERROR, std::move(message));
+}
+
+void Logger::log(LogLevel level, std::string&& message) {
+    if (!enabled(level)) {
+        return;
     }
-}
\ No newline at end of file
+
+    LogRecord record;
+    record.time = std::chrono::system_clock::now();
+    record.level = level;
+    record.component = component_;
+    record.message = std::move(message);
+    LogBackend::instance().push(std::move(record));
+}
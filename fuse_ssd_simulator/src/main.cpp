@@ -1,16 +1,50 @@
 #include "fuse_interface.h"
 #include "storage_accelerator/storage_accelerator.h"
+#include "config/config.h"
 #include "logger/logger.h"
+#include "monitoring/monitor.h"
+#include "utils/trace.h"
 #include <iostream>
 #include <memory>
 #include <cstring>
 #include <filesystem>
+#include <sstream>
 #include <system_error>
 #include <signal.h>
 
 static std::shared_ptr<FuseInterface> fuse_interface_ptr;
 static Logger* signal_logger = nullptr;
 
+// Apply a comma separated -o list. Settings of the accelerator, kernel
+// caching and config=FILE are taken here, everything else is left for FUSE.
+static bool applyMountOptions(AcceleratorConfig& config, FuseCacheOptions& cache_options,
+                              const std::string& list, std::string& fuse_options) {
+    std::stringstream items(list);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        size_t equals = item.find('=');
+        std::string key = item.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : item.substr(equals + 1);
+
+        std::string error;
+        int ret = key == "config" ? loadConfigFile(config, value, error, &cache_options)
+                                  : applyConfigOption(config, key, value, error);
+        if (ret == -ENOENT && key != "config") {
+            ret = applyFuseOption(cache_options, key, value, error);
+        }
+        if (ret == -ENOENT && key != "config") {
+            fuse_options += (fuse_options.empty() ? "" : ",") + item;
+        } else if (ret < 0) {
+            std::cerr << "Error: " << error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 void signal_handler(int sig) {
     if (signal_logger) {
         signal_logger->info("Received signal " + std::to_string(sig) + ", cleaning up...");
@@ -23,44 +57,113 @@ void signal_handler(int sig) {
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <mount_point> [-f] [-d]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <mount_point> [-f] [-d] [-w] [-p DIR] [-t N] [-a] [-D] [-s N] [-o OPTIONS]" << std::endl;
         std::cerr << "Options:" << std::endl;
         std::cerr << "  -f  Keep program in foreground" << std::endl;
         std::cerr << "  -d  Enable debug output" << std::endl;
+        std::cerr << "  -w  Write-back block cache, data reaches the drives on close or fsync" << std::endl;
+        std::cerr << "  -p DIR  Keep drive contents and metadata in DIR across restarts" << std::endl;
+        std::cerr << "  -t N  Keep at most N idle FUSE worker threads" << std::endl;
+        std::cerr << "  -a  Pin drive and pool threads to the NUMA nodes of the drives" << std::endl;
+        std::cerr << "  -D  Store identical blocks once, not with -p" << std::endl;
+        std::cerr << "  -s N  Keep files of up to N bytes (at most one block) with their metadata" << std::endl;
+        std::cerr << "  -o OPTIONS  Comma separated key=value settings such as drives=8,"
+                     "block_size=4K,stripe_unit=1M,attr_timeout=5; config=FILE reads"
+                     " them from FILE, anything else goes to FUSE" << std::endl;
         return 1;
     }
 
     try {
-        // Set up signal handling
-        signal_logger = new Logger("SignalHandler");
-        signal(SIGINT, signal_handler);
-        signal(SIGTERM, signal_handler);
-        signal(SIGHUP, signal_handler);
+        // Daemonizing changes to /, so every path is made absolute first
+        std::filesystem::path work_dir = std::filesystem::current_path();
+        std::string mount_point = std::filesystem::absolute(argv[1]).string();
 
-        std::string mount_point = argv[1];
-        
-        // Initialize logging
-        std::filesystem::path log_path = std::filesystem::current_path() / "filesystem.log";
-        Logger::init(log_path.string());
-        Logger logger("Main");
-        logger.info("Starting FUSE SSD Simulator");
+        bool foreground = false;
+        bool debug = false;
+        std::string max_idle_threads;
+        std::string fuse_options;
+        AcceleratorConfig config;
+        FuseCacheOptions cache_options;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-f") == 0) {
+                foreground = true;
+            }
+            if (strcmp(argv[i], "-d") == 0) {
+                foreground = true;  // As libfuse does for -d
+                debug = true;
+            }
+            if (strcmp(argv[i], "-w") == 0) {
+                config.cache.write_back = true;
+            }
+            if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+                config.persistence.directory = argv[++i];
+            }
+            if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                max_idle_threads = "max_idle_threads=" + std::string(argv[++i]);
+            }
+            if (strcmp(argv[i], "-a") == 0) {
+                config.threading.pin_threads = true;
+            }
+            if (strcmp(argv[i], "-D") == 0) {
+                config.dedup.enabled = true;
+            }
+            if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                config.small_files.inline_limit = std::stoul(argv[++i]);
+            }
+            if (strcmp(argv[i], "-o") == 0 && i + 1 < argc &&
+                !applyMountOptions(config, cache_options, argv[++i], fuse_options)) {
+                return 1;
+            }
+        }
+        if (!config.persistence.directory.empty()) {
+            config.persistence.directory =
+                std::filesystem::absolute(config.persistence.directory).string();
+        }
 
         // Check mount point
         if (!std::filesystem::exists(mount_point)) {
-            logger.error("Mount point does not exist: " + mount_point);
+            std::cerr << "Mount point does not exist: " << mount_point << std::endl;
             return 1;
         }
 
         if (!std::filesystem::is_directory(mount_point)) {
-            logger.error("Mount point is not a directory: " + mount_point);
+            std::cerr << "Mount point is not a directory: " << mount_point << std::endl;
+            return 1;
+        }
+
+        // Fork before any thread starts, only the forking thread would
+        // survive it. FUSE then runs in the daemon's foreground.
+        if (!foreground && fuse_daemonize(0) != 0) {
+            std::cerr << "Failed to daemonize" << std::endl;
             return 1;
         }
 
+        // Set up signal handling
+        signal_logger = new Logger("SignalHandler");
+        signal(SIGINT, signal_handler);
+        signal(SIGTERM, signal_handler);
+        signal(SIGHUP, signal_handler);
+
+        // Initialize logging
+        std::filesystem::path log_path = work_dir / "filesystem.log";
+        Logger::init(log_path.string());
+        if (debug) {
+            Logger::setLevel(DEBUG);
+        }
+        Logger logger("Main");
+        logger.info("Starting FUSE SSD Simulator");
+
         // Initialize storage
-        int num_drives = 16;
-        std::string hash_seed = "default_seed";
-        auto accelerator = std::make_shared<StorageAccelerator>(num_drives, hash_seed);
-        logger.info("Storage Accelerator initialized with " + std::to_string(num_drives) + " drives");
+        auto accelerator = std::make_shared<StorageAccelerator>(config);
+        logger.info("Storage Accelerator initialized with " + std::to_string(config.num_drives) +
+                    " drives, " + std::to_string(config.drives.block_size) + " byte blocks, " +
+                    std::to_string(accelerator->defaultStripeUnit()) + " byte stripe units");
+
+        // Prometheus metrics are refreshed next to the log file
+        Logger monitor_logger("Monitor");
+        std::filesystem::path metrics_path = work_dir / "metrics.prom";
+        Monitor monitor(accelerator, &monitor_logger, metrics_path.string());
+        monitor.start();
 
         // Prepare FUSE arguments
         std::vector<char*> fuse_args;
@@ -73,26 +176,30 @@ int main(int argc, char* argv[]) {
         fuse_args.push_back(const_cast<char*>("-o"));
         fuse_args.push_back(const_cast<char*>("default_permissions"));
         
-        // Process command line options
-        bool foreground = false;
-        for (int i = 2; i < argc; i++) {
-            if (strcmp(argv[i], "-f") == 0) {
-                foreground = true;
-                fuse_args.push_back(const_cast<char*>("-f"));
-            }
-            if (strcmp(argv[i], "-d") == 0) {
-                fuse_args.push_back(const_cast<char*>("-d"));
-            }
+        // Already daemonized above if that was wanted
+        fuse_args.push_back(const_cast<char*>("-f"));
+        if (debug) {
+            fuse_args.push_back(const_cast<char*>("-d"));
+        }
+        if (!max_idle_threads.empty()) {
+            fuse_args.push_back(const_cast<char*>("-o"));
+            fuse_args.push_back(const_cast<char*>(max_idle_threads.c_str()));
+        }
+        if (!fuse_options.empty()) {
+            fuse_args.push_back(const_cast<char*>("-o"));
+            fuse_args.push_back(const_cast<char*>(fuse_options.c_str()));
         }
 
         // Initialize FUSE interface
-        auto interface = std::make_shared<FuseInterface>(mount_point, accelerator);
+        auto interface = std::make_shared<FuseInterface>(mount_point, accelerator, cache_options);
         fuse_interface_ptr = interface;
         logger.info("Mounting FUSE filesystem at " + mount_point);
         
         // Run FUSE
         interface->run(fuse_args.size(), fuse_args.data());
-        
+
+        monitor.stop();
+        TRACE_DUMP((work_dir / "trace.json").string());
         return 0;
     }
     catch (const std::exception& e) {
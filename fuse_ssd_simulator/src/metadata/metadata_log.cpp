@@ -0,0 +1,292 @@
+#include "metadata/metadata_log.h"
+#include "hashing/xxhash.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Record frame: payload length, sequence, checksum of both, payload
+constexpr size_t FRAME_HEADER = sizeof(uint32_t) + 2 * sizeof(uint64_t);
+constexpr size_t MAX_PAYLOAD = 1 << 20;
+
+template <typename T>
+void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, const std::string& value) {
+    put<uint32_t>(out, value.size());
+    out += value;
+}
+
+// Bounds-checked reads from a payload
+struct Reader {
+    const char* at;
+    const char* end;
+    bool ok = true;
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (end - at < static_cast<ptrdiff_t>(sizeof(T))) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+
+    std::string getString() {
+        uint32_t size = get<uint32_t>();
+        if (!ok || end - at < static_cast<ptrdiff_t>(size)) {
+            ok = false;
+            return std::string();
+        }
+        std::string value(at, size);
+        at += size;
+        return value;
+    }
+};
+
+uint64_t checksum(uint64_t sequence, const char* payload, size_t size) {
+    return XXH3_64bits_withSeed(payload, size, sequence);
+}
+
+// Whole file into contents; a missing file reads as empty
+int readAll(const std::string& path, std::string& contents) {
+    contents.clear();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -errno;
+    }
+
+    char buffer[1 << 16];
+    ssize_t bytes;
+    while ((bytes = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        contents.append(buffer, bytes);
+    }
+    int error = bytes < 0 ? -errno : 0;
+    ::close(fd);
+    return error;
+}
+
+int writeAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t bytes = ::write(fd, data.data() + done, data.size() - done);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        done += bytes;
+    }
+    return 0;
+}
+
+}  // namespace
+
+MetadataLog::~MetadataLog() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void MetadataLog::encode(const Record& record, uint64_t sequence, std::string& out) {
+    std::string payload;
+    const FileMetadata& m = record.metadata;
+    put<uint8_t>(payload, static_cast<uint8_t>(record.type));
+    putString(payload, record.path);
+    putString(payload, record.new_path);
+    put<uint32_t>(payload, record.flags);
+    put<uint8_t>(payload, record.directory);
+    put<uint64_t>(payload, m.ino);
+    put<uint32_t>(payload, m.mode.load());
+    put<uint64_t>(payload, m.nlink.load());
+    put<uint32_t>(payload, m.uid.load());
+    put<uint32_t>(payload, m.gid.load());
+    put<int64_t>(payload, m.size.load());
+    put<int64_t>(payload, m.atime.load());
+    put<int64_t>(payload, m.mtime.load());
+    put<int64_t>(payload, m.ctime.load());
+    put<uint64_t>(payload, record.next_ino);
+    auto contents = std::atomic_load(&m.inline_data);
+    put<uint8_t>(payload, contents != nullptr);
+    putString(payload, contents ? *contents : std::string());
+    put<uint64_t>(payload, m.stripe_unit.load());
+
+    put<uint32_t>(out, payload.size());
+    put<uint64_t>(out, sequence);
+    put<uint64_t>(out, checksum(sequence, payload.data(), payload.size()));
+    out += payload;
+}
+
+bool MetadataLog::decode(const char* data, size_t size, size_t& used, uint64_t& sequence,
+                         Record& record) {
+    Reader frame{data, data + size};
+    uint32_t length = frame.get<uint32_t>();
+    sequence = frame.get<uint64_t>();
+    uint64_t sum = frame.get<uint64_t>();
+    if (!frame.ok || length > MAX_PAYLOAD || size - FRAME_HEADER < length ||
+        checksum(sequence, frame.at, length) != sum) {
+        return false;
+    }
+
+    Reader in{frame.at, frame.at + length};
+    FileMetadata& m = record.metadata;
+    record.type = static_cast<RecordType>(in.get<uint8_t>());
+    record.path = in.getString();
+    record.new_path = in.getString();
+    record.flags = in.get<uint32_t>();
+    record.directory = in.get<uint8_t>() != 0;
+    m.ino = in.get<uint64_t>();
+    m.mode = in.get<uint32_t>();
+    m.nlink = in.get<uint64_t>();
+    m.uid = in.get<uint32_t>();
+    m.gid = in.get<uint32_t>();
+    m.size = in.get<int64_t>();
+    m.atime = in.get<int64_t>();
+    m.mtime = in.get<int64_t>();
+    m.ctime = in.get<int64_t>();
+    record.next_ino = in.get<uint64_t>();
+    // Fields added later; older records end before them
+    if (in.at < in.end) {
+        bool inlined = in.get<uint8_t>() != 0;
+        std::string contents = in.getString();
+        if (inlined) {
+            m.inline_data = std::make_shared<const std::string>(std::move(contents));
+        }
+    }
+    if (in.at < in.end) {
+        m.stripe_unit = in.get<uint64_t>();
+    }
+    used = FRAME_HEADER + length;
+    return in.ok;
+}
+
+int MetadataLog::open(const std::string& directory, const Apply& apply) {
+    // Not locked: apply takes the caller's locks, and nothing appends before
+    // open returns
+    directory_ = directory;
+    std::string contents;
+
+    // The checkpoint was renamed into place complete, so damage is an error
+    int ret = readAll(directory_ + "/metadata.table", contents);
+    if (ret < 0) {
+        return ret;
+    }
+    uint64_t base = 0;
+    for (size_t pos = 0; pos < contents.size();) {
+        size_t used = 0;
+        Record record;
+        if (!decode(contents.data() + pos, contents.size() - pos, used, base, record)) {
+            return -EIO;
+        }
+        apply(record);
+        pos += used;
+    }
+
+    // Records up to base are already in the checkpoint; they remain in the
+    // log if a crash came between writing the checkpoint and emptying it
+    ret = readAll(directory_ + "/metadata.log", contents);
+    if (ret < 0) {
+        return ret;
+    }
+    sequence_ = base;
+    size_t valid = 0;
+    while (valid < contents.size()) {
+        size_t used = 0;
+        uint64_t sequence = 0;
+        Record record;
+        if (!decode(contents.data() + valid, contents.size() - valid, used, sequence, record)) {
+            break;
+        }
+        if (sequence > base) {
+            apply(record);
+            sequence_ = sequence;
+        }
+        valid += used;
+    }
+
+    fd_ = ::open((directory_ + "/metadata.log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+        return -errno;
+    }
+    if (valid < contents.size() && ftruncate(fd_, valid) != 0) {
+        return -errno;  // A torn tail must not sit in front of new records
+    }
+    log_bytes_ = valid;
+    return 0;
+}
+
+int MetadataLog::appendLocked(const Record& record) {
+    std::string frame;
+    encode(record, sequence_ + 1, frame);
+    int ret = writeAll(fd_, frame);
+    if (ret < 0) {
+        return ret;
+    }
+    sequence_++;
+    log_bytes_.fetch_add(frame.size(), std::memory_order_relaxed);
+    return 0;
+}
+
+int MetadataLog::append(const Record& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appendLocked(record);
+}
+
+int MetadataLog::appendAttributes(const FileMetadata& metadata) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Record record;
+    record.type = RecordType::ATTRIBUTES;
+    record.metadata = metadata;
+    return appendLocked(record);
+}
+
+int MetadataLog::checkpoint(const std::function<void(const Apply& emit)>& table) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string contents;
+    table([&](const Record& record) { encode(record, sequence_, contents); });
+
+    std::string path = directory_ + "/metadata.table";
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    int ret = writeAll(fd, contents);
+    if (ret == 0 && fdatasync(fd) != 0) {
+        ret = -errno;
+    }
+    ::close(fd);
+    if (ret == 0 && rename(temporary.c_str(), path.c_str()) != 0) {
+        ret = -errno;
+    }
+    if (ret < 0) {
+        unlink(temporary.c_str());
+        return ret;
+    }
+
+    // The rename must be on disk before the log it replaces is emptied
+    int dir = ::open(directory_.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir >= 0) {
+        fsync(dir);
+        ::close(dir);
+    }
+    if (ftruncate(fd_, 0) != 0) {
+        return -errno;
+    }
+    log_bytes_ = 0;
+    return 0;
+}
+
+int MetadataLog::sync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return fdatasync(fd_) == 0 ? 0 : -errno;
+}
@@ -1,5 +1,8 @@
 #include "metadata/metadata_manager.h"
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>     // For RENAME_NOREPLACE, RENAME_EXCHANGE
+#include <unordered_set>
 #include <sys/stat.h> // For S_IFDIR
 #include <unistd.h>   // For getuid(), getgid()
 
@@ -12,56 +15,544 @@ MetadataManager::MetadataManager() {
     root_metadata.uid = getuid();
     root_metadata.gid = getgid();
     root_metadata.size = 0;
-    time(&root_metadata.atime);
-    time(&root_metadata.mtime);
-    time(&root_metadata.ctime);
+    root_metadata.atime = time(nullptr);
+    root_metadata.mtime = root_metadata.atime.load();
+    root_metadata.ctime = root_metadata.atime.load();
+    root_metadata.ino = ROOT_INO;
 
-    metadata_map_["/"] = root_metadata;
+    addMetadata("/", root_metadata);
 }
 
 MetadataManager::~MetadataManager() {
     // Cleanup if necessary
 }
 
+MetadataManager::Shard& MetadataManager::shardFor(const std::string& path) {
+    return shards_[std::hash<std::string>{}(path) % NUM_SHARDS];
+}
+
+MetadataManager::InodeShard& MetadataManager::inodeShardFor(uint64_t ino) {
+    return inode_shards_[ino % NUM_SHARDS];
+}
+
+void MetadataManager::lockShards(Shard& a, Shard& b,
+                                 std::unique_lock<std::shared_mutex>& lock_a,
+                                 std::unique_lock<std::shared_mutex>& lock_b) {
+    lock_a = std::unique_lock<std::shared_mutex>(a.mutex, std::defer_lock);
+    if (&a == &b) {
+        lock_a.lock();
+        return;
+    }
+    lock_b = std::unique_lock<std::shared_mutex>(b.mutex, std::defer_lock);
+    std::lock(lock_a, lock_b);
+}
+
+std::string MetadataManager::parentOf(const std::string& path) {
+    size_t pos = path.find_last_of('/');
+    if (pos == std::string::npos || pos == 0) {
+        return "/";
+    }
+    return path.substr(0, pos);
+}
+
+std::string MetadataManager::nameOf(const std::string& path) {
+    return path.substr(path.find_last_of('/') + 1);
+}
+
+void MetadataManager::insertLocked(const std::string& path, std::shared_ptr<FileMetadata> entry) {
+    // Inode numbers are assigned before the entry is published
+    if (entry->ino == 0) {
+        entry->ino = next_ino_.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t ino = entry->ino;
+
+    shardFor(path).entries[path] = entry;
+    if (path != "/") {
+        shardFor(parentOf(path)).children[parentOf(path)][nameOf(path)] = ino;
+    }
+
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    inodes.entries[ino] = {path, std::move(entry)};
+}
+
+bool MetadataManager::unlinkInode(uint64_t ino, const std::string& path) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto inode = inodes.entries.find(ino);
+    // After a rename the inode already points at its new path
+    if (inode == inodes.entries.end() || inode->second.path != path) {
+        return false;
+    }
+    if (inodes.lookups.count(ino) || inodes.handles.count(ino)) {
+        inode->second.path.clear();
+        inode->second.entry->nlink = 0;
+        return false;
+    }
+    inodes.entries.erase(inode);
+    return true;
+}
+
+bool MetadataManager::eraseLocked(const std::string& path) {
+    Shard& shard = shardFor(path);
+    auto it = shard.entries.find(path);
+    if (it == shard.entries.end()) {
+        return false;
+    }
+
+    bool dropped = unlinkInode(it->second->ino, path);
+    shard.entries.erase(it);
+
+    if (path != "/") {
+        Shard& parent_shard = shardFor(parentOf(path));
+        auto parent = parent_shard.children.find(parentOf(path));
+        if (parent != parent_shard.children.end()) {
+            parent->second.erase(nameOf(path));
+            if (parent->second.empty()) {
+                parent_shard.children.erase(parent);
+            }
+        }
+    }
+    return dropped;
+}
+
 void MetadataManager::addMetadata(const std::string& path, const FileMetadata& metadata) {
-    metadata_map_[path] = metadata;
+    std::shared_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+    std::unique_lock<std::shared_mutex> lock, parent_lock;
+    lockShards(shardFor(path), shardFor(parentOf(path)), lock, parent_lock);
+    insertLocked(path, std::make_shared<FileMetadata>(metadata));
 }
 
 void MetadataManager::removeMetadata(const std::string& path) {
-    metadata_map_.erase(path);
+    std::shared_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+    std::unique_lock<std::shared_mutex> lock, parent_lock;
+    lockShards(shardFor(path), shardFor(parentOf(path)), lock, parent_lock);
+    eraseLocked(path);
 }
 
 std::shared_ptr<FileMetadata> MetadataManager::getMetadata(const std::string& path) {
-    auto it = metadata_map_.find(path);
-    if (it != metadata_map_.end()) {
-        return std::make_shared<FileMetadata>(it->second);
+    Shard& shard = shardFor(path);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.entries.find(path);
+    if (it != shard.entries.end()) {
+        return it->second;
     }
     return nullptr;
 }
 
 bool MetadataManager::exists(const std::string& path) {
-    return metadata_map_.find(path) != metadata_map_.end();
+    Shard& shard = shardFor(path);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.entries.find(path) != shard.entries.end();
+}
+
+int MetadataManager::createMetadata(const std::string& path, const FileMetadata& metadata) {
+    std::shared_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+    std::string parent_path = parentOf(path);
+    Shard& shard = shardFor(path);
+    Shard& parent_shard = shardFor(parent_path);
+    std::unique_lock<std::shared_mutex> lock, parent_lock;
+    lockShards(shard, parent_shard, lock, parent_lock);
+
+    if (shard.entries.count(path)) {
+        return -EEXIST;
+    }
+    auto parent = parent_shard.entries.find(parent_path);
+    if (parent == parent_shard.entries.end()) {
+        return -ENOENT;
+    }
+    if ((parent->second->mode & S_IFMT) != S_IFDIR) {
+        return -ENOTDIR;
+    }
+
+    auto entry = std::make_shared<FileMetadata>(metadata);
+    if (entry->ino == 0) {
+        entry->ino = next_ino_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (log_) {
+        MetadataLog::Record record;
+        record.type = MetadataLog::RecordType::CREATE;
+        record.path = path;
+        record.metadata = *entry;
+        int ret = log_->append(record);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    insertLocked(path, std::move(entry));
+    return 0;
+}
+
+int MetadataManager::unlinkMetadata(const std::string& path, bool directory,
+                                    std::shared_ptr<FileMetadata>* removed) {
+    if (path == "/") {
+        return -EBUSY;
+    }
+
+    std::shared_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+    Shard& shard = shardFor(path);
+    std::unique_lock<std::shared_mutex> lock, parent_lock;
+    lockShards(shard, shardFor(parentOf(path)), lock, parent_lock);
+
+    auto it = shard.entries.find(path);
+    if (it == shard.entries.end()) {
+        return -ENOENT;
+    }
+
+    bool is_directory = (it->second->mode & S_IFMT) == S_IFDIR;
+    if (directory && !is_directory) {
+        return -ENOTDIR;
+    }
+    if (!directory && is_directory) {
+        return -EISDIR;
+    }
+    // The child set of a directory lives in the directory's own shard
+    if (directory && shard.children.count(path)) {
+        return -ENOTEMPTY;
+    }
+
+    if (log_) {
+        MetadataLog::Record record;
+        record.type = MetadataLog::RecordType::UNLINK;
+        record.path = path;
+        record.directory = directory;
+        int ret = log_->append(record);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    auto entry = it->second;
+    if (eraseLocked(path) && removed) {
+        *removed = std::move(entry);
+    }
+    return 0;
 }
 
 std::vector<std::string> MetadataManager::listDirectory(const std::string& path) {
-    std::vector<std::string> entries;
-    std::string prefix = path;
-    if (prefix.back() != '/') {
-        prefix += "/";
-    }
-
-    for (const auto& [key, value] : metadata_map_) {
-        if (key.find(prefix) == 0 && key != prefix) {
-            std::string remaining = key.substr(prefix.length());
-            size_t pos = remaining.find('/');
-            if (pos != std::string::npos) {
-                remaining = remaining.substr(0, pos);
-            }
-            if (!remaining.empty() && std::find(entries.begin(), entries.end(), remaining) == entries.end()) {
-                entries.push_back(remaining);
-            }
+    Shard& shard = shardFor(path);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.children.find(path);
+    if (it == shard.children.end()) {
+        return {};
+    }
+    std::vector<std::string> names;
+    names.reserve(it->second.size());
+    for (const auto& child : it->second) {
+        names.push_back(child.first);
+    }
+    return names;
+}
+
+std::vector<DirectoryEntry> MetadataManager::listEntries(const std::string& path) {
+    std::vector<std::pair<std::string, uint64_t>> children;
+    {
+        Shard& shard = shardFor(path);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.children.find(path);
+        if (it == shard.children.end()) {
+            return {};
         }
+        children.assign(it->second.begin(), it->second.end());
     }
 
+    // Inode shards are taken one at a time, after the directory's is released
+    std::vector<DirectoryEntry> entries;
+    entries.reserve(children.size());
+    for (auto& child : children) {
+        auto metadata = getMetadata(child.second);
+        if (metadata) {
+            entries.push_back({std::move(child.first), std::move(metadata)});
+        }
+    }
     return entries;
 }
+
+bool MetadataManager::hasChildren(const std::string& path) {
+    Shard& shard = shardFor(path);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.children.find(path);
+    return it != shard.children.end() && !it->second.empty();
+}
+
+std::vector<std::string> MetadataManager::listSubtree(const std::string& path) {
+    std::vector<std::string> subtree;
+    if (!exists(path)) {
+        return subtree;
+    }
+
+    subtree.push_back(path);
+    for (size_t i = 0; i < subtree.size(); i++) {
+        std::string prefix = subtree[i] == "/" ? "/" : subtree[i] + "/";
+        for (const auto& name : listDirectory(subtree[i])) {
+            subtree.push_back(prefix + name);
+        }
+    }
+    return subtree;
+}
+
+int MetadataManager::renameMetadata(const std::string& path, const std::string& new_path,
+                                    unsigned int flags, std::shared_ptr<FileMetadata>* replaced) {
+    if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) ||
+        ((flags & RENAME_NOREPLACE) && (flags & RENAME_EXCHANGE))) {
+        return -EINVAL;
+    }
+    bool exchange = flags & RENAME_EXCHANGE;
+
+    std::unique_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+
+    auto source = getMetadata(path);
+    if (!source) {
+        return -ENOENT;
+    }
+    if (path == "/" || new_path == "/" ||
+        new_path.compare(0, path.length() + 1, path + "/") == 0 ||
+        (exchange && path.compare(0, new_path.length() + 1, new_path + "/") == 0)) {
+        return -EINVAL;
+    }
+    {
+        Shard& parent_shard = shardFor(parentOf(new_path));
+        std::shared_lock<std::shared_mutex> lock(parent_shard.mutex);
+        auto parent = parent_shard.entries.find(parentOf(new_path));
+        if (parent == parent_shard.entries.end()) {
+            return -ENOENT;
+        }
+        if ((parent->second->mode & S_IFMT) != S_IFDIR) {
+            return -ENOTDIR;
+        }
+    }
+
+    auto target = getMetadata(new_path);
+    if (exchange && !target) {
+        return -ENOENT;
+    }
+    if (target && !exchange) {
+        if (flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+        if (target.get() == source.get()) {
+            return 0;  // Same file under both names
+        }
+        bool source_dir = (source->mode & S_IFMT) == S_IFDIR;
+        bool target_dir = (target->mode & S_IFMT) == S_IFDIR;
+        if (source_dir && !target_dir) {
+            return -ENOTDIR;
+        }
+        if (!source_dir && target_dir) {
+            return -EISDIR;
+        }
+        if (target_dir && hasChildren(new_path)) {
+            return -ENOTEMPTY;
+        }
+    }
+    if (path == new_path) {
+        return 0;
+    }
+    if (log_) {
+        MetadataLog::Record record;
+        record.type = MetadataLog::RecordType::RENAME;
+        record.path = path;
+        record.new_path = new_path;
+        record.flags = flags;
+        int ret = log_->append(record);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    // Every entry of the subtrees involved, with the path it moves to
+    std::vector<std::pair<std::string, std::shared_ptr<FileMetadata>>> moves;
+    std::unordered_set<std::string> destinations;
+    auto collect = [&](const std::string& from, const std::string& to) {
+        for (const auto& old_path : listSubtree(from)) {
+            std::string moved_path = to + old_path.substr(from.length());
+            moves.emplace_back(moved_path, getMetadata(old_path));
+            destinations.insert(moved_path);
+        }
+    };
+    std::vector<std::string> sources = listSubtree(path);
+    collect(path, new_path);
+    if (exchange) {
+        std::vector<std::string> other = listSubtree(new_path);
+        sources.insert(sources.end(), other.begin(), other.end());
+        collect(new_path, path);
+    }
+
+    // Insert under the new names before erasing the old ones, so concurrent
+    // lookups always find an entry under one of them; a replaced or
+    // exchanged name is overwritten in place. The entry objects themselves
+    // move, so handles held across the rename stay live.
+    for (auto& move : moves) {
+        std::unique_lock<std::shared_mutex> lock, parent_lock;
+        lockShards(shardFor(move.first), shardFor(parentOf(move.first)), lock, parent_lock);
+        insertLocked(move.first, std::move(move.second));
+    }
+    for (const auto& old_path : sources) {
+        if (destinations.count(old_path)) {
+            continue;
+        }
+        std::unique_lock<std::shared_mutex> lock, parent_lock;
+        lockShards(shardFor(old_path), shardFor(parentOf(old_path)), lock, parent_lock);
+        eraseLocked(old_path);
+    }
+
+    // The replaced entry is unlinked; its inode no longer has a path
+    if (target && !exchange && unlinkInode(target->ino, new_path) && replaced) {
+        *replaced = target;
+    }
+    return 0;
+}
+
+std::string MetadataManager::getPath(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto it = inodes.entries.find(ino);
+    if (it != inodes.entries.end()) {
+        return it->second.path;
+    }
+    return std::string();
+}
+
+std::shared_ptr<FileMetadata> MetadataManager::getMetadata(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto it = inodes.entries.find(ino);
+    return it != inodes.entries.end() ? it->second.entry : nullptr;
+}
+
+void MetadataManager::lookup(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    inodes.lookups[ino]++;
+}
+
+std::shared_ptr<FileMetadata> MetadataManager::forget(uint64_t ino, uint64_t nlookup) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto it = inodes.lookups.find(ino);
+    if (it == inodes.lookups.end()) {
+        return nullptr;
+    }
+    if (it->second > nlookup) {
+        it->second -= nlookup;
+        return nullptr;
+    }
+    inodes.lookups.erase(it);
+    return reapLocked(inodes, ino);
+}
+
+void MetadataManager::openHandle(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    inodes.handles[ino]++;
+}
+
+std::shared_ptr<FileMetadata> MetadataManager::releaseHandle(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto it = inodes.handles.find(ino);
+    if (it == inodes.handles.end()) {
+        return nullptr;
+    }
+    if (--it->second > 0) {
+        return nullptr;
+    }
+    inodes.handles.erase(it);
+    return reapLocked(inodes, ino);
+}
+
+std::shared_ptr<FileMetadata> MetadataManager::reapLocked(InodeShard& inodes, uint64_t ino) {
+    auto inode = inodes.entries.find(ino);
+    if (inode == inodes.entries.end() || !inode->second.path.empty() ||
+        inodes.lookups.count(ino) || inodes.handles.count(ino)) {
+        return nullptr;
+    }
+    auto entry = std::move(inode->second.entry);
+    inodes.entries.erase(inode);
+    return entry;
+}
+
+uint64_t MetadataManager::lookupCount(uint64_t ino) {
+    InodeShard& inodes = inodeShardFor(ino);
+    std::lock_guard<std::mutex> lock(inodes.mutex);
+    auto it = inodes.lookups.find(ino);
+    return it != inodes.lookups.end() ? it->second : 0;
+}
+
+int MetadataManager::open(const std::string& directory) {
+    auto log = std::make_unique<MetadataLog>();
+    int ret = log->open(directory, [this](const MetadataLog::Record& record) { replay(record); });
+    if (ret < 0) {
+        return ret;
+    }
+    log_ = std::move(log);
+    return 0;
+}
+
+void MetadataManager::replay(const MetadataLog::Record& record) {
+    // Inode numbers are never reused, not even those of unlinked files
+    uint64_t next = std::max(record.metadata.ino + 1, record.next_ino);
+    if (next > next_ino_.load()) {
+        next_ino_ = next;
+    }
+
+    switch (record.type) {
+        case MetadataLog::RecordType::CREATE:
+            createMetadata(record.path, record.metadata);
+            break;
+        case MetadataLog::RecordType::UNLINK:
+            unlinkMetadata(record.path, record.directory);
+            break;
+        case MetadataLog::RecordType::RENAME:
+            renameMetadata(record.path, record.new_path, record.flags);
+            break;
+        case MetadataLog::RecordType::ATTRIBUTES: {
+            // Records of an inode unlinked since then have nothing to update
+            auto entry = getMetadata(record.metadata.ino);
+            if (entry) {
+                *entry = record.metadata;
+            }
+            break;
+        }
+        case MetadataLog::RecordType::NEXT_INO:
+            break;
+    }
+}
+
+int MetadataManager::logAttributes(const FileMetadata& metadata) {
+    return log_ ? log_->appendAttributes(metadata) : 0;
+}
+
+int MetadataManager::checkpoint() {
+    if (!log_) {
+        return 0;
+    }
+
+    std::unique_lock<std::shared_mutex> ns_lock(namespace_mutex_);
+    // Parents come before their children, so replaying creates works.
+    // Collected first: the log's lock is taken after the shard locks.
+    std::vector<std::pair<std::string, std::shared_ptr<FileMetadata>>> entries;
+    for (auto& path : listSubtree("/")) {
+        auto entry = getMetadata(path);
+        entries.emplace_back(std::move(path), std::move(entry));
+    }
+
+    return log_->checkpoint([&](const MetadataLog::Apply& emit) {
+        MetadataLog::Record next;
+        next.type = MetadataLog::RecordType::NEXT_INO;
+        next.next_ino = next_ino_.load();
+        emit(next);
+
+        for (const auto& entry : entries) {
+            MetadataLog::Record record;
+            record.type = entry.first == "/" ? MetadataLog::RecordType::ATTRIBUTES
+                                             : MetadataLog::RecordType::CREATE;
+            record.path = entry.first;
+            record.metadata = *entry.second;
+            emit(record);
+        }
+    });
+}
+
+int MetadataManager::sync() {
+    return log_ ? log_->sync() : 0;
+}
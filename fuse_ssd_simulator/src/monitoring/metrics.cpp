@@ -0,0 +1,98 @@
+#include "monitoring/metrics.h"
+#include <cstdio>
+#include <algorithm>
+#include <utility>
+
+size_t LatencyHistogram::bucketFor(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return value;  // Exact below the first full power of two
+    }
+    unsigned exponent = 63 - __builtin_clzll(value);
+    size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucketUpper(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lower = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    buckets_[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t old_max = max_.load(std::memory_order_relaxed);
+    while (value > old_max &&
+           !max_.compare_exchange_weak(old_max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    // Buckets are read one by one while writers keep recording, so the
+    // total is taken from the buckets themselves rather than count_
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(q * total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return std::min(bucketUpper(i), max());
+        }
+    }
+    return max();
+}
+
+void OpStats::record(ssize_t result, std::chrono::nanoseconds duration) {
+    ops.fetch_add(1, std::memory_order_relaxed);
+    if (result < 0) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        bytes.fetch_add(result, std::memory_order_relaxed);
+    }
+    latency.record(duration.count() > 0 ? duration.count() : 0);
+}
+
+void PrometheusWriter::family(const std::string& name, const char* type, const std::string& help) {
+    out_ += "# HELP " + name + " " + help + "\n";
+    out_ += "# TYPE " + name + " " + type + "\n";
+}
+
+void PrometheusWriter::sample(const std::string& name, const std::string& labels, double value) {
+    char number[32];
+    snprintf(number, sizeof(number), "%.17g", value);
+    out_ += name;
+    if (!labels.empty()) {
+        out_ += "{" + labels + "}";
+    }
+    out_ += " ";
+    out_ += number;
+    out_ += "\n";
+}
+
+void PrometheusWriter::summary(const std::string& name, const std::string& labels,
+                               const LatencyHistogram& latency) {
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    static const std::pair<const char*, double> quantiles[] = {
+        {"0.5", 0.5}, {"0.99", 0.99}, {"0.999", 0.999}};
+    for (const auto& quantile : quantiles) {
+        sample(name, prefix + "quantile=\"" + quantile.first + "\"",
+               latency.percentile(quantile.second) / 1e9);
+    }
+    sample(name + "_sum", labels, latency.sum() / 1e9);
+    sample(name + "_count", labels, latency.count());
+}
@@ -1,28 +1,101 @@
 #include "monitoring/monitor.h"
 #include <chrono>
-#include <iostream>
+#include <cstdio>
+#include <fstream>
 
-Monitor::Monitor(std::shared_ptr<StorageAccelerator> accelerator, Logger* logger)
-    : accelerator_(accelerator), logger_(logger), running_(false) {}
+Monitor::Monitor(std::shared_ptr<StorageAccelerator> accelerator, Logger* logger,
+                 const std::string& metrics_file, std::chrono::milliseconds interval)
+    : accelerator_(accelerator), logger_(logger), metrics_file_(metrics_file),
+      interval_(interval), running_(false), last_sample_(std::chrono::steady_clock::now()) {}
+
+Monitor::~Monitor() {
+    stop();
+}
 
 void Monitor::start() {
-    running_ = true;
+    if (running_.exchange(true)) {
+        return;
+    }
     monitor_thread_ = std::thread(&Monitor::monitorLoop, this);
 }
 
 void Monitor::stop() {
-    running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
     if (monitor_thread_.joinable()) {
         monitor_thread_.join();
     }
 }
 
+std::string Monitor::render() {
+    PrometheusWriter writer;
+    accelerator_->exportMetrics(writer);
+    return writer.str();
+}
+
+bool Monitor::writeMetrics() {
+    if (metrics_file_.empty()) {
+        return false;
+    }
+
+    std::string tmp_file = metrics_file_ + ".tmp";
+    {
+        std::ofstream out(tmp_file, std::ios::out | std::ios::trunc);
+        if (!out.is_open()) {
+            logger_->error("Failed to open metrics file: " + tmp_file);
+            return false;
+        }
+        out << render();
+        if (!out.good()) {
+            logger_->error("Failed to write metrics file: " + tmp_file);
+            return false;
+        }
+    }
+    if (std::rename(tmp_file.c_str(), metrics_file_.c_str()) != 0) {
+        logger_->error("Failed to replace metrics file: " + metrics_file_);
+        return false;
+    }
+    return true;
+}
+
+void Monitor::logSummary() {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - last_sample_).count();
+    uint64_t read_bytes = accelerator_->readStats().bytes.load();
+    uint64_t write_bytes = accelerator_->writeStats().bytes.load();
+    if (seconds <= 0.0) {
+        return;
+    }
+
+    LOG_INFO(*logger_, "Read " + std::to_string(static_cast<uint64_t>((read_bytes - last_read_bytes_) / seconds)) +
+             " B/s (p99 " + std::to_string(accelerator_->readStats().latency.percentile(0.99) / 1000) +
+             " us), write " + std::to_string(static_cast<uint64_t>((write_bytes - last_write_bytes_) / seconds)) +
+             " B/s (p99 " + std::to_string(accelerator_->writeStats().latency.percentile(0.99) / 1000) +
+             " us)");
+
+    last_read_bytes_ = read_bytes;
+    last_write_bytes_ = write_bytes;
+    last_sample_ = now;
+}
+
 void Monitor::monitorLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
     while (running_) {
-        // Collect and log metrics
-        // Placeholder for actual monitoring logic
-        logger_->info("Monitoring system performance...");
+        cv_.wait_for(lock, interval_, [this]() { return !running_; });
+        if (!running_) {
+            break;
+        }
 
-        std::this_thread::sleep_for(std::chrono::seconds(5));
+        lock.unlock();
+        writeMetrics();
+        logSummary();
+        lock.lock();
     }
+
+    // Leave the final counters behind on shutdown
+    lock.unlock();
+    writeMetrics();
 }
@@ -0,0 +1,206 @@
+#include "ssd_simulator/extent_store.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+BlockPool::BlockPool(size_t block_size, size_t blocks_per_chunk)
+    : block_size_(block_size), blocks_per_chunk_(blocks_per_chunk), in_use_(0) {}
+
+char* BlockPool::allocate() {
+    if (free_list_.empty()) {
+        chunks_.emplace_back(new char[block_size_ * blocks_per_chunk_]);
+        char* base = chunks_.back().get();
+        for (size_t i = blocks_per_chunk_; i > 0; i--) {
+            free_list_.push_back(base + (i - 1) * block_size_);
+        }
+    }
+
+    char* block = free_list_.back();
+    free_list_.pop_back();
+    memset(block, 0, block_size_);
+    in_use_++;
+    return block;
+}
+
+void BlockPool::release(char* block) {
+    free_list_.push_back(block);
+    in_use_--;
+}
+
+ExtentStore::ExtentStore(size_t block_size)
+    : block_size_(block_size), pool_(block_size) {}
+
+ExtentStore::ExtentStore(size_t block_size, std::unique_ptr<SlotFile> slots)
+    : block_size_(block_size), pool_(block_size), slots_(std::move(slots)) {
+    for (const auto& slot : slots_->usedSlots()) {
+        FileExtents& extents = files_[slot.file];
+        extents.blocks[slot.index] = slot.data;
+        extents.size = std::max(extents.size, static_cast<off_t>(slot.index * block_size_ + slot.length));
+    }
+}
+
+char* ExtentStore::allocateBlock(const std::string& file, uint64_t index) {
+    return slots_ ? slots_->allocate(file, index) : pool_.allocate();
+}
+
+void ExtentStore::releaseBlock(char* block) {
+    if (slots_) {
+        slots_->release(block);
+    } else {
+        pool_.release(block);
+    }
+}
+
+void ExtentStore::setLength(char* block, size_t length) {
+    if (slots_) {
+        slots_->setLength(block, static_cast<uint32_t>(length));
+    }
+}
+
+std::vector<ExtentStore::StoredBlock> ExtentStore::storedBlocks() const {
+    std::vector<StoredBlock> stored;
+    for (const auto& file : files_) {
+        for (const auto& block : file.second.blocks) {
+            stored.push_back({file.first, block.first});
+        }
+    }
+    return stored;
+}
+
+ExtentStore::~ExtentStore() {
+    // Slabs are owned by the pool chunks and go away with it
+}
+
+bool ExtentStore::exists(const std::string& file) const {
+    return files_.find(file) != files_.end();
+}
+
+ssize_t ExtentStore::read(const std::string& file, char* buffer, size_t size, off_t offset) const {
+    auto it = files_.find(file);
+    if (it == files_.end()) {
+        return -ENOENT;
+    }
+
+    const FileExtents& extents = it->second;
+    if (offset >= extents.size) {
+        return 0;
+    }
+
+    size_t to_read = std::min(size, static_cast<size_t>(extents.size - offset));
+    size_t done = 0;
+    while (done < to_read) {
+        uint64_t index = (offset + done) / block_size_;
+        size_t block_offset = (offset + done) % block_size_;
+        size_t chunk = std::min(to_read - done, block_size_ - block_offset);
+
+        auto block = extents.blocks.find(index);
+        if (block != extents.blocks.end()) {
+            memcpy(buffer + done, block->second + block_offset, chunk);
+        } else {
+            memset(buffer + done, 0, chunk);  // Hole
+        }
+        done += chunk;
+    }
+
+    return to_read;
+}
+
+ssize_t ExtentStore::write(const std::string& file, const char* buffer, size_t size, off_t offset) {
+    FileExtents& extents = files_[file];
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t index = (offset + done) / block_size_;
+        size_t block_offset = (offset + done) % block_size_;
+        size_t chunk = std::min(size - done, block_size_ - block_offset);
+
+        auto it = extents.blocks.find(index);
+        char* block = it != extents.blocks.end() ? it->second : allocateBlock(file, index);
+        if (!block) {
+            break;  // Drive file full
+        }
+        extents.blocks[index] = block;
+        memcpy(block + block_offset, buffer + done, chunk);
+        if (slots_ && slots_->length(block) < block_offset + chunk) {
+            setLength(block, block_offset + chunk);
+        }
+        done += chunk;
+    }
+
+    if (done == 0 && size > 0) {
+        if (extents.blocks.empty()) {
+            files_.erase(file);
+        }
+        return -ENOSPC;
+    }
+    extents.size = std::max(extents.size, static_cast<off_t>(offset + done));
+    return done;
+}
+
+int ExtentStore::truncate(const std::string& file, off_t size) {
+    auto it = files_.find(file);
+    if (it == files_.end()) {
+        return -ENOENT;
+    }
+
+    FileExtents& extents = it->second;
+    uint64_t first_dropped = (size + block_size_ - 1) / block_size_;
+    for (auto block = extents.blocks.begin(); block != extents.blocks.end();) {
+        if (block->first >= first_dropped) {
+            releaseBlock(block->second);
+            block = extents.blocks.erase(block);
+        } else {
+            ++block;
+        }
+    }
+
+    // Zero the tail of a partial last block so a later extend reads zeroes
+    size_t tail = size % block_size_;
+    if (tail != 0) {
+        auto last = extents.blocks.find(size / block_size_);
+        if (last != extents.blocks.end()) {
+            memset(last->second + tail, 0, block_size_ - tail);
+            setLength(last->second, tail);
+        }
+    }
+
+    extents.size = size;
+    return 0;
+}
+
+int ExtentStore::remove(const std::string& file) {
+    auto it = files_.find(file);
+    if (it == files_.end()) {
+        return -ENOENT;
+    }
+
+    for (const auto& block : it->second.blocks) {
+        releaseBlock(block.second);
+    }
+    files_.erase(it);
+    return 0;
+}
+
+int ExtentStore::discard(const std::string& file, off_t offset, size_t size) {
+    auto it = files_.find(file);
+    if (it == files_.end()) {
+        return -ENOENT;
+    }
+
+    FileExtents& extents = it->second;
+    uint64_t first = (offset + block_size_ - 1) / block_size_;
+    uint64_t end = (offset + size) / block_size_;
+    for (auto block = extents.blocks.begin(); block != extents.blocks.end();) {
+        if (block->first >= first && block->first < end) {
+            releaseBlock(block->second);
+            block = extents.blocks.erase(block);
+        } else {
+            ++block;
+        }
+    }
+
+    if (extents.blocks.empty()) {
+        files_.erase(it);
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "ssd_simulator/latency_model.h"
+#include "ssd_simulator/ssd_simulator.h"
+#include <cmath>
+
+LatencyProfile LatencyProfile::legacy() {
+    return LatencyProfile();
+}
+
+LatencyProfile LatencyProfile::nvme() {
+    LatencyProfile profile;
+    profile.read = {std::chrono::microseconds(80), 400e6};
+    profile.write = {std::chrono::microseconds(20), 250e6};
+    profile.truncate = {std::chrono::microseconds(50), 0.0};
+    profile.other = {std::chrono::microseconds(10), 0.0};
+    profile.queue_depth_penalty = std::chrono::microseconds(2);
+    profile.tail_probability = 0.001;
+    profile.tail_multiplier = 20.0;
+    profile.jitter_sigma = 0.1;
+    profile.gc_interval_bytes = 64ULL * 1024 * 1024;
+    profile.gc_stall = std::chrono::milliseconds(2);
+    profile.write_amplification = 2.5;
+    return profile;
+}
+
+LatencyModel::LatencyModel(const LatencyProfile& profile, uint64_t seed)
+    : profile_(profile), rng_(seed), bytes_since_gc_(0) {}
+
+const OpLatency& LatencyModel::opLatency(IOType type) const {
+    switch (type) {
+        case IOType::READ:
+            return profile_.read;
+        case IOType::WRITE:
+            return profile_.write;
+        case IOType::TRUNCATE:
+            return profile_.truncate;
+        default:
+            return profile_.other;
+    }
+}
+
+std::chrono::nanoseconds LatencyModel::transferTime(IOType type, size_t size) const {
+    const OpLatency& op = opLatency(type);
+    if (op.bytes_per_second <= 0.0 || size == 0) {
+        return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::nanoseconds(static_cast<int64_t>(size * 1e9 / op.bytes_per_second));
+}
+
+std::chrono::nanoseconds LatencyModel::accessTime(IOType type, size_t size, size_t queue_depth) {
+    double latency = static_cast<double>(opLatency(type).base.count());
+    latency += static_cast<double>(profile_.queue_depth_penalty.count()) * queue_depth;
+
+    if (profile_.jitter_sigma > 0.0) {
+        std::lognormal_distribution<double> jitter(0.0, profile_.jitter_sigma);
+        latency *= jitter(rng_);
+    }
+    if (profile_.tail_probability > 0.0) {
+        std::bernoulli_distribution tail(profile_.tail_probability);
+        if (tail(rng_)) {
+            latency *= profile_.tail_multiplier;
+        }
+    }
+
+    if (type == IOType::WRITE && profile_.gc_interval_bytes > 0) {
+        bytes_since_gc_ += static_cast<uint64_t>(size * profile_.write_amplification);
+        if (bytes_since_gc_ >= profile_.gc_interval_bytes) {
+            bytes_since_gc_ -= profile_.gc_interval_bytes;
+            latency += static_cast<double>(profile_.gc_stall.count());
+        }
+    }
+
+    return std::chrono::nanoseconds(static_cast<int64_t>(latency));
+}
@@ -0,0 +1,152 @@
+#include "ssd_simulator/slot_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// On-disk layout: one block of superblock, the slot headers rounded up to
+// whole blocks, then the data slots
+struct SlotFile::Superblock {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t capacity;
+};
+
+struct SlotFile::SlotHeader {
+    uint64_t index;
+    uint32_t length;
+    uint8_t name_length;  // 0 marks a free slot
+    char name[MAX_NAME];
+};
+
+static constexpr uint64_t SLOT_FILE_MAGIC = 0x53534453534c4f54ULL;  // "SSDSSLOT"
+static constexpr uint32_t SLOT_FILE_VERSION = 1;
+
+SlotFile::SlotFile(const std::string& path, size_t block_size, size_t capacity)
+    : path_(path), block_size_(block_size), capacity_(capacity) {
+    static_assert(sizeof(SlotHeader) == 64, "slot headers are 64 bytes on disk");
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        int error = errno;
+        ::close(fd_);
+        throw std::runtime_error("cannot stat " + path + ": " + strerror(error));
+    }
+
+    Superblock super = {};
+    bool existing = st.st_size > 0;
+    if (existing) {
+        if (pread(fd_, &super, sizeof(super), 0) != static_cast<ssize_t>(sizeof(super)) ||
+            super.magic != SLOT_FILE_MAGIC || super.version != SLOT_FILE_VERSION ||
+            super.block_size != block_size) {
+            ::close(fd_);
+            throw std::runtime_error(path + " is not a drive file with " +
+                                     std::to_string(block_size) + " byte blocks");
+        }
+        capacity_ = super.capacity;
+    }
+
+    size_t header_bytes = (capacity_ * sizeof(SlotHeader) + block_size_ - 1) / block_size_ * block_size_;
+    mapped_size_ = block_size_ + header_bytes + capacity_ * block_size_;
+    if (!existing) {
+        // Sparse, so creating a large drive costs nothing until it fills
+        super = {SLOT_FILE_MAGIC, SLOT_FILE_VERSION, static_cast<uint32_t>(block_size_), capacity_};
+        if (ftruncate(fd_, mapped_size_) != 0 ||
+            pwrite(fd_, &super, sizeof(super), 0) != static_cast<ssize_t>(sizeof(super))) {
+            int error = errno;
+            ::close(fd_);
+            throw std::runtime_error("cannot size " + path + ": " + strerror(error));
+        }
+    } else if (static_cast<size_t>(st.st_size) < mapped_size_) {
+        ::close(fd_);
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    void* base = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+        int error = errno;
+        ::close(fd_);
+        throw std::runtime_error("cannot map " + path + ": " + strerror(error));
+    }
+    base_ = static_cast<char*>(base);
+    headers_ = reinterpret_cast<SlotHeader*>(base_ + block_size_);
+    data_ = base_ + block_size_ + header_bytes;
+
+    free_.reserve(capacity_);
+    for (size_t slot = capacity_; slot > 0; slot--) {
+        if (headers_[slot - 1].name_length == 0) {
+            free_.push_back(slot - 1);
+        }
+    }
+}
+
+SlotFile::~SlotFile() {
+    // The mapping is shared, so unmapped pages still reach the file
+    munmap(base_, mapped_size_);
+    ::close(fd_);
+}
+
+size_t SlotFile::slotOf(const char* block) const {
+    return (block - data_) / block_size_;
+}
+
+std::vector<SlotFile::Slot> SlotFile::usedSlots() const {
+    std::vector<Slot> slots;
+    slots.reserve(capacity_ - free_.size());
+    for (size_t slot = 0; slot < capacity_; slot++) {
+        const SlotHeader& header = headers_[slot];
+        if (header.name_length == 0) {
+            continue;
+        }
+        slots.push_back({std::string(header.name, std::min<size_t>(header.name_length, MAX_NAME)),
+                         header.index, header.length, data_ + slot * block_size_});
+    }
+    return slots;
+}
+
+char* SlotFile::allocate(const std::string& file, uint64_t index) {
+    if (free_.empty() || file.empty() || file.size() > MAX_NAME) {
+        return nullptr;
+    }
+
+    size_t slot = free_.back();
+    free_.pop_back();
+    char* block = data_ + slot * block_size_;
+    memset(block, 0, block_size_);
+
+    // The name goes in last: a slot is only claimed once it is complete
+    SlotHeader& header = headers_[slot];
+    header.index = index;
+    header.length = 0;
+    memcpy(header.name, file.data(), file.size());
+    header.name_length = static_cast<uint8_t>(file.size());
+    return block;
+}
+
+void SlotFile::release(char* block) {
+    size_t slot = slotOf(block);
+    headers_[slot].name_length = 0;
+    free_.push_back(slot);
+}
+
+void SlotFile::setLength(char* block, uint32_t length) {
+    headers_[slotOf(block)].length = length;
+}
+
+uint32_t SlotFile::length(const char* block) const {
+    return headers_[slotOf(block)].length;
+}
+
+int SlotFile::sync() {
+    return msync(base_, mapped_size_, MS_SYNC) == 0 ? 0 : -errno;
+}
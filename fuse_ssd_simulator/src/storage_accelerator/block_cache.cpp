@@ -0,0 +1,322 @@
+#include "storage_accelerator/block_cache.h"
+#include <algorithm>
+#include <cstring>
+
+BlockCache::BlockCache(size_t block_size, const BlockCacheOptions& options)
+    : block_size_(block_size),
+      slots_per_shard_((options.capacity / block_size + NUM_SHARDS - 1) / NUM_SHARDS),
+      write_back_(options.write_back) {
+    // Slot buffers are allocated on first use
+    for (auto& shard : shards_) {
+        shard.slots.resize(slots_per_shard_);
+        shard.index.reserve(slots_per_shard_);
+    }
+}
+
+size_t BlockCache::mix(uint64_t file, uint64_t block) {
+    // splitmix64 finalizer, neighbouring blocks spread over all shards
+    uint64_t x = file * 0x9E3779B97F4A7C15ULL + block;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+BlockCache::Shard& BlockCache::shardFor(uint64_t file, uint64_t block) {
+    return shards_[mix(file, block) % NUM_SHARDS];
+}
+
+BlockCache::Slot* BlockCache::find(Shard& shard, uint64_t file, uint64_t block) {
+    auto it = shard.index.find({file, block});
+    return it != shard.index.end() ? &shard.slots[it->second] : nullptr;
+}
+
+BlockCache::Slot* BlockCache::allocate(Shard& shard, uint64_t file, uint64_t block) {
+    // Two turns: the first may only clear reference bits
+    for (size_t step = 0; step < 2 * shard.slots.size(); step++) {
+        size_t index = shard.hand;
+        Slot& slot = shard.slots[index];
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+
+        if (slot.used) {
+            if (slot.dirty()) {
+                continue;
+            }
+            if (slot.referenced) {
+                slot.referenced = false;
+                continue;
+            }
+            release(shard, slot);
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (!slot.data) {
+            slot.data.reset(new char[block_size_]);
+        }
+        slot.file = file;
+        slot.block = block;
+        slot.used = true;
+        slot.referenced = false;
+        slot.complete = false;
+        slot.valid_begin = slot.valid_end = 0;
+        slot.dirty_begin = slot.dirty_end = 0;
+        slot.version = 0;
+        shard.index[{file, block}] = index;
+
+        FileShard& files = files_[file % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(files.mutex);
+        files.files[file].insert(block);
+        return &slot;
+    }
+    return nullptr;
+}
+
+void BlockCache::release(Shard& shard, Slot& slot) {
+    shard.index.erase({slot.file, slot.block});
+    slot.used = false;
+    unindex(slot.file, slot.block);
+}
+
+void BlockCache::unindex(uint64_t file, uint64_t block) {
+    FileShard& files = files_[file % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(files.mutex);
+    auto it = files.files.find(file);
+    if (it != files.files.end()) {
+        it->second.erase(block);
+        if (it->second.empty()) {
+            files.files.erase(it);
+        }
+    }
+}
+
+bool BlockCache::extendValid(Slot& slot, size_t begin, size_t end) {
+    if (slot.valid_end > slot.valid_begin) {
+        if (begin > slot.valid_end || end < slot.valid_begin) {
+            return false;
+        }
+        begin = std::min<size_t>(begin, slot.valid_begin);
+        end = std::max<size_t>(end, slot.valid_end);
+    }
+    slot.valid_begin = begin;
+    slot.valid_end = end;
+    slot.complete = begin == 0 && end == block_size_;
+    return true;
+}
+
+void BlockCache::setDirty(Slot& slot, size_t begin, size_t end) {
+    if (slot.dirty()) {
+        // Known bytes are one range holding both, so the gap is known too
+        slot.dirty_begin = std::min<size_t>(begin, slot.dirty_begin);
+        slot.dirty_end = std::max<size_t>(end, slot.dirty_end);
+        return;
+    }
+
+    slot.dirty_begin = begin;
+    slot.dirty_end = end;
+    dirty_blocks_.fetch_add(1, std::memory_order_relaxed);
+    DirtyShard& dirty = dirty_[slot.file % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(dirty.mutex);
+    dirty.files[slot.file].insert(slot.block);
+}
+
+void BlockCache::clearDirty(Slot& slot) {
+    if (!slot.dirty()) {
+        return;
+    }
+
+    slot.dirty_begin = slot.dirty_end = 0;
+    dirty_blocks_.fetch_sub(1, std::memory_order_relaxed);
+    DirtyShard& dirty = dirty_[slot.file % NUM_SHARDS];
+    std::lock_guard<std::mutex> lock(dirty.mutex);
+    auto it = dirty.files.find(slot.file);
+    if (it != dirty.files.end()) {
+        it->second.erase(slot.block);
+        if (it->second.empty()) {
+            dirty.files.erase(it);
+        }
+    }
+}
+
+bool BlockCache::read(uint64_t file, uint64_t block, size_t offset, size_t size, char* out) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Slot* slot = find(shard, file, block);
+    if (!slot || (!slot->complete &&
+                  (offset < slot->valid_begin || offset + size > slot->valid_end))) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    memcpy(out, slot->data.get() + offset, size);
+    slot->referenced = true;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool BlockCache::cached(uint64_t file, uint64_t block) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Slot* slot = find(shard, file, block);
+    return slot && slot->complete;
+}
+
+uint64_t BlockCache::ticket(uint64_t file, uint64_t block) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    FileShard& files = files_[file % NUM_SHARDS];
+    std::lock_guard<std::mutex> files_lock(files.mutex);
+    // Both only grow, so the sum is unchanged only if neither moved
+    return shard.writes + files.generation;
+}
+
+void BlockCache::fill(uint64_t file, uint64_t block, uint64_t ticket, char* data) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Slot* slot = find(shard, file, block);
+    if (slot) {
+        size_t begin = slot->complete ? 0 : slot->valid_begin;
+        size_t end = slot->complete ? block_size_ : slot->valid_end;
+        memcpy(data + begin, slot->data.get() + begin, end - begin);
+    }
+
+    // The drive read may predate a write or an invalidate that has since
+    // completed. The block is indexed along with the check, so an
+    // invalidate that comes after it finds the block and waits for the shard.
+    {
+        FileShard& files = files_[file % NUM_SHARDS];
+        std::lock_guard<std::mutex> files_lock(files.mutex);
+        if (ticket != shard.writes + files.generation) {
+            return;
+        }
+        files.files[file].insert(block);
+    }
+    if (!slot && !(slot = allocate(shard, file, block))) {
+        unindex(file, block);
+        return;
+    }
+    memcpy(slot->data.get(), data, block_size_);
+    slot->valid_begin = 0;
+    slot->valid_end = block_size_;
+    slot->complete = true;
+}
+
+void BlockCache::update(uint64_t file, uint64_t block, size_t offset, size_t size,
+                        const char* data) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.writes++;
+
+    Slot* slot = find(shard, file, block);
+    if (!slot) {
+        // Whole-block writes are cached at once, partial ones on their next read
+        if (offset != 0 || size != block_size_ || !(slot = allocate(shard, file, block))) {
+            return;
+        }
+    }
+    if (!slot->complete && !extendValid(*slot, offset, offset + size)) {
+        if (slot->dirty()) {
+            return;  // The drives have these bytes, the slot keeps its own
+        }
+        slot->valid_begin = slot->valid_end = 0;
+        extendValid(*slot, offset, offset + size);
+    }
+    memcpy(slot->data.get() + offset, data, size);
+    slot->version++;
+}
+
+bool BlockCache::write(uint64_t file, uint64_t block, size_t offset, size_t size,
+                       const char* data) {
+    Shard& shard = shardFor(file, block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.writes++;
+
+    Slot* slot = find(shard, file, block);
+    if (!slot && !(slot = allocate(shard, file, block))) {
+        return false;
+    }
+    if (!slot->complete && !extendValid(*slot, offset, offset + size)) {
+        if (slot->dirty()) {
+            return false;
+        }
+        slot->valid_begin = slot->valid_end = 0;
+        extendValid(*slot, offset, offset + size);
+    }
+
+    memcpy(slot->data.get() + offset, data, size);
+    setDirty(*slot, offset, offset + size);
+    slot->version++;
+    slot->referenced = true;
+    return true;
+}
+
+std::vector<BlockCache::DirtyRange> BlockCache::dirtyRanges(uint64_t file) {
+    std::set<uint64_t> blocks;
+    {
+        DirtyShard& dirty = dirty_[file % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(dirty.mutex);
+        auto it = dirty.files.find(file);
+        if (it == dirty.files.end()) {
+            return {};
+        }
+        blocks = it->second;
+    }
+
+    std::vector<DirtyRange> ranges;
+    ranges.reserve(blocks.size());
+    for (uint64_t block : blocks) {
+        Shard& shard = shardFor(file, block);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Slot* slot = find(shard, file, block);
+        if (!slot || !slot->dirty()) {
+            continue;
+        }
+        const char* begin = slot->data.get() + slot->dirty_begin;
+        ranges.push_back({block, slot->dirty_begin,
+                          std::vector<char>(begin, begin + (slot->dirty_end - slot->dirty_begin)),
+                          slot->version});
+    }
+    return ranges;
+}
+
+void BlockCache::markClean(uint64_t file, const DirtyRange& range) {
+    Shard& shard = shardFor(file, range.block);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Slot* slot = find(shard, file, range.block);
+    if (slot && slot->version == range.version) {
+        clearDirty(*slot);
+    }
+}
+
+std::vector<uint64_t> BlockCache::dirtyFiles() {
+    std::vector<uint64_t> files;
+    for (auto& dirty : dirty_) {
+        std::lock_guard<std::mutex> lock(dirty.mutex);
+        for (const auto& file : dirty.files) {
+            files.push_back(file.first);
+        }
+    }
+    return files;
+}
+
+void BlockCache::invalidate(uint64_t file, uint64_t first_block) {
+    std::vector<uint64_t> blocks;
+    {
+        FileShard& files = files_[file % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(files.mutex);
+        files.generation++;
+        auto it = files.files.find(file);
+        if (it == files.files.end()) {
+            return;
+        }
+        blocks.assign(it->second.lower_bound(first_block), it->second.end());
+    }
+
+    for (uint64_t block : blocks) {
+        Shard& shard = shardFor(file, block);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Slot* slot = find(shard, file, block);
+        if (slot) {
+            clearDirty(*slot);
+            release(shard, *slot);
+        }
+    }
+}
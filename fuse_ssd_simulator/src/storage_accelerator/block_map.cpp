@@ -0,0 +1,119 @@
+#include "storage_accelerator/block_map.h"
+#include <algorithm>
+
+BlockMap::Shard& BlockMap::shardFor(uint64_t file) {
+    return shards_[file % NUM_SHARDS];
+}
+
+size_t BlockMap::locate(uint64_t file, off_t block_start, size_t primary) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.files.find(file);
+    if (it == shard.files.end()) {
+        return primary;
+    }
+    auto block = it->second.find(block_start);
+    return block != it->second.end() ? block->second : primary;
+}
+
+size_t BlockMap::place(uint64_t file, off_t block_start, size_t candidate) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Concurrent first writes of one block agree on whichever came first
+    return shard.files[file].emplace(block_start, candidate).first->second;
+}
+
+void BlockMap::truncate(uint64_t file, off_t size) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.files.find(file);
+    if (it == shard.files.end()) {
+        return;
+    }
+
+    // The block containing size keeps its place, its tail is cut by the drive
+    for (auto block = it->second.begin(); block != it->second.end();) {
+        if (block->first >= size) {
+            block = it->second.erase(block);
+        } else {
+            ++block;
+        }
+    }
+    if (it->second.empty()) {
+        shard.files.erase(it);
+    }
+}
+
+void BlockMap::erase(uint64_t file) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.files.erase(file);
+    shard.units.erase(file);
+}
+
+size_t BlockMap::blockCount(uint64_t file) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.files.find(file);
+    return it != shard.files.end() ? it->second.size() : 0;
+}
+
+void BlockMap::setStripeUnit(uint64_t file, size_t unit) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.units[file] = unit;
+}
+
+size_t BlockMap::stripeUnit(uint64_t file, size_t fallback) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.units.find(file);
+    return it != shard.units.end() ? it->second : fallback;
+}
+
+std::vector<size_t> BlockMap::drivesOf(uint64_t file) {
+    std::vector<size_t> drives;
+    {
+        Shard& shard = shardFor(file);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.files.find(file);
+        if (it == shard.files.end()) {
+            return drives;
+        }
+        for (const auto& block : it->second) {
+            drives.push_back(block.second);
+        }
+    }
+
+    std::sort(drives.begin(), drives.end());
+    drives.erase(std::unique(drives.begin(), drives.end()), drives.end());
+    return drives;
+}
+
+std::vector<BlockMap::Location> BlockMap::snapshot() {
+    std::vector<Location> locations;
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& file : shard.files) {
+            for (const auto& block : file.second) {
+                locations.push_back({file.first, block.first, block.second});
+            }
+        }
+    }
+    return locations;
+}
+
+bool BlockMap::relocate(uint64_t file, off_t block_start, size_t from, size_t to) {
+    Shard& shard = shardFor(file);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.files.find(file);
+    if (it == shard.files.end()) {
+        return false;
+    }
+    auto block = it->second.find(block_start);
+    if (block == it->second.end() || block->second != from) {
+        return false;
+    }
+    block->second = to;
+    return true;
+}
@@ -0,0 +1,227 @@
+#include "storage_accelerator/dedup_index.h"
+#include "hashing/xxhash.h"
+#include <cstdio>
+
+Fingerprint DedupIndex::fingerprint(const char* data, size_t size) {
+    XXH128_hash_t hash = XXH3_128bits(data, size);
+    return {hash.high64, hash.low64};
+}
+
+std::string DedupIndex::objectName(const ContentKey& key) {
+    char name[64];
+    snprintf(name, sizeof(name), "dup:%016llx%016llx.%llu",
+             static_cast<unsigned long long>(key.fingerprint.high),
+             static_cast<unsigned long long>(key.fingerprint.low),
+             static_cast<unsigned long long>(key.generation));
+    return name;
+}
+
+DedupIndex::ContentShard& DedupIndex::contentShardFor(const Fingerprint& fingerprint) {
+    return content_shards_[fingerprint.high % NUM_SHARDS];
+}
+
+DedupIndex::FileShard& DedupIndex::fileShardFor(uint64_t file) {
+    return file_shards_[file % NUM_SHARDS];
+}
+
+DedupIndex::Entry* DedupIndex::find(ContentShard& shard, const ContentKey& key) {
+    auto it = shard.entries.find(key.fingerprint);
+    if (it == shard.entries.end()) {
+        return nullptr;
+    }
+    for (auto& entry : it->second) {
+        if (entry.generation == key.generation) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool DedupIndex::acquire(uint64_t file, uint64_t block, Stored& out) {
+    FileShard& files = fileShardFor(file);
+    std::lock_guard<std::mutex> file_lock(files.mutex);
+    auto it = files.files.find(file);
+    if (it == files.files.end()) {
+        return false;
+    }
+    auto pointer = it->second.find(block);
+    if (pointer == it->second.end()) {
+        return false;
+    }
+
+    // The file's reference keeps the entry alive while both locks are held
+    ContentShard& shard = contentShardFor(pointer->second.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry* entry = find(shard, pointer->second);
+    entry->references++;
+    out = {pointer->second, entry->drive};
+    return true;
+}
+
+std::vector<DedupIndex::Stored> DedupIndex::candidates(const Fingerprint& fingerprint) {
+    std::vector<Stored> found;
+    ContentShard& shard = contentShardFor(fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(fingerprint);
+    if (it == shard.entries.end()) {
+        return found;
+    }
+    for (auto& entry : it->second) {
+        if (entry.published) {
+            entry.references++;
+            found.push_back({{fingerprint, entry.generation}, entry.drive});
+        }
+    }
+    return found;
+}
+
+bool DedupIndex::pin(const ContentKey& key, size_t& drive) {
+    ContentShard& shard = contentShardFor(key.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry* entry = find(shard, key);
+    if (!entry) {
+        return false;
+    }
+    entry->references++;
+    drive = entry->drive;
+    return true;
+}
+
+bool DedupIndex::release(const ContentKey& key, size_t& drive) {
+    ContentShard& shard = contentShardFor(key.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key.fingerprint);
+    for (auto entry = it->second.begin(); entry != it->second.end(); ++entry) {
+        if (entry->generation != key.generation) {
+            continue;
+        }
+        if (--entry->references > 0) {
+            return false;
+        }
+        drive = entry->drive;
+        it->second.erase(entry);
+        if (it->second.empty()) {
+            shard.entries.erase(it);
+        }
+        unique_blocks_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+ContentKey DedupIndex::create(const Fingerprint& fingerprint, size_t drive) {
+    ContentShard& shard = contentShardFor(fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    uint64_t generation = next_generation_.fetch_add(1, std::memory_order_relaxed);
+    shard.entries[fingerprint].push_back({generation, drive, 1, false});
+    unique_blocks_.fetch_add(1, std::memory_order_relaxed);
+    return {fingerprint, generation};
+}
+
+void DedupIndex::publish(const ContentKey& key) {
+    ContentShard& shard = contentShardFor(key.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry* entry = find(shard, key);
+    if (entry) {
+        entry->published = true;
+    }
+}
+
+bool DedupIndex::assign(uint64_t file, uint64_t block, const ContentKey& key, ContentKey& previous) {
+    FileShard& files = fileShardFor(file);
+    std::lock_guard<std::mutex> lock(files.mutex);
+    auto result = files.files[file].emplace(block, key);
+    if (result.second) {
+        referenced_blocks_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    previous = result.first->second;
+    result.first->second = key;
+    return true;
+}
+
+bool DedupIndex::clear(uint64_t file, uint64_t block, ContentKey& previous) {
+    FileShard& files = fileShardFor(file);
+    std::lock_guard<std::mutex> lock(files.mutex);
+    auto it = files.files.find(file);
+    if (it == files.files.end()) {
+        return false;
+    }
+    auto pointer = it->second.find(block);
+    if (pointer == it->second.end()) {
+        return false;
+    }
+    previous = pointer->second;
+    it->second.erase(pointer);
+    if (it->second.empty()) {
+        files.files.erase(it);
+    }
+    referenced_blocks_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::vector<ContentKey> DedupIndex::truncate(uint64_t file, uint64_t first_block) {
+    std::vector<ContentKey> dropped;
+    FileShard& files = fileShardFor(file);
+    std::lock_guard<std::mutex> lock(files.mutex);
+    auto it = files.files.find(file);
+    if (it == files.files.end()) {
+        return dropped;
+    }
+    for (auto pointer = it->second.begin(); pointer != it->second.end();) {
+        if (pointer->first >= first_block) {
+            dropped.push_back(pointer->second);
+            pointer = it->second.erase(pointer);
+        } else {
+            ++pointer;
+        }
+    }
+    if (it->second.empty()) {
+        files.files.erase(it);
+    }
+    referenced_blocks_.fetch_sub(dropped.size(), std::memory_order_relaxed);
+    return dropped;
+}
+
+std::vector<ContentKey> DedupIndex::erase(uint64_t file) {
+    return truncate(file, 0);
+}
+
+size_t DedupIndex::blockCount(uint64_t file) {
+    FileShard& files = fileShardFor(file);
+    std::lock_guard<std::mutex> lock(files.mutex);
+    auto it = files.files.find(file);
+    return it != files.files.end() ? it->second.size() : 0;
+}
+
+size_t DedupIndex::driveOf(const ContentKey& key) {
+    ContentShard& shard = contentShardFor(key.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return find(shard, key)->drive;
+}
+
+bool DedupIndex::relocate(const ContentKey& key, size_t from, size_t to) {
+    ContentShard& shard = contentShardFor(key.fingerprint);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Entry* entry = find(shard, key);
+    if (!entry || entry->drive != from) {
+        return false;
+    }
+    entry->drive = to;
+    return true;
+}
+
+std::vector<DedupIndex::Stored> DedupIndex::snapshot() {
+    std::vector<Stored> stored;
+    for (auto& shard : content_shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& fingerprint : shard.entries) {
+            for (const auto& entry : fingerprint.second) {
+                if (entry.published) {
+                    stored.push_back({{fingerprint.first, entry.generation}, entry.drive});
+                }
+            }
+        }
+    }
+    return stored;
+}
@@ -1,40 +1,73 @@
 #include "storage_accelerator/load_balancer.h"
 #include <limits>
 #include <algorithm>
+#include <random>
+#include <thread>
 
 size_t LoadBalancer::selectDrive(size_t primary_drive, size_t size) {
-    // Check load of primary drive
+    std::vector<size_t> all(drive_stats_.size());
+    for (size_t i = 0; i < all.size(); i++) {
+        all[i] = i;
+    }
+    return selectDrive(primary_drive, size, all);
+}
+
+size_t LoadBalancer::selectDrive(size_t primary_drive, size_t size,
+                                 const std::vector<size_t>& candidates) {
     if (primary_drive >= drive_stats_.size()) {
         logger_->error("Invalid primary drive index: " + std::to_string(primary_drive));
         return 0;
     }
 
-    auto& primary_stats = drive_stats_[primary_drive];
-    if (primary_stats.pending_ops < MAX_PENDING_OPS) {
+    // Placement stays on the hash primary unless it is clearly hot
+    double primary_wait = expectedWait(primary_drive, size);
+    double threshold_ms = options_.redirect_threshold.count() / 1e3;
+    if (!options_.enabled || candidates.size() < 2 || primary_wait <= threshold_ms) {
         return primary_drive;
     }
 
-    // Find least loaded drive
-    size_t selected = primary_drive;
-    size_t min_ops = primary_stats.pending_ops;
-
-    for (size_t i = 0; i < drive_stats_.size(); i++) {
-        if (drive_stats_[i].pending_ops < min_ops) {
-            min_ops = drive_stats_[i].pending_ops;
-            selected = i;
-        }
+    size_t first = candidates[sampleDrive(candidates.size())];
+    size_t second = candidates[sampleDrive(candidates.size())];
+    size_t candidate = expectedWait(first, size) <= expectedWait(second, size) ? first : second;
+    if (candidate == primary_drive ||
+        expectedWait(candidate, size) > primary_wait * options_.redirect_margin) {
+        return primary_drive;
     }
 
-    if (selected != primary_drive) {
-        logger_->debug("Load balanced: Redirecting from drive " + 
-                      std::to_string(primary_drive) + " to " + 
-                      std::to_string(selected));
+    LOG_DEBUG(*logger_, "Load balanced: Redirecting from drive " +
+              std::to_string(primary_drive) + " to " +
+              std::to_string(candidate));
+    return candidate;
+}
+
+double LoadBalancer::expectedWait(size_t drive_id, size_t size) const {
+    const auto& stats = drive_stats_[drive_id];
+    double wait = (stats.pending_ops.load(std::memory_order_relaxed) + 1) *
+                  stats.avg_latency.load(std::memory_order_relaxed);
+    double throughput = stats.avg_throughput.load(std::memory_order_relaxed);
+    if (throughput > 0.0) {
+        wait += size / throughput * 1e3;
     }
+    return wait;
+}
+
+void LoadBalancer::updateAverage(std::atomic<double>& average, double sample) {
+    // The first sample seeds the average instead of being damped towards 0
+    double old_value = average.load(std::memory_order_relaxed);
+    double new_value;
+    do {
+        new_value = old_value == 0.0 ? sample
+                                     : old_value + options_.ewma_alpha * (sample - old_value);
+    } while (!average.compare_exchange_weak(old_value, new_value, std::memory_order_relaxed));
+}
 
-    return selected;
+size_t LoadBalancer::sampleDrive(size_t count) {
+    thread_local std::minstd_rand rng(
+        static_cast<unsigned>(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+    return rng() % count;
 }
 
-void LoadBalancer::recordOperation(size_t drive_id, size_t size, 
+void LoadBalancer::recordOperation(size_t drive_id, size_t size,
                                  const std::chrono::nanoseconds& duration) {
     if (drive_id >= drive_stats_.size()) {
         logger_->error("Invalid drive ID in recordOperation: " + std::to_string(drive_id));
@@ -43,18 +76,20 @@ void LoadBalancer::recordOperation(size_t drive_id, size_t size,
 
     auto& stats = drive_stats_[drive_id];
     stats.total_bytes += size;
-    
+
     double duration_ms = duration.count() / 1e6;  // Convert to milliseconds
-    double old_latency = stats.avg_latency.load();
-    stats.avg_latency.store((old_latency + duration_ms) / 2.0);
-    
+    updateAverage(stats.avg_latency, duration_ms);
+    if (size > 0 && duration.count() > 0) {
+        updateAverage(stats.avg_throughput, size / (duration.count() / 1e9));
+    }
+
     size_t old_pending = stats.pending_ops.fetch_sub(1);
     if (old_pending == 0) {
         logger_->error("Pending ops underflow for drive " + std::to_string(drive_id));
     }
 
     if (duration_ms > 100.0) {  // More than 100ms
-        logger_->info("High latency operation on drive " + std::to_string(drive_id) + 
+        logger_->info("High latency operation on drive " + std::to_string(drive_id) +
                      ": " + std::to_string(duration_ms) + "ms");
     }
 }
@@ -66,4 +101,4 @@ void LoadBalancer::startOperation(size_t drive_id) {
     }
 
     drive_stats_[drive_id].pending_ops++;
-}
\ No newline at end of file
+}
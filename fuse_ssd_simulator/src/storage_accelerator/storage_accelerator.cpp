@@ -3,491 +3,2233 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+#include <stdexcept>
+
+namespace {
+
+AcceleratorConfig makeConfig(int num_drives, const std::string& hash_seed,
+                             const BlockCacheOptions& cache_options,
+                             const PersistenceOptions& persistence,
+                             const ThreadingOptions& threading, const DedupOptions& dedup,
+                             const SmallFileOptions& small_files) {
+    AcceleratorConfig config;
+    config.num_drives = num_drives;
+    config.hash_seed = hash_seed;
+    config.cache = cache_options;
+    config.persistence = persistence;
+    config.threading = threading;
+    config.dedup = dedup;
+    config.small_files = small_files;
+    return config;
+}
+
+bool isPowerOfTwo(size_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Checked before any member is built, the cache and the ring depend on these
+const AcceleratorConfig& validated(const AcceleratorConfig& config) {
+    if (config.num_drives < 1 ||
+        config.num_drives > static_cast<int>(StorageAccelerator::MAX_DRIVES)) {
+        throw std::runtime_error("drive count " + std::to_string(config.num_drives) +
+                                 " is not from 1 to " +
+                                 std::to_string(StorageAccelerator::MAX_DRIVES));
+    }
+    size_t block_size = config.drives.block_size;
+    if (!isPowerOfTwo(block_size) || block_size < StorageAccelerator::MIN_BLOCK_SIZE ||
+        block_size > StorageAccelerator::MAX_BLOCK_SIZE) {
+        throw std::runtime_error("block size " + std::to_string(block_size) +
+                                 " is not a power of two from " +
+                                 std::to_string(StorageAccelerator::MIN_BLOCK_SIZE) + " to " +
+                                 std::to_string(StorageAccelerator::MAX_BLOCK_SIZE));
+    }
+    if (config.stripe_unit % block_size != 0 ||
+        config.stripe_unit > StorageAccelerator::MAX_STRIPE_UNIT) {
+        throw std::runtime_error("stripe unit " + std::to_string(config.stripe_unit) +
+                                 " is not a multiple of the block size up to " +
+                                 std::to_string(StorageAccelerator::MAX_STRIPE_UNIT));
+    }
+    return config;
+}
 
-StorageAccelerator::StorageAccelerator(int num_drives, const std::string& hash_seed)
-    : num_drives_(num_drives),
-      hashing_module_(std::make_unique<HashingModule>(hash_seed)),
+}  // namespace
+
+StorageAccelerator::StorageAccelerator(int num_drives, const std::string& hash_seed,
+                                       const BlockCacheOptions& cache_options,
+                                       const PersistenceOptions& persistence,
+                                       const ThreadingOptions& threading,
+                                       const DedupOptions& dedup,
+                                       const SmallFileOptions& small_files)
+    : StorageAccelerator(makeConfig(num_drives, hash_seed, cache_options, persistence, threading,
+                                    dedup, small_files)) {}
+
+StorageAccelerator::StorageAccelerator(const AcceleratorConfig& config)
+    : logger_("StorageAccelerator"),
+      persistence_(validated(config).persistence),
+      threading_(config.threading),
+      drive_options_(config.drives),
+      block_size_(config.drives.block_size),
+      default_stripe_unit_(config.stripe_unit ? config.stripe_unit : config.drives.block_size),
+      topology_(CpuTopology::detect()),
+      num_drives_(config.num_drives),
+      hashing_module_(std::make_unique<HashingModule>(config.hash_seed)),
+      load_balancer_(std::make_unique<LoadBalancer>(MAX_DRIVES, &logger_, config.load_balancer)),
       metadata_manager_(std::make_unique<MetadataManager>()),
-      load_balancer_(std::make_unique<LoadBalancer>(num_drives, &logger_)),
-      logger_("StorageAccelerator") {
-    
+      cache_(block_size_, config.cache),
+      dedup_options_(config.dedup),
+      inline_limit_(std::min(config.small_files.inline_limit, block_size_)),
+      pool_(std::make_unique<ThreadPool>(
+          threading_.pool_threads,
+          threading_.pin_threads ? topology_.spread(threading_.pool_threads)
+                                 : std::vector<std::vector<int>>())) {
     logger_.info("Initializing Storage Accelerator with " + std::to_string(num_drives_) + " drives.");
-    drives_.reserve(num_drives_);
-    
-    for (int i = 0; i < num_drives_; ++i) {
-        logger_.info("Initializing SSD Simulator Drive " + std::to_string(i));
-        drives_.emplace_back(std::make_unique<SSD_Simulator>(i, &logger_));
+    // Fixed slots, so drives can come and go without moving the others
+    drives_.resize(MAX_DRIVES);
+    auto ring = std::make_shared<ConsistentHashRing>();
+
+    // The index of stored blocks is not persisted yet
+    if (dedup_options_.enabled && persistent()) {
+        throw std::runtime_error("deduplication cannot be combined with persistence");
+    }
+
+    std::vector<size_t> drive_ids;
+    if (persistent()) {
+        std::filesystem::create_directories(persistence_.directory);
+        int ret = metadata_manager_->open(persistence_.directory);
+        if (ret < 0) {
+            throw std::runtime_error("cannot load metadata from " + persistence_.directory + ": " +
+                                     strerror(-ret));
+        }
+        drive_ids = existingDrives();
+        if (!drive_ids.empty()) {
+            logger_.info("Reopening " + std::to_string(drive_ids.size()) + " drives in " +
+                         persistence_.directory);
+            num_drives_ = drive_ids.size();
+        }
+    }
+    if (drive_ids.empty()) {
+        for (int i = 0; i < num_drives_; ++i) {
+            drive_ids.push_back(i);
+        }
+    }
+
+    for (size_t drive : drive_ids) {
+        logger_.info("Initializing SSD Simulator Drive " + std::to_string(drive));
+        drives_[drive] = makeDrive(drive);
+        ring->addDrive(drive);
+    }
+    ring_ = ring;
+    if (persistent()) {
+        restoreBlocks();
     }
+
+    rebalancer_ = std::thread(&StorageAccelerator::rebalanceLoop, this);
+    reclaimer_ = std::thread(&StorageAccelerator::reclaimLoop, this);
 }
 
 StorageAccelerator::~StorageAccelerator() {
     logger_.info("Shutting down Storage Accelerator.");
+    // The rebalancer hands migrations to the pool, so it stops first
+    {
+        std::lock_guard<std::mutex> lock(rebalance_mutex_);
+        rebalance_stop_ = true;
+    }
+    rebalance_cv_.notify_all();
+    rebalancer_.join();
+    // Queued flushes run next, then nothing dirty may stay behind
+    pool_.reset();
+    flushAll();
+    {
+        std::lock_guard<std::mutex> lock(reclaim_mutex_);
+        reclaim_stop_ = true;
+    }
+    reclaim_cv_.notify_all();
+    reclaimer_.join();
+
+    // The next start then loads the table instead of replaying a long log
+    if (metadata_manager_->checkpoint() < 0) {
+        logger_.error("Metadata checkpoint on shutdown failed, the log will be replayed");
+    }
 }
 
 std::shared_ptr<FileMetadata> StorageAccelerator::getMetadata(const std::string& path) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+    TRACE_SCOPE("accel", "metadata_lookup");
     return metadata_manager_->getMetadata(path);
 }
 
-std::vector<std::string> StorageAccelerator::listDirectory(const std::string& path) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
-    return metadata_manager_->listDirectory(path);
+std::shared_ptr<FileMetadata> StorageAccelerator::getMetadata(uint64_t ino) {
+    TRACE_SCOPE("accel", "metadata_lookup");
+    return metadata_manager_->getMetadata(ino);
 }
 
-int StorageAccelerator::createFile(const std::string& path, mode_t mode) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
-    
-    if (metadata_manager_->exists(path)) {
-        logger_.error("Create File Failed: " + path + " already exists");
-        return -EEXIST;
-    }
-
-    // Calculate the correct mode by preserving only the permission bits from the input mode
-    // and adding the regular file type bit
-    mode_t adjusted_mode = S_IFREG | (mode & 0777);
+std::string StorageAccelerator::getPath(uint64_t ino) {
+    return metadata_manager_->getPath(ino);
+}
 
-    // Debug log the modes
-    logger_.debug("Creating file with requested mode: " + std::to_string(mode) + 
-                 ", adjusted mode: " + std::to_string(adjusted_mode));
+void StorageAccelerator::lookupInode(uint64_t ino) {
+    metadata_manager_->lookup(ino);
+}
 
-    FileMetadata metadata;
-    metadata.mode = adjusted_mode;
-    metadata.nlink = 1;
-    metadata.uid = getuid();
-    metadata.gid = getgid();
-    metadata.size = 0;
-    metadata.atime = time(nullptr);
-    metadata.mtime = metadata.atime;
-    metadata.ctime = metadata.atime;
+void StorageAccelerator::forgetInode(uint64_t ino, uint64_t nlookup) {
+    releaseUnlinked(metadata_manager_->forget(ino, nlookup));
+}
 
-    metadata_manager_->addMetadata(path, metadata);
-    logger_.info("File created: " + path);
-    return 0;
+void StorageAccelerator::openFile(uint64_t ino) {
+    metadata_manager_->openHandle(ino);
 }
 
-int StorageAccelerator::deleteFile(const std::string& path) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+void StorageAccelerator::releaseUnlinked(const std::shared_ptr<FileMetadata>& entry) {
+    if (entry && (entry->mode & S_IFMT) == S_IFREG) {
+        releaseData(dataObject(entry->ino), entry->ino);
+    }
+}
 
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Delete File Failed: " + path + " does not exist");
-        return -ENOENT;
+void StorageAccelerator::exportMetrics(PrometheusWriter& writer) {
+    writer.family("fuse_ssd_fs_latency_seconds", "summary",
+                  "Time to serve a file read or write across all drives");
+    writer.summary("fuse_ssd_fs_latency_seconds", "op=\"read\"", read_stats_.latency);
+    writer.summary("fuse_ssd_fs_latency_seconds", "op=\"write\"", write_stats_.latency);
+    writer.family("fuse_ssd_fs_bytes_total", "counter", "Bytes read or written by file operations");
+    writer.sample("fuse_ssd_fs_bytes_total", "op=\"read\"", read_stats_.bytes.load());
+    writer.sample("fuse_ssd_fs_bytes_total", "op=\"write\"", write_stats_.bytes.load());
+    writer.family("fuse_ssd_fs_errors_total", "counter", "File reads or writes that failed");
+    writer.sample("fuse_ssd_fs_errors_total", "op=\"read\"", read_stats_.errors.load());
+    writer.sample("fuse_ssd_fs_errors_total", "op=\"write\"", write_stats_.errors.load());
+
+    writer.family("fuse_ssd_cache_hits_total", "counter", "Block reads served from the cache");
+    writer.sample("fuse_ssd_cache_hits_total", "", cache_.hits());
+    writer.family("fuse_ssd_cache_misses_total", "counter", "Block reads that went to the drives");
+    writer.sample("fuse_ssd_cache_misses_total", "", cache_.misses());
+    writer.family("fuse_ssd_cache_evictions_total", "counter", "Clean blocks evicted by CLOCK");
+    writer.sample("fuse_ssd_cache_evictions_total", "", cache_.evictions());
+    writer.family("fuse_ssd_cache_dirty_blocks", "gauge", "Blocks waiting to be written back");
+    writer.sample("fuse_ssd_cache_dirty_blocks", "", cache_.dirtyBlocks());
+    writer.family("fuse_ssd_readahead_blocks_total", "counter",
+                  "Blocks prefetched for sequential readers");
+    writer.sample("fuse_ssd_readahead_blocks_total", "", readaheadBlocks());
+    writer.family("fuse_ssd_inline_spills_total", "counter",
+                  "Small files moved from their metadata entry to the drives");
+    writer.sample("fuse_ssd_inline_spills_total", "", inlineSpills());
+    if (dedup_options_.enabled) {
+        writer.family("fuse_ssd_dedup_stored_blocks", "gauge", "Distinct blocks stored on the drives");
+        writer.sample("fuse_ssd_dedup_stored_blocks", "", dedup_index_.uniqueBlocks());
+        writer.family("fuse_ssd_dedup_file_blocks", "gauge", "File blocks pointing at a stored block");
+        writer.sample("fuse_ssd_dedup_file_blocks", "", dedup_index_.referencedBlocks());
+        writer.family("fuse_ssd_dedup_hits_total", "counter",
+                      "Block writes turned into a reference to a stored block");
+        writer.sample("fuse_ssd_dedup_hits_total", "", dedupHits());
+        writer.family("fuse_ssd_dedup_collisions_total", "counter",
+                      "Fingerprint matches whose bytes differed");
+        writer.sample("fuse_ssd_dedup_collisions_total", "", dedup_collisions_.load());
     }
 
-    if ((metadata->mode & S_IFMT) != S_IFREG) {
-        logger_.error("Delete File Failed: " + path + " is not a regular file");
-        return -EISDIR;
+    // Slots only change under pool_mutex_, so drives cannot go away mid-export
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    std::vector<SSD_Simulator*> drives;
+    for (const auto& drive : drives_) {
+        if (drive) {
+            drives.push_back(drive.get());
+        }
     }
 
-    // Clean up file data from the drive
-    SSD_Simulator* drive = selectDrive(path, 0);
-    if (drive) {
-        auto promise_ptr = std::make_shared<IOPromise>();
-        auto future = promise_ptr->promise.get_future();
-        
-        IORequest request;
-        request.type = IOType::DELETE;
-        request.path = path;
-        request.promise = promise_ptr;
-        drive->enqueueIO(request);
-        
-        // Wait for completion
-        auto status = future.wait_for(std::chrono::seconds(5));
-        if (status == std::future_status::timeout) {
-            logger_.error("Delete operation timed out for " + path);
-            return -ETIMEDOUT;
+    auto opLabels = [](const SSD_Simulator* drive, size_t type) {
+        return "drive=\"" + std::to_string(drive->driveId()) + "\",op=\"" +
+               ioTypeName(static_cast<IOType>(type)) + "\"";
+    };
+
+    writer.family("fuse_ssd_drive_ops_total", "counter", "Requests completed by each drive");
+    for (auto* drive : drives) {
+        for (size_t type = 0; type < NUM_IO_TYPES; type++) {
+            if (drive->metrics().ops[type].ops.load() > 0) {
+                writer.sample("fuse_ssd_drive_ops_total", opLabels(drive, type),
+                              drive->metrics().ops[type].ops.load());
+            }
+        }
+    }
+    writer.family("fuse_ssd_drive_errors_total", "counter", "Requests that failed on each drive");
+    for (auto* drive : drives) {
+        for (size_t type = 0; type < NUM_IO_TYPES; type++) {
+            if (drive->metrics().ops[type].ops.load() > 0) {
+                writer.sample("fuse_ssd_drive_errors_total", opLabels(drive, type),
+                              drive->metrics().ops[type].errors.load());
+            }
+        }
+    }
+    writer.family("fuse_ssd_drive_bytes_total", "counter", "Bytes transferred by each drive");
+    for (auto* drive : drives) {
+        for (IOType type : {IOType::READ, IOType::WRITE}) {
+            writer.sample("fuse_ssd_drive_bytes_total", opLabels(drive, static_cast<size_t>(type)),
+                          drive->metrics().ops[static_cast<size_t>(type)].bytes.load());
+        }
+    }
+    writer.family("fuse_ssd_drive_latency_seconds", "summary",
+                  "Time from submission to completion on each drive");
+    for (auto* drive : drives) {
+        for (size_t type = 0; type < NUM_IO_TYPES; type++) {
+            if (drive->metrics().ops[type].ops.load() > 0) {
+                writer.summary("fuse_ssd_drive_latency_seconds", opLabels(drive, type),
+                               drive->metrics().ops[type].latency);
+            }
         }
     }
 
-    metadata_manager_->removeMetadata(path);
-    logger_.info("File deleted: " + path);
-    return 0;
+    writer.family("fuse_ssd_drive_queue_depth", "gauge", "Requests submitted and not yet completed");
+    for (auto* drive : drives) {
+        writer.sample("fuse_ssd_drive_queue_depth", "drive=\"" + std::to_string(drive->driveId()) + "\"",
+                      drive->metrics().queue_depth.load());
+    }
+    writer.family("fuse_ssd_drive_blocks_in_use", "gauge", "Data blocks held by each drive");
+    for (auto* drive : drives) {
+        writer.sample("fuse_ssd_drive_blocks_in_use", "drive=\"" + std::to_string(drive->driveId()) + "\"",
+                      drive->blocksInUse());
+    }
+    writer.family("fuse_ssd_drive_throughput_bytes_per_second", "gauge",
+                  "Smoothed per-block throughput seen by the load balancer");
+    for (auto* drive : drives) {
+        writer.sample("fuse_ssd_drive_throughput_bytes_per_second",
+                      "drive=\"" + std::to_string(drive->driveId()) + "\"",
+                      load_balancer_->stats(drive->driveId()).avg_throughput.load());
+    }
+    writer.family("fuse_ssd_drive_pending_operations", "gauge",
+                  "Requests the load balancer counts as in flight on each drive");
+    for (auto* drive : drives) {
+        writer.sample("fuse_ssd_drive_pending_operations",
+                      "drive=\"" + std::to_string(drive->driveId()) + "\"",
+                      load_balancer_->stats(drive->driveId()).pending_ops.load());
+    }
+    writer.family("fuse_ssd_drive_expected_wait_seconds", "gauge",
+                  "Load balancer estimate of the wait for a new one-block request");
+    for (auto* drive : drives) {
+        writer.sample("fuse_ssd_drive_expected_wait_seconds",
+                      "drive=\"" + std::to_string(drive->driveId()) + "\"",
+                      load_balancer_->expectedWait(drive->driveId(), block_size_) / 1e3);
+    }
 }
 
-int StorageAccelerator::createDirectory(const std::string& path, mode_t mode) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+std::string StorageAccelerator::driveFile(size_t drive) const {
+    return persistence_.directory + "/drive_" + std::to_string(drive) + ".slots";
+}
 
-    if (metadata_manager_->exists(path)) {
-        logger_.error("Create Directory Failed: " + path + " already exists");
-        return -EEXIST;
+std::unique_ptr<SSD_Simulator> StorageAccelerator::makeDrive(size_t drive) {
+    auto ssd = std::make_unique<SSD_Simulator>(drive, &logger_, drive_options_.channels,
+                                               drive_options_.latency,
+                                               persistent() ? driveFile(drive) : std::string(),
+                                               persistence_.drive_blocks, block_size_,
+                                               drive_options_.queue_size);
+
+    // Before any I/O, so the drive's blocks are first touched on its node
+    if (threading_.pin_threads) {
+        size_t node = topology_.nodeOfDrive(drive);
+        int ret = ssd->pinWorkers(topology_.nodeCpus(node));
+        if (ret < 0) {
+            logger_.error("Could not pin drive " + std::to_string(drive) + " to NUMA node " +
+                          std::to_string(node) + ": " + strerror(-ret));
+        }
     }
+    return ssd;
+}
 
-    // Calculate the correct mode by preserving only the permission bits from the input mode
-    // and adding the directory type bit
-    mode_t adjusted_mode = S_IFDIR | (mode & 0777);
+std::vector<size_t> StorageAccelerator::existingDrives() {
+    std::vector<size_t> drives;
+    for (const auto& entry : std::filesystem::directory_iterator(persistence_.directory)) {
+        std::string name = entry.path().filename().string();
+        unsigned long drive = 0;
+        char suffix[8] = {};
+        if (sscanf(name.c_str(), "drive_%lu.%7s", &drive, suffix) == 2 &&
+            strcmp(suffix, "slots") == 0 && drive < MAX_DRIVES) {
+            drives.push_back(drive);
+        }
+    }
+    std::sort(drives.begin(), drives.end());
+    return drives;
+}
 
-    // Debug log the modes
-    logger_.debug("Creating directory with requested mode: " + std::to_string(mode) + 
-                 ", adjusted mode: " + std::to_string(adjusted_mode));
+void StorageAccelerator::restoreBlocks() {
+    // Units first, drive blocks are grouped by them below
+    for (const auto& path : metadata_manager_->listSubtree("/")) {
+        auto metadata = metadata_manager_->getMetadata(path);
+        if (metadata && S_ISREG(metadata->mode) && metadata->stripe_unit != block_size_ &&
+            metadata->stripe_unit != 0) {
+            block_map_.setStripeUnit(metadata->ino, metadata->stripe_unit);
+        }
+    }
 
-    FileMetadata metadata;
-    metadata.mode = adjusted_mode;
-    metadata.nlink = 2;  // . and ..
-    metadata.uid = getuid();
-    metadata.gid = getgid();
-    metadata.size = 0;
-    metadata.atime = time(nullptr);
-    metadata.mtime = metadata.atime;
-    metadata.ctime = metadata.atime;
+    size_t restored = 0;
+    size_t dropped = 0;
+    for (size_t drive = 0; drive < MAX_DRIVES; drive++) {
+        if (!drives_[drive]) {
+            continue;
+        }
 
-    metadata_manager_->addMetadata(path, metadata);
-    logger_.info("Directory created: " + path);
-    return 0;
-}
+        std::set<std::string> orphans;
+        for (const auto& block : drives_[drive]->storedBlocks()) {
+            uint64_t file_id = 0;
+            if (block.file.compare(0, 4, "ino:") == 0) {
+                file_id = strtoull(block.file.c_str() + 4, nullptr, 10);
+            }
+            // Unlinked before the restart with its data not yet reclaimed
+            if (file_id == 0 || metadata_manager_->getPath(file_id).empty()) {
+                orphans.insert(block.file);
+                continue;
+            }
 
-int StorageAccelerator::removeDirectory(const std::string& path) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+            // Migrations discard their source under the file's exclusive
+            // lock, so a block found twice is the same data twice
+            off_t offset = block.index * block_size_;
+            size_t unit = stripeUnitOf(file_id);
+            size_t holder = block_map_.place(file_id, offset / unit * unit, drive);
+            if (holder == drive) {
+                restored++;
+                continue;
+            }
+            IORequest request;
+            request.type = IOType::DISCARD;
+            request.path = block.file;
+            request.offset = offset;
+            request.size = block_size_;
+            drives_[drive]->submitAndWait(std::move(request));
+            dropped++;
+        }
 
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Remove Directory Failed: " + path + " does not exist");
-        return -ENOENT;
+        for (const auto& object : orphans) {
+            IORequest request;
+            request.type = IOType::DELETE;
+            request.path = object;
+            drives_[drive]->submitAndWait(std::move(request));
+            dropped++;
+        }
     }
+    logger_.info("Restored " + std::to_string(restored) + " blocks, dropped " +
+                 std::to_string(dropped) + " stale copies and unlinked files");
+}
 
-    if ((metadata->mode & S_IFMT) != S_IFDIR) {
-        logger_.error("Remove Directory Failed: " + path + " is not a directory");
-        return -ENOTDIR;
+void StorageAccelerator::persistAttributes(const std::string& path, const FileMetadata& metadata) {
+    if (metadata_manager_->logAttributes(metadata) < 0) {
+        logger_.error("Metadata log: could not record attributes of " + path);
     }
+    maybeCheckpoint();
+}
 
-    auto entries = metadata_manager_->listDirectory(path);
-    if (!entries.empty()) {
-        logger_.error("Remove Directory Failed: " + path + " is not empty");
-        return -ENOTEMPTY;
+void StorageAccelerator::maybeCheckpoint() {
+    // One checkpoint at a time, off the request path
+    if (!metadata_manager_->checkpointDue() || checkpoint_queued_.exchange(true)) {
+        return;
     }
+    pool_->enqueue([this]() {
+        checkpoint_queued_ = false;
+        int ret = metadata_manager_->checkpoint();
+        if (ret < 0) {
+            logger_.error("Metadata checkpoint failed: " + std::string(strerror(-ret)));
+        }
+    });
+}
 
-    metadata_manager_->removeMetadata(path);
-    logger_.info("Directory removed: " + path);
-    return 0;
+std::shared_ptr<const ConsistentHashRing> StorageAccelerator::placementRing() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    return ring_;
 }
 
-int StorageAccelerator::renameFile(const std::string& from, const std::string& to, unsigned int flags) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+std::shared_mutex& StorageAccelerator::migrationLockFor(uint64_t file_id) {
+    return migration_locks_[file_id % NUM_MIGRATION_LOCKS];
+}
 
-    auto src_metadata = metadata_manager_->getMetadata(from);
-    if (!src_metadata) {
-        logger_.error("Rename Failed: Source " + from + " does not exist");
-        return -ENOENT;
-    }
+std::mutex& StorageAccelerator::flushLockFor(uint64_t file_id) {
+    return flush_locks_[file_id % NUM_FLUSH_LOCKS];
+}
 
-    if (metadata_manager_->exists(to)) {
-        logger_.error("Rename Failed: Destination " + to + " already exists");
-        return -EEXIST;
-    }
-
-    // Move the data between drives if necessary
-    SSD_Simulator* src_drive = selectDrive(from, src_metadata->size);
-    SSD_Simulator* dst_drive = selectDrive(to, src_metadata->size);
-    
-    if (src_drive != dst_drive && (src_metadata->mode & S_IFMT) == S_IFREG) {
-        std::vector<char> buffer(BLOCK_SIZE);
-        size_t total_moved = 0;
-            
-        while (total_moved < src_metadata->size) {
-            size_t remaining = src_metadata->size - total_moved;
-            size_t to_move = std::min(remaining, BLOCK_SIZE);
-                
-            // Read from source
-            auto read_promise = std::make_shared<IOPromise>();
-            auto read_future = read_promise->promise.get_future();
-                
-            IORequest read_req;
-            read_req.type = IOType::READ;
-            read_req.path = from;
-            read_req.buffer = buffer.data();
-            read_req.size = to_move;
-            read_req.offset = total_moved;
-            read_req.promise = read_promise;
-                
-            src_drive->enqueueIO(read_req);
-                
-            ssize_t bytes_read = read_future.get();
-            if (bytes_read < 0) {
-                logger_.error("Rename Failed: Error reading from source file");
-                return -EIO;
-            }
-                
-            // Write to destination
-            auto write_promise = std::make_shared<IOPromise>();
-            auto write_future = write_promise->promise.get_future();
-                
-            IORequest write_req;
-            write_req.type = IOType::WRITE;
-            write_req.path = to;
-            write_req.buffer = buffer.data();
-            write_req.size = bytes_read;
-            write_req.offset = total_moved;
-            write_req.promise = write_promise;
-                
-            dst_drive->enqueueIO(write_req);
-                
-            ssize_t bytes_written = write_future.get();
-            if (bytes_written < 0) {
-                logger_.error("Rename Failed: Error writing to destination file");
-                return -EIO;
-            }
-                
-            total_moved += bytes_written;
-        }
-            
-        // Delete source file
-        auto delete_promise = std::make_shared<IOPromise>();
-        auto delete_future = delete_promise->promise.get_future();
-            
-        IORequest delete_req;
-        delete_req.type = IOType::DELETE;
-        delete_req.path = from;
-        delete_req.promise = delete_promise;
-            
-        src_drive->enqueueIO(delete_req);
-        delete_future.wait();
-    }
-
-    metadata_manager_->addMetadata(to, *src_metadata);
-    metadata_manager_->removeMetadata(from);
-    logger_.info("Renamed " + from + " to " + to);
-    return 0;
+std::string StorageAccelerator::dataObject(uint64_t file_id) {
+    return "ino:" + std::to_string(file_id);
 }
 
-int StorageAccelerator::chmodFile(const std::string& path, mode_t mode) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+std::vector<size_t> StorageAccelerator::activeDrives() {
+    return placementRing()->drives();
+}
 
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Chmod Failed: " + path + " does not exist");
-        return -ENOENT;
+int StorageAccelerator::addDrive() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    // A slot is free once its drive has left the ring and been drained
+    size_t drive = 0;
+    while (drive < MAX_DRIVES && drives_[drive]) {
+        drive++;
+    }
+    if (drive == MAX_DRIVES) {
+        logger_.error("Add Drive Failed: all " + std::to_string(MAX_DRIVES) + " slots in use");
+        return -ENOSPC;
     }
 
-    metadata->mode = (metadata->mode & S_IFMT) | (mode & 07777);
-    metadata->ctime = time(nullptr);
+    try {
+        drives_[drive] = makeDrive(drive);
+    } catch (const std::exception& e) {
+        logger_.error("Add Drive Failed: " + std::string(e.what()));
+        return -EIO;
+    }
+    auto ring = std::make_shared<ConsistentHashRing>(*ring_);
+    ring->addDrive(drive);
 
-    logger_.info("Changed mode of " + path + " to " + std::to_string(mode));
-    return 0;
+    publishRing(ring, -1);
+    logger_.info("Added drive " + std::to_string(drive));
+    return drive;
 }
 
-int StorageAccelerator::chownFile(const std::string& path, uid_t uid, gid_t gid) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
-
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Chown Failed: " + path + " does not exist");
+int StorageAccelerator::removeDrive(size_t drive) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (!ring_->contains(drive)) {
+        logger_.error("Remove Drive Failed: drive " + std::to_string(drive) + " is not in the pool");
         return -ENOENT;
     }
+    if (ring_->drives().size() == 1) {
+        logger_.error("Remove Drive Failed: drive " + std::to_string(drive) + " is the last drive");
+        return -EBUSY;
+    }
 
-    metadata->uid = uid;
-    metadata->gid = gid;
-    metadata->ctime = time(nullptr);
+    auto ring = std::make_shared<ConsistentHashRing>(*ring_);
+    ring->removeDrive(drive);
 
-    logger_.info("Changed owner of " + path + " to UID: " + std::to_string(uid) + 
-                ", GID: " + std::to_string(gid));
+    // The drive keeps serving its blocks until the rebalancer has moved them
+    publishRing(ring, drive);
+    logger_.info("Removing drive " + std::to_string(drive));
     return 0;
 }
 
-int StorageAccelerator::truncateFile(const std::string& path, off_t size) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+void StorageAccelerator::publishRing(std::shared_ptr<const ConsistentHashRing> ring, int removed_drive) {
+    // Caller holds pool_mutex_, so jobs queue in publication order and
+    // each one diffs against the ring it replaced
+    RebalanceJob job;
+    job.old_ring = ring_;
+    job.new_ring = ring;
+    job.removed_drive = removed_drive;
+    ring_ = ring;
+    num_drives_ = ring->drives().size();
 
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Truncate Failed: " + path + " does not exist");
-        return -ENOENT;
+    {
+        std::lock_guard<std::mutex> lock(rebalance_mutex_);
+        rebalance_jobs_.push_back(std::move(job));
     }
+    rebalance_cv_.notify_all();
+}
 
-    if ((metadata->mode & S_IFMT) != S_IFREG) {
-        logger_.error("Truncate Failed: " + path + " is not a regular file");
-        return -EISDIR;
-    }
+void StorageAccelerator::waitForRebalance() {
+    std::unique_lock<std::mutex> lock(rebalance_mutex_);
+    rebalance_cv_.wait(lock, [this]() { return rebalance_jobs_.empty() && !rebalance_busy_; });
+}
 
-    SSD_Simulator* drive = selectDrive(path, size);
-    if (drive) {
-        auto promise = std::make_shared<IOPromise>();
-        auto future = promise->promise.get_future();
-        
-        IORequest request;
-        request.type = IOType::TRUNCATE;
-        request.path = path;
-        request.size = size;
-        request.promise = promise;
-        
-        drive->enqueueIO(request);
-        
-        // Wait for completion with timeout
-        auto status = future.wait_for(std::chrono::seconds(5));
-        if (status == std::future_status::timeout) {
-            logger_.error("Truncate operation timed out for " + path);
-            return -ETIMEDOUT;
-        }
-        
-        ssize_t result = future.get();
-        if (result < 0) {
-            return result;
+void StorageAccelerator::rebalanceLoop() {
+    std::unique_lock<std::mutex> lock(rebalance_mutex_);
+    while (true) {
+        rebalance_cv_.wait(lock, [this]() { return rebalance_stop_ || !rebalance_jobs_.empty(); });
+        if (rebalance_stop_) {
+            break;
         }
-    }
 
-    metadata->size = size;
-    metadata->mtime = time(nullptr);
-    metadata->ctime = time(nullptr);
+        RebalanceJob job = std::move(rebalance_jobs_.front());
+        rebalance_jobs_.pop_front();
+        rebalance_busy_ = true;
+        lock.unlock();
 
-    logger_.info("Truncated " + path + " to size " + std::to_string(size));
-    return 0;
-}
+        rebalance(job);
 
-int StorageAccelerator::utimensFile(const std::string& path, const struct timespec ts[2]) {
-    std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
+        lock.lock();
+        rebalance_busy_ = false;
+        rebalance_cv_.notify_all();
+    }
+}
 
-    auto metadata = metadata_manager_->getMetadata(path);
-    if (!metadata) {
-        logger_.error("Utimens Failed: " + path + " does not exist");
-        return -ENOENT;
+void StorageAccelerator::rebalance(const RebalanceJob& job) {
+    // Wait out every transfer that may still be placing blocks with the old ring
+    for (auto& migration_lock : migration_locks_) {
+        std::unique_lock<std::shared_mutex> barrier(migration_lock);
     }
 
-    metadata->atime = ts[0].tv_sec;
-    metadata->mtime = ts[1].tv_sec;
+    // Only blocks that sat on their old hash owner follow the ring; blocks
+    // the load balancer put elsewhere stay unless their drive is leaving
+    struct Move {
+        BlockMap::Location block;
+        size_t target;
+        bool reclaim_source;
+    };
+    std::vector<Move> moves;
+    for (const auto& block : block_map_.snapshot()) {
+        uint64_t hash = hashing_module_->hashBlock(hashing_module_->fileKey(block.file),
+                                                   block.block_start / stripeUnitOf(block.file));
+        size_t target = job.new_ring->locate(hash);
+        if (target == block.drive) {
+            continue;
+        }
+        if (static_cast<int>(block.drive) != job.removed_drive &&
+            job.old_ring->locate(hash) != block.drive) {
+            continue;
+        }
 
-    logger_.info("Updated timestamps of " + path);
-    return 0;
-}
+        // A leaving drive is dropped as a whole, its copies need no discard,
+        // unless it may come back with them after a restart
+        moves.push_back({block, target,
+                         persistent() || static_cast<int>(block.drive) != job.removed_drive});
+    }
 
-ssize_t StorageAccelerator::readFile(const std::string& path, char* buffer, size_t size, off_t offset) {
-    auto metadata = getMetadata(path);
-    if (!metadata) {
-        logger_.error("Read Failed: " + path + " does not exist");
-        return -ENOENT;
+    // Each migration locks only its own file or stored block, so batches
+    // run side by side
+    std::vector<std::future<void>> batches;
+    for (size_t i = 0; i < moves.size(); i += MIGRATION_BATCH) {
+        size_t end = std::min(moves.size(), i + MIGRATION_BATCH);
+        batches.push_back(pool_->enqueue([this, &moves, i, end]() {
+            for (size_t j = i; j < end; j++) {
+                migrateBlock(moves[j].block, moves[j].target, moves[j].reclaim_source);
+            }
+        }));
     }
 
-    if (offset >= metadata->size) {
-        return 0;  // EOF
+    // Stored blocks follow the ring by fingerprint under the same rules
+    std::vector<std::pair<DedupIndex::Stored, size_t>> content_moves;
+    for (const auto& stored : dedup_index_.snapshot()) {
+        uint64_t hash = stored.key.fingerprint.low;
+        size_t target = job.new_ring->locate(hash);
+        if (target == stored.drive) {
+            continue;
+        }
+        if (static_cast<int>(stored.drive) != job.removed_drive &&
+            job.old_ring->locate(hash) != stored.drive) {
+            continue;
+        }
+        content_moves.push_back({stored, target});
+    }
+    for (size_t i = 0; i < content_moves.size(); i += MIGRATION_BATCH) {
+        size_t end = std::min(content_moves.size(), i + MIGRATION_BATCH);
+        batches.push_back(pool_->enqueue([this, &content_moves, i, end]() {
+            for (size_t j = i; j < end; j++) {
+                migrateContent(content_moves[j].first, content_moves[j].second);
+            }
+        }));
+    }
+
+    for (auto& batch : batches) {
+        batch.wait();
     }
+    size_t moved = moves.size() + content_moves.size();
 
-    ssize_t total_read = 0;
-    size_t remaining = std::min(size, static_cast<size_t>(metadata->size - offset));
+    if (job.removed_drive >= 0) {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        drives_[job.removed_drive].reset();
+        if (persistent()) {
+            unlink(driveFile(job.removed_drive).c_str());
+        }
+        logger_.info("Drive " + std::to_string(job.removed_drive) + " drained and removed");
+    }
+    logger_.info("Rebalance finished, moved " + std::to_string(moved) + " blocks");
+}
 
-    // Process in blocks
-    while (remaining > 0) {
-        size_t block_size = std::min(remaining, BLOCK_SIZE);
+void StorageAccelerator::migrateBlock(const BlockMap::Location& block, size_t to, bool reclaim_source) {
+    std::unique_lock<std::shared_mutex> lock(migrationLockFor(block.file));
+    // Deleted, truncated or already moved since the snapshot
+    if (block_map_.locate(block.file, block.block_start, to) != block.drive) {
+        return;
+    }
 
-        // Select drive based on block offset
-        std::string block_key = path + ":" + std::to_string(offset + total_read);
-        size_t primary_drive = getDriveIndex(block_key);
-        size_t selected_drive = load_balancer_->selectDrive(primary_drive, block_size);
-        
-        // Start operation
-        load_balancer_->startOperation(selected_drive);
-        auto start_time = std::chrono::steady_clock::now();
-        
-        ssize_t bytes = drives_[selected_drive]->readFile(
-            path,
-            buffer + total_read,
-            block_size,
-            offset + total_read
-        );
+    const size_t unit = stripeUnitOf(block.file);
+    std::vector<char> buffer(unit);
+    std::string object = dataObject(block.file);
+    ssize_t bytes = drives_[block.drive]->readFile(object, buffer.data(), unit, block.block_start);
+    // A failed read leaves the block where it is, the source is its only copy
+    if (bytes < 0 && bytes != -ENOENT) {
+        logger_.error("Rebalance: failed to read block " + std::to_string(block.block_start) +
+                     " of inode " + std::to_string(block.file) + " from drive " +
+                     std::to_string(block.drive));
+        return;
+    }
+    if (bytes > 0 &&
+        drives_[to]->writeFile(object, buffer.data(), bytes, block.block_start) != bytes) {
+        logger_.error("Rebalance: failed to move block " + std::to_string(block.block_start) +
+                     " of inode " + std::to_string(block.file) + " to drive " + std::to_string(to));
+        return;
+    }
+    block_map_.relocate(block.file, block.block_start, block.drive, to);
 
-        if (bytes < 0) {
-            logger_.error("Read Failed: Error reading from " + path + 
-                         " on drive " + std::to_string(selected_drive));
-            return bytes;
+    if (reclaim_source) {
+        IORequest request;
+        request.type = IOType::DISCARD;
+        request.path = object;
+        request.offset = block.block_start;
+        request.size = unit;
+        ssize_t result = drives_[block.drive]->submitAndWait(std::move(request));
+        if (result < 0 && result != -ENOENT) {
+            logger_.error("Rebalance: failed to discard block " + std::to_string(block.block_start) +
+                         " of inode " + std::to_string(block.file) + " on drive " +
+                         std::to_string(block.drive));
         }
+    }
+}
+
+size_t StorageAccelerator::stripeUnitOf(uint64_t file_id) {
+    return block_map_.stripeUnit(file_id, block_size_);
+}
 
-        // Record operation stats
-        auto duration = std::chrono::steady_clock::now() - start_time;
-        load_balancer_->recordOperation(
-            selected_drive,
-            bytes,
-            std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
-        );
+size_t StorageAccelerator::inheritedStripeUnit(const std::string& path) {
+    auto parent = metadata_manager_->getMetadata(MetadataManager::parentOf(path));
+    size_t unit = parent ? parent->stripe_unit.load() : 0;
+    return unit ? unit : default_stripe_unit_;
+}
 
-        total_read += bytes;
-        remaining -= bytes;
+int StorageAccelerator::setStripeUnit(const std::string& path, size_t unit) {
+    auto metadata = metadata_manager_->getMetadata(path);
+    if (!metadata) {
+        return -ENOENT;
+    }
+    bool directory = S_ISDIR(metadata->mode);
+    if (unit % block_size_ != 0 || unit > MAX_STRIPE_UNIT || (unit == 0 && !directory)) {
+        return -EINVAL;
     }
 
-  // Update access time
-    {
-        std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
-        auto metadata = metadata_manager_->getMetadata(path);
-        if (metadata) {
-            metadata->atime = time(nullptr);
+    if (directory) {
+        // Zero hands the mount default down again
+        metadata->stripe_unit = unit;
+    } else {
+        // Data already placed by the old unit would no longer be found
+        std::lock_guard<std::mutex> inline_lock(inlineLockFor(metadata->ino));
+        std::unique_lock<std::shared_mutex> lock(migrationLockFor(metadata->ino));
+        if (metadata->size > 0 || fileBlocks(metadata->ino) > 0) {
+            return -EBUSY;
         }
+        metadata->stripe_unit = unit;
+        block_map_.setStripeUnit(metadata->ino, unit);
     }
-    
-    return total_read;
+    metadata->ctime = time(nullptr);
+    persistAttributes(path, *metadata);
+    logger_.info("Stripe unit of " + path + " set to " + std::to_string(unit));
+    return 0;
 }
 
-ssize_t StorageAccelerator::writeFile(const std::string& path, const char* buffer, size_t size, off_t offset) {
-    auto metadata = getMetadata(path);
+int StorageAccelerator::getStripeUnit(const std::string& path, size_t& unit) {
+    auto metadata = metadata_manager_->getMetadata(path);
     if (!metadata) {
-        logger_.error("Write Failed: " + path + " does not exist");
         return -ENOENT;
     }
+    if (S_ISDIR(metadata->mode)) {
+        unit = metadata->stripe_unit ? metadata->stripe_unit.load() : default_stripe_unit_;
+    } else {
+        unit = stripeUnitOf(metadata->ino);
+    }
+    return 0;
+}
 
-    ssize_t total_written = 0;
-    size_t remaining = size;
+std::vector<std::string> StorageAccelerator::listDirectory(const std::string& path) {
+    return metadata_manager_->listDirectory(path);
+}
 
-    // Process in blocks
-    while (remaining > 0) {
-        size_t block_size = std::min(remaining, BLOCK_SIZE);
-        
-        // Select drive based on block offset
-        std::string block_key = path + ":" + std::to_string(offset + total_written);
-        size_t primary_drive = getDriveIndex(block_key);
-        size_t selected_drive = load_balancer_->selectDrive(primary_drive, block_size);
-        
-        // Start operation
-        load_balancer_->startOperation(selected_drive);
-        auto start_time = std::chrono::steady_clock::now();
-        
-        ssize_t bytes = drives_[selected_drive]->writeFile(
-            path,
-            buffer + total_written,
-            block_size,
-            offset + total_written
-        );
+std::vector<DirectoryEntry> StorageAccelerator::listEntries(const std::string& path) {
+    return metadata_manager_->listEntries(path);
+}
 
-        if (bytes < 0) {
-            logger_.error("Write Failed: Error writing to " + path + 
-                         " on drive " + std::to_string(selected_drive));
-            return bytes;
-        }
+int StorageAccelerator::createFile(const std::string& path, mode_t mode) {
+    // Calculate the correct mode by preserving only the permission bits from the input mode
+    // and adding the regular file type bit
+    mode_t adjusted_mode = S_IFREG | (mode & 0777);
 
-        // Record operation stats
-        auto duration = std::chrono::steady_clock::now() - start_time;
-        load_balancer_->recordOperation(
-            selected_drive,
-            bytes,
-            std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
-        );
+    // Debug log the modes
+    LOG_DEBUG(logger_, "Creating file with requested mode: " + std::to_string(mode) +
+              ", adjusted mode: " + std::to_string(adjusted_mode));
 
-        total_written += bytes;
-        remaining -= bytes;
+    FileMetadata metadata;
+    metadata.mode = adjusted_mode;
+    metadata.nlink = 1;
+    metadata.uid = getuid();
+    metadata.gid = getgid();
+    metadata.size = 0;
+    metadata.atime = time(nullptr);
+    metadata.mtime = metadata.atime.load();
+    metadata.ctime = metadata.atime.load();
+    if (inline_limit_ > 0) {
+        metadata.inline_data = std::make_shared<const std::string>();
     }
+    metadata.stripe_unit = inheritedStripeUnit(path);
 
-    // Update metadata
-    {
-        std::lock_guard<std::mutex> lock(metadata_manager_->mutex_);
-        auto metadata = metadata_manager_->getMetadata(path);
-        if (metadata) {
-            metadata->mtime = time(nullptr);
-            if (offset + total_written > metadata->size) {
-                metadata->size = offset + total_written;
-            }
+    int ret = metadata_manager_->createMetadata(path, metadata);
+    if (ret == -EEXIST) {
+        logger_.error("Create File Failed: " + path + " already exists");
+        return ret;
+    }
+    if (ret < 0) {
+        logger_.error("Create File Failed: parent of " + path + " does not exist or is not a directory");
+        return ret;
+    }
+    if (metadata.stripe_unit != block_size_) {
+        auto created = metadata_manager_->getMetadata(path);
+        if (created) {
+            block_map_.setStripeUnit(created->ino, metadata.stripe_unit);
         }
     }
-    
-    return total_written;
-}
 
-int StorageAccelerator::getDriveIndex(const std::string& path) {
-    uint64_t hash = hashing_module_->hash(path);
-    return hash % num_drives_;
-}
-
-SSD_Simulator* StorageAccelerator::selectDrive(const std::string& path, size_t size) {
-    int primary_index = getDriveIndex(path);
-    size_t selected_index = load_balancer_->selectDrive(primary_index, size);
-    logger_.debug("Selected drive " + std::to_string(selected_index) + 
-                 " for path: " + path);
-    return drives_[selected_index].get();
+    maybeCheckpoint();
+    logger_.info("File created: " + path);
+    return 0;
 }
 
-SSD_Simulator* StorageAccelerator::getDrive(const std::string& path) {
-    int index = getDriveIndex(path);
-    logger_.debug("Path: " + path + " mapped to Drive " + std::to_string(index));
-    return drives_[index].get();
-}
\ No newline at end of file
+int StorageAccelerator::deleteFile(const std::string& path) {
+    // Unlink first, the drive cleanup below runs without any metadata lock
+    std::shared_ptr<FileMetadata> removed;
+    int ret = metadata_manager_->unlinkMetadata(path, false, &removed);
+    if (ret == -ENOENT) {
+        logger_.error("Delete File Failed: " + path + " does not exist");
+        return ret;
+    }
+    if (ret == -EISDIR) {
+        logger_.error("Delete File Failed: " + path + " is not a regular file");
+        return ret;
+    }
+    if (ret < 0) {
+        logger_.error("Delete File Failed: could not log the unlink of " + path);
+        return ret;
+    }
+
+    // Still open or looked up, the data goes with the last reference
+    if (removed) {
+        releaseData(path, removed->ino);
+    }
+
+    maybeCheckpoint();
+    logger_.info("File deleted: " + path);
+    return 0;
+}
+
+void StorageAccelerator::releaseData(const std::string& path, uint64_t file_id) {
+    // Cached data of an unlinked file is dropped unflushed; taking the
+    // flush lock lets a flush already under way finish first
+    std::lock_guard<std::mutex> flush_lock(flushLockFor(file_id));
+    cache_.invalidate(file_id);
+
+    // Nothing can reach an unlinked inode's blocks any more, so large
+    // files are freed in the background and unlink returns right away
+    if (fileBlocks(file_id) > RECLAIM_SYNC_BLOCKS) {
+        {
+            std::lock_guard<std::mutex> lock(reclaim_mutex_);
+            reclaim_jobs_.push_back(file_id);
+        }
+        reclaim_cv_.notify_all();
+        return;
+    }
+
+    // Clean up file data from the drives, never in the middle of a migration
+    std::unique_lock<std::shared_mutex> migration_lock(migrationLockFor(file_id));
+    if (fanOut(IOType::DELETE, file_id, 0) < 0) {
+        logger_.error("Delete File: failed releasing data of " + path);
+    }
+    block_map_.erase(file_id);
+}
+
+void StorageAccelerator::reclaimLoop() {
+    std::unique_lock<std::mutex> lock(reclaim_mutex_);
+    while (true) {
+        reclaim_cv_.wait(lock, [this]() { return reclaim_stop_ || !reclaim_jobs_.empty(); });
+        if (reclaim_stop_) {
+            break;
+        }
+
+        uint64_t file_id = reclaim_jobs_.front();
+        reclaim_jobs_.pop_front();
+        reclaim_busy_ = true;
+        lock.unlock();
+
+        {
+            std::unique_lock<std::shared_mutex> migration_lock(migrationLockFor(file_id));
+            size_t blocks = fileBlocks(file_id);
+            if (fanOut(IOType::DELETE, file_id, 0) < 0) {
+                logger_.error("Reclaim: failed releasing data of inode " + std::to_string(file_id));
+            }
+            block_map_.erase(file_id);
+            LOG_DEBUG(logger_, "Reclaimed " + std::to_string(blocks) + " blocks of inode " +
+                      std::to_string(file_id));
+        }
+
+        lock.lock();
+        reclaim_busy_ = false;
+        reclaim_cv_.notify_all();
+    }
+}
+
+void StorageAccelerator::waitForReclaim() {
+    std::unique_lock<std::mutex> lock(reclaim_mutex_);
+    reclaim_cv_.wait(lock, [this]() { return reclaim_jobs_.empty() && !reclaim_busy_; });
+}
+
+size_t StorageAccelerator::blocksInUse() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    size_t blocks = 0;
+    for (const auto& drive : drives_) {
+        if (drive) {
+            blocks += drive->blocksInUse();
+        }
+    }
+    return blocks;
+}
+
+size_t StorageAccelerator::fileBlocks(uint64_t file_id) {
+    return dedup_options_.enabled ? dedup_index_.blockCount(file_id) : block_map_.blockCount(file_id);
+}
+
+ssize_t StorageAccelerator::fanOut(IOType type, uint64_t file_id, off_t size) {
+    if (dedup_options_.enabled) {
+        return dedupFanOut(type, file_id, size);
+    }
+    std::vector<size_t> targets = block_map_.drivesOf(file_id);
+    IOCompletionQueue completion;
+    for (size_t drive : targets) {
+        IORequest request;
+        request.type = type;
+        request.path = dataObject(file_id);
+        request.size = size;
+        request.completion = &completion;
+        request.user_data = drive;
+        drives_[drive]->enqueueIO(std::move(request));
+    }
+
+    std::vector<IOCompletion> completions;
+    if (completion.reap(completions, targets.size(), SSD_Simulator::IO_TIMEOUT) < targets.size()) {
+        return -ETIMEDOUT;
+    }
+    // A drive whose copy is already gone has nothing left to free
+    for (const auto& done : completions) {
+        if (done.result < 0 && done.result != -ENOENT) {
+            return done.result;
+        }
+    }
+    return 0;
+}
+
+int StorageAccelerator::createDirectory(const std::string& path, mode_t mode) {
+    // Calculate the correct mode by preserving only the permission bits from the input mode
+    // and adding the directory type bit
+    mode_t adjusted_mode = S_IFDIR | (mode & 0777);
+
+    // Debug log the modes
+    LOG_DEBUG(logger_, "Creating directory with requested mode: " + std::to_string(mode) +
+              ", adjusted mode: " + std::to_string(adjusted_mode));
+
+    FileMetadata metadata;
+    metadata.mode = adjusted_mode;
+    metadata.nlink = 2;  // . and ..
+    metadata.uid = getuid();
+    metadata.gid = getgid();
+    metadata.size = 0;
+    metadata.atime = time(nullptr);
+    metadata.mtime = metadata.atime.load();
+    metadata.ctime = metadata.atime.load();
+    auto parent = metadata_manager_->getMetadata(MetadataManager::parentOf(path));
+    if (parent) {
+        metadata.stripe_unit = parent->stripe_unit.load();
+    }
+
+    int ret = metadata_manager_->createMetadata(path, metadata);
+    if (ret == -EEXIST) {
+        logger_.error("Create Directory Failed: " + path + " already exists");
+        return ret;
+    }
+    if (ret < 0) {
+        logger_.error("Create Directory Failed: parent of " + path + " does not exist or is not a directory");
+        return ret;
+    }
+
+    maybeCheckpoint();
+    logger_.info("Directory created: " + path);
+    return 0;
+}
+
+int StorageAccelerator::removeDirectory(const std::string& path) {
+    int ret = metadata_manager_->unlinkMetadata(path, true);
+    if (ret == -ENOENT) {
+        logger_.error("Remove Directory Failed: " + path + " does not exist");
+        return ret;
+    }
+    if (ret == -ENOTDIR) {
+        logger_.error("Remove Directory Failed: " + path + " is not a directory");
+        return ret;
+    }
+    if (ret == -ENOTEMPTY) {
+        logger_.error("Remove Directory Failed: " + path + " is not empty");
+        return ret;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    maybeCheckpoint();
+    logger_.info("Directory removed: " + path);
+    return 0;
+}
+
+int StorageAccelerator::renameFile(const std::string& from, const std::string& to, unsigned int flags) {
+    // Only the namespace changes; data stays where its inode number put it
+    std::shared_ptr<FileMetadata> replaced;
+    int ret = metadata_manager_->renameMetadata(from, to, flags, &replaced);
+    if (ret == -ENOENT) {
+        logger_.error("Rename Failed: " + from + " or the parent of " + to + " does not exist");
+        return ret;
+    }
+    if (ret == -EEXIST) {
+        logger_.error("Rename Failed: Destination " + to + " already exists");
+        return ret;
+    }
+    if (ret == -EINVAL) {
+        logger_.error("Rename Failed: cannot move " + from + " to " + to);
+        return ret;
+    }
+    if (ret < 0) {
+        logger_.error("Rename Failed: " + to + " cannot replace or be replaced by " + from);
+        return ret;
+    }
+
+    if (replaced && (replaced->mode & S_IFMT) == S_IFREG) {
+        releaseData(to, replaced->ino);
+    }
+
+    maybeCheckpoint();
+    logger_.info("Renamed " + from + " to " + to);
+    return 0;
+}
+
+int StorageAccelerator::chmodFile(const std::string& path, mode_t mode) {
+    auto metadata = metadata_manager_->getMetadata(path);
+    if (!metadata) {
+        logger_.error("Chmod Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return chmodEntry(path, *metadata, mode);
+}
+
+int StorageAccelerator::chmodFile(uint64_t ino, mode_t mode) {
+    auto metadata = metadata_manager_->getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Chmod Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return chmodEntry(dataObject(ino), *metadata, mode);
+}
+
+int StorageAccelerator::chmodEntry(const std::string& path, FileMetadata& metadata, mode_t mode) {
+    metadata.mode = (metadata.mode & S_IFMT) | (mode & 07777);
+    metadata.ctime = time(nullptr);
+    persistAttributes(path, metadata);
+
+    logger_.info("Changed mode of " + path + " to " + std::to_string(mode));
+    return 0;
+}
+
+int StorageAccelerator::chownFile(const std::string& path, uid_t uid, gid_t gid) {
+    auto metadata = metadata_manager_->getMetadata(path);
+    if (!metadata) {
+        logger_.error("Chown Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return chownEntry(path, *metadata, uid, gid);
+}
+
+int StorageAccelerator::chownFile(uint64_t ino, uid_t uid, gid_t gid) {
+    auto metadata = metadata_manager_->getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Chown Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return chownEntry(dataObject(ino), *metadata, uid, gid);
+}
+
+int StorageAccelerator::chownEntry(const std::string& path, FileMetadata& metadata, uid_t uid, gid_t gid) {
+    metadata.uid = uid;
+    metadata.gid = gid;
+    metadata.ctime = time(nullptr);
+    persistAttributes(path, metadata);
+
+    logger_.info("Changed owner of " + path + " to UID: " + std::to_string(uid) + 
+                ", GID: " + std::to_string(gid));
+    return 0;
+}
+
+int StorageAccelerator::truncateFile(const std::string& path, off_t size) {
+    auto metadata = metadata_manager_->getMetadata(path);
+    if (!metadata) {
+        logger_.error("Truncate Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return truncateEntry(path, *metadata, size);
+}
+
+int StorageAccelerator::truncateFile(uint64_t ino, off_t size) {
+    auto metadata = metadata_manager_->getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Truncate Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return truncateEntry(dataObject(ino), *metadata, size);
+}
+
+int StorageAccelerator::truncateEntry(const std::string& path, FileMetadata& metadata, off_t size) {
+    if ((metadata.mode & S_IFMT) != S_IFREG) {
+        logger_.error("Truncate Failed: " + path + " is not a regular file");
+        return -EISDIR;
+    }
+    int inline_result;
+    if (truncateInline(path, metadata, size, inline_result)) {
+        return inline_result;
+    }
+
+    // Cached blocks past the new end are dropped, the rest is flushed so
+    // the drives hold everything the truncate has to cut
+    std::lock_guard<std::mutex> flush_lock(flushLockFor(metadata.ino));
+    cache_.invalidate(metadata.ino, (size + block_size_ - 1) / block_size_);
+    ssize_t result = flushLocked(metadata.ino);
+    if (result < 0) {
+        logger_.error("Truncate Failed: could not flush cached data of " + path);
+        return result;
+    }
+
+    // Every drive holding blocks of the file cuts its part in parallel
+    std::unique_lock<std::shared_mutex> migration_lock(migrationLockFor(metadata.ino));
+    result = fanOut(IOType::TRUNCATE, metadata.ino, size);
+    if (result < 0) {
+        logger_.error("Truncate Failed: drives could not truncate " + path);
+        return result;
+    }
+    // The block holding the new end now has a zeroed tail on the drives
+    cache_.invalidate(metadata.ino, size / block_size_);
+
+    block_map_.truncate(metadata.ino, size);
+    metadata.size = size;
+    metadata.mtime = time(nullptr);
+    metadata.ctime = metadata.mtime.load();
+    persistAttributes(path, metadata);
+
+    logger_.info("Truncated " + path + " to size " + std::to_string(size));
+    return 0;
+}
+
+int StorageAccelerator::utimensFile(const std::string& path, const struct timespec ts[2]) {
+    auto metadata = metadata_manager_->getMetadata(path);
+    if (!metadata) {
+        logger_.error("Utimens Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return utimensEntry(path, *metadata, ts);
+}
+
+int StorageAccelerator::utimensFile(uint64_t ino, const struct timespec ts[2]) {
+    auto metadata = metadata_manager_->getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Utimens Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return utimensEntry(dataObject(ino), *metadata, ts);
+}
+
+int StorageAccelerator::utimensEntry(const std::string& path, FileMetadata& metadata, const struct timespec ts[2]) {
+    metadata.atime = ts[0].tv_sec;
+    metadata.mtime = ts[1].tv_sec;
+    persistAttributes(path, metadata);
+
+    logger_.info("Updated timestamps of " + path);
+    return 0;
+}
+
+ssize_t StorageAccelerator::readFile(const std::string& path, char* buffer, size_t size, off_t offset,
+                                     ReadStream* stream) {
+    TRACE_SCOPE_ARG("accel", "read_file", size);
+    auto metadata = getMetadata(path);
+    if (!metadata) {
+        logger_.error("Read Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return readData(path, metadata, buffer, size, offset, stream);
+}
+
+ssize_t StorageAccelerator::readFile(uint64_t ino, char* buffer, size_t size, off_t offset,
+                                     ReadStream* stream) {
+    TRACE_SCOPE_ARG("accel", "read_file", size);
+    auto metadata = getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Read Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return readData(dataObject(ino), metadata, buffer, size, offset, stream);
+}
+
+ssize_t StorageAccelerator::readData(const std::string& path, const std::shared_ptr<FileMetadata>& metadata,
+                                     char* buffer, size_t size, off_t offset, ReadStream* stream) {
+    if (offset >= metadata->size) {
+        return 0;  // EOF
+    }
+
+    // Small files are answered from the metadata entry alone
+    auto start_time = std::chrono::steady_clock::now();
+    auto contents = std::atomic_load(&metadata->inline_data);
+    if (contents) {
+        size_t available = contents->size() > static_cast<size_t>(offset) ? contents->size() - offset : 0;
+        size_t copied = std::min(size, available);
+        memcpy(buffer, contents->data() + offset, copied);
+        read_stats_.record(copied, std::chrono::steady_clock::now() - start_time);
+        metadata->atime = time(nullptr);
+        return copied;
+    }
+
+    size_t to_read = std::min(size, static_cast<size_t>(metadata->size - offset));
+    ssize_t total_read = cache_.enabled()
+        ? readCached(path, metadata->ino, buffer, to_read, offset)
+        : transferBlocks(IOType::READ, path, metadata->ino, buffer, nullptr, to_read, offset);
+    read_stats_.record(total_read, std::chrono::steady_clock::now() - start_time);
+    if (total_read < 0) {
+        return total_read;
+    }
+    if (stream && cache_.enabled()) {
+        readahead(*stream, path, metadata->ino, offset, total_read, metadata->size);
+    }
+
+    // Update access time
+    metadata->atime = time(nullptr);
+
+    return total_read;
+}
+
+ssize_t StorageAccelerator::writeFile(const std::string& path, const char* buffer, size_t size, off_t offset) {
+    TRACE_SCOPE_ARG("accel", "write_file", size);
+    auto metadata = getMetadata(path);
+    if (!metadata) {
+        logger_.error("Write Failed: " + path + " does not exist");
+        return -ENOENT;
+    }
+    return writeData(path, metadata, buffer, size, offset);
+}
+
+ssize_t StorageAccelerator::writeFile(uint64_t ino, const char* buffer, size_t size, off_t offset) {
+    TRACE_SCOPE_ARG("accel", "write_file", size);
+    auto metadata = getMetadata(ino);
+    if (!metadata) {
+        logger_.error("Write Failed: inode " + std::to_string(ino) + " does not exist");
+        return -ENOENT;
+    }
+    return writeData(dataObject(ino), metadata, buffer, size, offset);
+}
+
+ssize_t StorageAccelerator::writeData(const std::string& path, const std::shared_ptr<FileMetadata>& metadata,
+                                      const char* buffer, size_t size, off_t offset) {
+    auto start_time = std::chrono::steady_clock::now();
+    ssize_t total_written;
+    if (writeInline(path, *metadata, buffer, size, offset, total_written)) {
+        write_stats_.record(total_written, std::chrono::steady_clock::now() - start_time);
+        return total_written;
+    }
+
+    // The caller's buffer is borrowed until every block completes, no copies
+    if (cache_.writeBack()) {
+        total_written = writeBack(path, metadata->ino, buffer, size, offset);
+    } else {
+        total_written = transferBlocks(IOType::WRITE, path, metadata->ino, nullptr, buffer,
+                                       size, offset);
+        if (total_written > 0 && cache_.enabled()) {
+            updateCache(metadata->ino, buffer, total_written, offset);
+        }
+    }
+    write_stats_.record(total_written, std::chrono::steady_clock::now() - start_time);
+    if (total_written < 0) {
+        return total_written;
+    }
+
+    // Update metadata. Only a new size or mtime second is worth a log record.
+    time_t now = time(nullptr);
+    bool changed = metadata->mtime != now || metadata->size < offset + total_written;
+    metadata->mtime = now;
+    metadata->extendSize(offset + total_written);
+    if (changed && metadata_manager_->persistent()) {
+        persistAttributes(path, *metadata);
+    }
+
+    return total_written;
+}
+
+std::mutex& StorageAccelerator::inlineLockFor(uint64_t file_id) {
+    return inline_locks_[file_id % NUM_INLINE_LOCKS];
+}
+
+bool StorageAccelerator::writeInline(const std::string& path, FileMetadata& metadata, const char* data,
+                                     size_t size, off_t offset, ssize_t& result) {
+    // A file never becomes inline again, so most files stop here unlocked
+    if (!std::atomic_load(&metadata.inline_data)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(inlineLockFor(metadata.ino));
+    auto contents = std::atomic_load(&metadata.inline_data);
+    if (!contents) {
+        return false;
+    }
+
+    size_t end = offset + size;
+    if (end > inline_limit_) {
+        result = spillInline(path, metadata, *contents);
+        return result < 0;
+    }
+
+    // Readers keep the copy they loaded, this one replaces it
+    auto updated = std::make_shared<std::string>(*contents);
+    if (updated->size() < end) {
+        updated->resize(end);
+    }
+    memcpy(&(*updated)[offset], data, size);
+    std::atomic_store(&metadata.inline_data, std::shared_ptr<const std::string>(std::move(updated)));
+    metadata.mtime = time(nullptr);
+    metadata.extendSize(end);
+    if (metadata_manager_->persistent()) {
+        persistAttributes(path, metadata);
+    }
+    result = size;
+    return true;
+}
+
+bool StorageAccelerator::truncateInline(const std::string& path, FileMetadata& metadata, off_t size,
+                                        int& result) {
+    if (!std::atomic_load(&metadata.inline_data)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(inlineLockFor(metadata.ino));
+    auto contents = std::atomic_load(&metadata.inline_data);
+    if (!contents) {
+        return false;
+    }
+
+    if (static_cast<size_t>(size) > inline_limit_) {
+        result = spillInline(path, metadata, *contents);
+        return result < 0;
+    }
+
+    auto updated = std::make_shared<std::string>(*contents);
+    updated->resize(size);
+    std::atomic_store(&metadata.inline_data, std::shared_ptr<const std::string>(std::move(updated)));
+    metadata.size = size;
+    metadata.mtime = time(nullptr);
+    metadata.ctime = metadata.mtime.load();
+    persistAttributes(path, metadata);
+
+    logger_.info("Truncated " + path + " to size " + std::to_string(size));
+    result = 0;
+    return true;
+}
+
+int StorageAccelerator::spillInline(const std::string& path, FileMetadata& metadata,
+                                    const std::string& contents) {
+    // Readers stay with the inline copy until the drives hold all of it
+    if (!contents.empty()) {
+        ssize_t written = transferBlocks(IOType::WRITE, path, metadata.ino, nullptr, contents.data(),
+                                         contents.size(), 0);
+        if (written != static_cast<ssize_t>(contents.size())) {
+            logger_.error("Write Failed: could not move the inline contents of " + path +
+                         " to the drives");
+            return written < 0 ? written : -EIO;
+        }
+    }
+    std::atomic_store(&metadata.inline_data, std::shared_ptr<const std::string>());
+    if (metadata_manager_->persistent()) {
+        persistAttributes(path, metadata);
+    }
+    inline_spills_.fetch_add(1, std::memory_order_relaxed);
+    LOG_DEBUG(logger_, "Moved the contents of " + path + " to the drives");
+    return 0;
+}
+
+ssize_t StorageAccelerator::readCached(const std::string& path, uint64_t file_id, char* buffer,
+                                       size_t size, off_t offset) {
+    std::vector<BlockTicket> misses;
+    for (size_t pos = 0; pos < size;) {
+        off_t at = offset + pos;
+        uint64_t block = at / block_size_;
+        size_t in_block = at % block_size_;
+        size_t len = std::min(size - pos, block_size_ - in_block);
+        if (!cache_.read(file_id, block, in_block, len, buffer + pos)) {
+            misses.push_back({block, cache_.ticket(file_id, block)});
+        }
+        pos += len;
+    }
+
+    // Each run of missing blocks is one transfer of whole blocks; those
+    // are cached and the requested bytes copied out
+    std::vector<char> fetched;
+    for (size_t i = 0; i < misses.size();) {
+        size_t j = i + 1;
+        while (j < misses.size() && misses[j].block == misses[j - 1].block + 1) {
+            j++;
+        }
+
+        ssize_t bytes = fetchRun(path, file_id, &misses[i], j - i, fetched);
+        if (bytes < 0) {
+            return bytes;
+        }
+
+        for (size_t k = i; k < j; k++) {
+            const char* data = fetched.data() + (k - i) * block_size_;
+            off_t block_start = misses[k].block * block_size_;
+            off_t from = std::max(block_start, offset);
+            off_t to = std::min(block_start + static_cast<off_t>(block_size_),
+                                offset + static_cast<off_t>(size));
+            memcpy(buffer + (from - offset), data + (from - block_start), to - from);
+        }
+        i = j;
+    }
+
+    return size;
+}
+
+ssize_t StorageAccelerator::fetchRun(const std::string& path, uint64_t file_id,
+                                     const BlockTicket* run, size_t count,
+                                     std::vector<char>& fetched) {
+    fetched.assign(count * block_size_, 0);
+    ssize_t bytes = transferBlocks(IOType::READ, path, file_id, fetched.data(), nullptr,
+                                   fetched.size(), run[0].block * block_size_);
+    if (bytes < 0) {
+        return bytes;
+    }
+
+    // Past a short read the zeroed buffer is the file's hole or EOF
+    for (size_t k = 0; k < count; k++) {
+        cache_.fill(file_id, run[k].block, run[k].ticket, fetched.data() + k * block_size_);
+    }
+    return bytes;
+}
+
+void StorageAccelerator::readahead(ReadStream& stream, const std::string& path, uint64_t file_id,
+                                   off_t offset, size_t bytes, off_t file_size) {
+    uint64_t end_block = (offset + bytes + block_size_ - 1) / block_size_;
+    uint64_t eof_block = (file_size + block_size_ - 1) / block_size_;
+    uint64_t first, last;
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        bool sequential = offset == stream.next_offset;
+        stream.next_offset = offset + bytes;
+        if (!sequential) {
+            stream.window = 0;
+            stream.ahead_end = 0;
+            return;
+        }
+
+        // Refill once the reader has used up half of what is ahead of it,
+        // so the next window is in flight before it is needed
+        stream.ahead_end = std::max(stream.ahead_end, end_block);
+        if (stream.window > 0 && stream.ahead_end - end_block >= stream.window / 2) {
+            return;
+        }
+        stream.window = stream.window == 0 ? READAHEAD_MIN_BLOCKS
+                                           : std::min(stream.window * 2, READAHEAD_MAX_BLOCKS);
+        first = stream.ahead_end;
+        last = std::min(end_block + stream.window, eof_block);
+        if (first >= last) {
+            return;
+        }
+        stream.ahead_end = last;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(readahead_mutex_);
+        readahead_pending_++;
+    }
+    pool_->enqueue([this, path, file_id, first, last]() {
+        prefetch(path, file_id, first, last);
+        std::lock_guard<std::mutex> lock(readahead_mutex_);
+        if (--readahead_pending_ == 0) {
+            readahead_cv_.notify_all();
+        }
+    });
+}
+
+void StorageAccelerator::prefetch(const std::string& path, uint64_t file_id, uint64_t first_block,
+                                  uint64_t end_block) {
+    TRACE_SCOPE_ARG("accel", "prefetch", end_block - first_block);
+    std::vector<BlockTicket> missing;
+    for (uint64_t block = first_block; block < end_block; block++) {
+        if (!cache_.cached(file_id, block)) {
+            missing.push_back({block, cache_.ticket(file_id, block)});
+        }
+    }
+
+    // One transfer per run, each spread over every drive holding the blocks
+    std::vector<char> fetched;
+    for (size_t i = 0; i < missing.size();) {
+        size_t j = i + 1;
+        while (j < missing.size() && missing[j].block == missing[j - 1].block + 1) {
+            j++;
+        }
+        if (fetchRun(path, file_id, &missing[i], j - i, fetched) < 0) {
+            LOG_DEBUG(logger_, "Readahead of " + path + " stopped at block " +
+                      std::to_string(missing[i].block));
+            return;
+        }
+        readahead_blocks_.fetch_add(j - i, std::memory_order_relaxed);
+        i = j;
+    }
+}
+
+void StorageAccelerator::waitForReadahead() {
+    std::unique_lock<std::mutex> lock(readahead_mutex_);
+    readahead_cv_.wait(lock, [this]() { return readahead_pending_ == 0; });
+}
+
+ssize_t StorageAccelerator::writeBack(const std::string& path, uint64_t file_id, const char* data,
+                                      size_t size, off_t offset) {
+    size_t pos = 0;
+    bool flushed = false;
+    while (pos < size) {
+        off_t at = offset + pos;
+        size_t in_block = at % block_size_;
+        size_t len = std::min(size - pos, block_size_ - in_block);
+        if (cache_.write(file_id, at / block_size_, in_block, len, data + pos)) {
+            pos += len;
+            continue;
+        }
+        // Dirty bytes in the way or no clean slot; a flush of this file
+        // clears the first and may free the second
+        if (flushed || flushFile(file_id) < 0) {
+            break;
+        }
+        flushed = true;
+    }
+    if (pos == size) {
+        return size;
+    }
+
+    // The cache is full of dirty blocks: write the rest through and get
+    // everything else flushed in the background
+    ssize_t written = transferBlocks(IOType::WRITE, path, file_id, nullptr, data + pos,
+                                     size - pos, offset + pos);
+    if (!flush_all_queued_.exchange(true)) {
+        pool_->enqueue([this]() {
+            flush_all_queued_ = false;
+            flushAll();
+        });
+    }
+    if (written < 0) {
+        return pos > 0 ? static_cast<ssize_t>(pos) : written;
+    }
+    updateCache(file_id, data + pos, written, offset + pos);
+    return pos + written;
+}
+
+void StorageAccelerator::updateCache(uint64_t file_id, const char* data, size_t size, off_t offset) {
+    for (size_t pos = 0; pos < size;) {
+        off_t at = offset + pos;
+        size_t in_block = at % block_size_;
+        size_t len = std::min(size - pos, block_size_ - in_block);
+        cache_.update(file_id, at / block_size_, in_block, len, data + pos);
+        pos += len;
+    }
+}
+
+int StorageAccelerator::flushFile(uint64_t ino) {
+    if (!cache_.writeBack()) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(flushLockFor(ino));
+    return flushLocked(ino);
+}
+
+void StorageAccelerator::releaseFile(uint64_t ino) {
+    auto unlinked = metadata_manager_->releaseHandle(ino);
+    if (unlinked) {
+        releaseUnlinked(unlinked);  // Unflushed data of an unlinked file is dropped
+        return;
+    }
+    if (cache_.writeBack()) {
+        pool_->enqueue([this, ino]() { flushFile(ino); });
+    }
+}
+
+int StorageAccelerator::syncFile(uint64_t ino) {
+    int ret = flushFile(ino);
+    if (ret < 0 || !persistent()) {
+        return ret;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        for (size_t drive : block_map_.drivesOf(ino)) {
+            if (drives_[drive] && (ret = drives_[drive]->sync()) < 0) {
+                logger_.error("Sync Failed: drive " + std::to_string(drive) + " could not write back");
+                return ret;
+            }
+        }
+    }
+    return metadata_manager_->sync();
+}
+
+int StorageAccelerator::flushAll() {
+    int result = 0;
+    for (uint64_t ino : cache_.dirtyFiles()) {
+        int ret = flushFile(ino);
+        if (ret < 0) {
+            result = ret;
+        }
+    }
+    return result;
+}
+
+int StorageAccelerator::flushLocked(uint64_t file_id) {
+    std::vector<BlockCache::DirtyRange> ranges = cache_.dirtyRanges(file_id);
+    std::string name = "inode " + std::to_string(file_id);
+    int result = 0;
+
+    // Ranges that meet at block boundaries go out as one transfer, so
+    // coalesced small writes reach the drives as full blocks in parallel
+    std::vector<char> run;
+    for (size_t i = 0; i < ranges.size();) {
+        size_t j = i + 1;
+        run = ranges[i].data;
+        while (j < ranges.size() && ranges[j].block == ranges[j - 1].block + 1 &&
+               ranges[j - 1].offset + ranges[j - 1].data.size() == block_size_ &&
+               ranges[j].offset == 0) {
+            run.insert(run.end(), ranges[j].data.begin(), ranges[j].data.end());
+            j++;
+        }
+
+        off_t start = ranges[i].block * block_size_ + ranges[i].offset;
+        ssize_t written = transferBlocks(IOType::WRITE, name, file_id, nullptr, run.data(),
+                                         run.size(), start);
+        if (written == static_cast<ssize_t>(run.size())) {
+            for (size_t k = i; k < j; k++) {
+                cache_.markClean(file_id, ranges[k]);
+            }
+        } else {
+            logger_.error("Flush Failed: could not write back " + std::to_string(run.size()) +
+                         " bytes of " + name);
+            result = written < 0 ? written : -EIO;
+        }
+        i = j;
+    }
+
+    return result;
+}
+
+ssize_t StorageAccelerator::transferBlocks(IOType type, const std::string& path, uint64_t file_id,
+                                          char* read_buffer, const char* write_data, size_t size,
+                                          off_t offset) {
+    // Bound each wave so large requests cannot overrun the drive queues
+    const size_t unit = dedup_options_.enabled ? block_size_ : stripeUnitOf(file_id);
+    const size_t wave_size = unit * num_drives_ * MAX_BLOCKS_PER_DRIVE_WAVE;
+    ssize_t total = 0;
+
+    while (static_cast<size_t>(total) < size) {
+        size_t chunk = std::min(wave_size, size - total);
+        ssize_t bytes = transferWave(type, path, file_id,
+                                     read_buffer ? read_buffer + total : nullptr,
+                                     write_data ? write_data + total : nullptr,
+                                     chunk, offset + total);
+        if (bytes < 0) {
+            return total > 0 && type == IOType::READ ? total : bytes;
+        }
+        total += bytes;
+        if (static_cast<size_t>(bytes) < chunk) {
+            break;  // Short read, nothing more to fetch
+        }
+    }
+
+    return total;
+}
+
+ssize_t StorageAccelerator::transferWave(IOType type, const std::string& path, uint64_t file_id,
+                                        char* read_buffer, const char* write_data, size_t size,
+                                        off_t offset) {
+    struct BlockIO {
+        size_t drive;
+        size_t pos;   // Offset within the caller's buffer
+        size_t size;
+    };
+
+    TRACE_SCOPE_ARG("accel", type == IOType::READ ? "read_wave" : "write_wave", size);
+    if (dedup_options_.enabled) {
+        return dedupWave(type, path, file_id, read_buffer, write_data, size, offset);
+    }
+
+    // Placement is fixed for the whole wave; a rebalance waits for it
+    std::shared_lock<std::shared_mutex> migration_lock(migrationLockFor(file_id));
+    auto ring = placementRing();
+    TRACE_NOW(placement_start);
+
+    std::vector<BlockIO> blocks;
+    std::vector<std::vector<IORequest>> per_drive(ring->drives().back() + 1);
+    const size_t unit = stripeUnitOf(file_id);
+    blocks.reserve(size / unit + 2);
+
+    // Placement hashes for every stripe unit of the wave in one pass
+    uint64_t first_block = offset / unit;
+    size_t num_blocks = size > 0 ? (offset + size - 1) / unit - first_block + 1 : 0;
+    std::vector<uint64_t> block_hashes(num_blocks);
+    hashing_module_->hashBlocks(hashing_module_->fileKey(file_id), first_block, num_blocks,
+                                block_hashes.data());
+    std::string object = dataObject(file_id);
+
+    // Build every request up front, one per stripe unit, aligned to unit
+    // boundaries so that reads and writes of the same byte always map to
+    // the same block key
+    size_t pos = 0;
+    while (pos < size) {
+        off_t block_offset = offset + pos;
+        off_t block_start = block_offset - (block_offset % unit);
+        size_t block_size = std::min(size - pos, unit - (block_offset - block_start));
+
+        // Only a block's first write is load balanced; after that it is
+        // pinned to the drive that holds it, for reads and overwrites alike
+        size_t primary_drive = ring->locate(block_hashes[block_start / unit - first_block]);
+        size_t selected_drive;
+        if (type == IOType::WRITE) {
+            selected_drive = block_map_.place(file_id, block_start,
+                                              load_balancer_->selectDrive(primary_drive, block_size,
+                                                                          ring->drives()));
+        } else {
+            selected_drive = block_map_.locate(file_id, block_start, primary_drive);
+        }
+        // A block may still sit on a leaving drive past the end of the ring
+        if (selected_drive >= per_drive.size()) {
+            per_drive.resize(selected_drive + 1);
+        }
+        load_balancer_->startOperation(selected_drive);
+
+        IORequest request;
+        request.type = type;
+        request.path = object;
+        request.buffer = read_buffer ? read_buffer + pos : nullptr;
+        request.data = write_data ? write_data + pos : nullptr;
+        request.size = block_size;
+        request.offset = block_offset;
+        request.user_data = blocks.size();
+        per_drive[selected_drive].push_back(std::move(request));
+
+        blocks.push_back({selected_drive, pos, block_size});
+        pos += block_size;
+    }
+
+    IOCompletionQueue completion;
+    completion.reserve(blocks.size());
+    auto start_time = std::chrono::steady_clock::now();
+    TRACE_SPAN("accel", "placement", placement_start, start_time, blocks.size());
+
+    for (size_t i = 0; i < per_drive.size(); i++) {
+        if (per_drive[i].empty()) {
+            continue;
+        }
+        for (auto& request : per_drive[i]) {
+            request.completion = &completion;
+        }
+        drives_[i]->enqueueBatch(per_drive[i]);
+    }
+
+    std::vector<IOCompletion> completions;
+    completions.reserve(blocks.size());
+    if (completion.reap(completions, blocks.size(), SSD_Simulator::IO_TIMEOUT) < blocks.size()) {
+        logger_.error(std::string(type == IOType::READ ? "Read" : "Write") +
+                     " operation timed out for " + path);
+        std::vector<size_t> drives;
+        drives.reserve(blocks.size());
+        for (const auto& block : blocks) {
+            drives.push_back(block.drive);
+        }
+        recordTimedOut(drives, completions, start_time);
+        return -ETIMEDOUT;
+    }
+    TRACE_NOW(reaped);
+    TRACE_SPAN("accel", "drive_wait", start_time, reaped, blocks.size());
+#if defined(FUSE_SSD_TRACING)
+    // Time the reaper took to run after the last of its blocks completed
+    auto last_completion = start_time;
+    for (const auto& done : completions) {
+        last_completion = std::max(last_completion, done.completed);
+    }
+    TRACE_SPAN("accel", "completion_wakeup", last_completion, reaped, 0);
+#endif
+
+    // Record per-block stats, each block's latency is measured to its own completion
+    std::vector<ssize_t> results(blocks.size());
+    for (const auto& done : completions) {
+        results[done.user_data] = done.result;
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(done.completed - start_time);
+        load_balancer_->recordOperation(blocks[done.user_data].drive,
+                                        done.result > 0 ? done.result : 0, duration);
+    }
+
+    ssize_t total = 0;
+    bool done = false;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        ssize_t bytes = results[i];
+        if (done) {
+            continue;
+        }
+
+        // Reads stay below the file size, so a block no drive holds, or one
+        // that ends early after a truncate and extend, is a hole of zeroes
+        if (type == IOType::READ &&
+            (bytes == -ENOENT || (bytes >= 0 && static_cast<size_t>(bytes) < blocks[i].size))) {
+            size_t filled = bytes > 0 ? bytes : 0;
+            memset(read_buffer + blocks[i].pos + filled, 0, blocks[i].size - filled);
+            bytes = blocks[i].size;
+        }
+
+        if (bytes < 0) {
+            logger_.error(std::string(type == IOType::READ ? "Read" : "Write") +
+                         " Failed: Error on " + path + " on drive " +
+                         std::to_string(blocks[i].drive));
+            if (type == IOType::WRITE || total == 0) {
+                total = bytes;
+            }
+            done = true;
+            continue;
+        }
+
+        total += bytes;
+        if (static_cast<size_t>(bytes) < blocks[i].size) {
+            done = true;  // Short read ends the contiguous range
+        }
+    }
+
+    return total;
+}
+
+bool StorageAccelerator::submitBatch(std::vector<DriveRequest>& requests, std::vector<ssize_t>& results) {
+    results.assign(requests.size(), 0);
+    if (requests.empty()) {
+        return true;
+    }
+
+    size_t last_drive = 0;
+    for (const auto& entry : requests) {
+        last_drive = std::max(last_drive, entry.drive);
+    }
+    std::vector<std::vector<IORequest>> per_drive(last_drive + 1);
+    IOCompletionQueue completion;
+    completion.reserve(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        requests[i].request.completion = &completion;
+        requests[i].request.user_data = i;
+        load_balancer_->startOperation(requests[i].drive);
+        per_drive[requests[i].drive].push_back(std::move(requests[i].request));
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < per_drive.size(); i++) {
+        if (!per_drive[i].empty()) {
+            drives_[i]->enqueueBatch(per_drive[i]);
+        }
+    }
+
+    std::vector<IOCompletion> completions;
+    completions.reserve(requests.size());
+    if (completion.reap(completions, requests.size(), SSD_Simulator::IO_TIMEOUT) < requests.size()) {
+        std::vector<size_t> drives;
+        drives.reserve(requests.size());
+        for (const auto& entry : requests) {
+            drives.push_back(entry.drive);
+        }
+        recordTimedOut(drives, completions, start_time);
+        return false;
+    }
+    for (const auto& done : completions) {
+        results[done.user_data] = done.result;
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(done.completed - start_time);
+        load_balancer_->recordOperation(requests[done.user_data].drive,
+                                        done.result > 0 ? done.result : 0, duration);
+    }
+    return true;
+}
+
+void StorageAccelerator::recordTimedOut(const std::vector<size_t>& drives,
+                                        const std::vector<IOCompletion>& completions,
+                                        std::chrono::steady_clock::time_point start_time) {
+    std::vector<bool> reaped(drives.size(), false);
+    for (const auto& done : completions) {
+        reaped[done.user_data] = true;
+        auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(done.completed - start_time);
+        load_balancer_->recordOperation(drives[done.user_data], done.result > 0 ? done.result : 0,
+                                        duration);
+    }
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    for (size_t i = 0; i < drives.size(); i++) {
+        if (!reaped[i]) {
+            load_balancer_->recordOperation(drives[i], 0, waited);
+        }
+    }
+}
+
+std::shared_mutex& StorageAccelerator::contentLockFor(const ContentKey& key) {
+    return content_locks_[key.fingerprint.high % NUM_CONTENT_LOCKS];
+}
+
+ssize_t StorageAccelerator::dedupWave(IOType type, const std::string& path, uint64_t file_id,
+                                      char* read_buffer, const char* write_data, size_t size,
+                                      off_t offset) {
+    // A partial block is read, merged and stored whole; concurrent writes
+    // to the same block must not interleave between the read and the store
+    bool partial = type == IOType::WRITE &&
+                   (offset % block_size_ != 0 || (offset + size) % block_size_ != 0);
+    if (partial) {
+        std::unique_lock<std::shared_mutex> migration_lock(migrationLockFor(file_id));
+        return dedupWrite(path, file_id, write_data, size, offset);
+    }
+
+    std::shared_lock<std::shared_mutex> migration_lock(migrationLockFor(file_id));
+    if (type == IOType::READ) {
+        return dedupRead(path, file_id, read_buffer, size, offset);
+    }
+    return dedupWrite(path, file_id, write_data, size, offset);
+}
+
+ssize_t StorageAccelerator::dedupRead(const std::string& path, uint64_t file_id, char* buffer,
+                                      size_t size, off_t offset) {
+    struct Span {
+        ContentKey key;
+        size_t pos;       // Offset within the caller's buffer
+        size_t size;
+        off_t in_block;
+    };
+
+    // Pin what every block points at; holes read as zeroes
+    std::vector<Span> spans;
+    std::vector<ContentKey> pins;
+    size_t pos = 0;
+    while (pos < size) {
+        off_t block_offset = offset + pos;
+        off_t block_start = block_offset - (block_offset % block_size_);
+        size_t block_size = std::min(size - pos, block_size_ - (block_offset - block_start));
+        DedupIndex::Stored stored;
+        if (dedup_index_.acquire(file_id, block_start / block_size_, stored)) {
+            spans.push_back({stored.key, pos, block_size, block_offset - block_start});
+            pins.push_back(stored.key);
+        } else {
+            memset(buffer + pos, 0, block_size);
+        }
+        pos += block_size;
+    }
+
+    // Stripes in address order, so two readers cannot deadlock behind a migration
+    std::vector<std::shared_mutex*> stripes;
+    for (const auto& span : spans) {
+        stripes.push_back(&contentLockFor(span.key));
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+    for (auto* stripe : stripes) {
+        stripe->lock_shared();
+    }
+
+    std::vector<DriveRequest> requests;
+    requests.reserve(spans.size());
+    for (const auto& span : spans) {
+        IORequest request;
+        request.type = IOType::READ;
+        request.path = DedupIndex::objectName(span.key);
+        request.buffer = buffer + span.pos;
+        request.size = span.size;
+        request.offset = span.in_block;
+        requests.push_back({dedup_index_.driveOf(span.key), std::move(request)});
+    }
+    std::vector<ssize_t> results;
+    bool completed = submitBatch(requests, results);
+
+    for (auto* stripe : stripes) {
+        stripe->unlock_shared();
+    }
+    releaseContent(pins);
+
+    if (!completed) {
+        logger_.error("Read operation timed out for " + path);
+        return -ETIMEDOUT;
+    }
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (results[i] < 0) {
+            logger_.error("Read Failed: Error on " + path + " on drive " +
+                         std::to_string(requests[i].drive));
+            return results[i];
+        }
+        size_t filled = results[i];
+        if (filled < spans[i].size) {
+            memset(buffer + spans[i].pos + filled, 0, spans[i].size - filled);
+        }
+    }
+    return size;
+}
+
+ssize_t StorageAccelerator::dedupWrite(const std::string& path, uint64_t file_id, const char* data,
+                                       size_t size, off_t offset) {
+    struct Block {
+        uint64_t index;
+        const char* data;
+        Fingerprint fingerprint;
+        ContentKey key;
+        bool matched = false;
+        size_t source = SIZE_MAX;  // Block of this wave whose write stores it
+    };
+
+    auto ring = placementRing();
+    uint64_t first_block = offset / block_size_;
+    size_t num_blocks = size > 0 ? (offset + size - 1) / block_size_ - first_block + 1 : 0;
+    std::vector<Block> blocks(num_blocks);
+    std::vector<std::vector<char>> merged;
+    std::vector<ContentKey> released;
+
+    // Whole blocks point into the caller's data, partial ones are merged
+    // into what the block held before
+    size_t pos = 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        off_t block_start = (first_block + i) * block_size_;
+        size_t in_block = offset + pos - block_start;
+        size_t chunk = std::min(size - pos, block_size_ - in_block);
+        blocks[i].index = first_block + i;
+        if (chunk == block_size_) {
+            blocks[i].data = data + pos;
+        } else {
+            merged.emplace_back(block_size_);
+            char* scratch = merged.back().data();
+            ssize_t bytes = dedupRead(path, file_id, scratch, block_size_, block_start);
+            if (bytes < 0) {
+                return bytes;
+            }
+            memcpy(scratch + in_block, data + pos, chunk);
+            blocks[i].data = scratch;
+        }
+        pos += chunk;
+    }
+
+    // Zero blocks become holes; the rest look for a stored block to share
+    std::vector<std::vector<DedupIndex::Stored>> candidates(num_blocks);
+    size_t num_candidates = 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        const char* block = blocks[i].data;
+        if (block[0] == 0 && memcmp(block, block + 1, block_size_ - 1) == 0) {
+            ContentKey previous;
+            if (dedup_index_.clear(file_id, blocks[i].index, previous)) {
+                released.push_back(previous);
+            }
+            blocks[i].data = nullptr;
+            continue;
+        }
+        blocks[i].fingerprint = DedupIndex::fingerprint(block, block_size_);
+        candidates[i] = dedup_index_.candidates(blocks[i].fingerprint);
+        num_candidates += candidates[i].size();
+    }
+
+    // Fetch every candidate in one batch and compare bytes
+    std::vector<char> verify_buffer;
+    std::vector<ssize_t> verify_results;
+    if (dedup_options_.verify && num_candidates > 0) {
+        verify_buffer.resize(num_candidates * block_size_);
+        std::vector<std::shared_mutex*> stripes;
+        for (const auto& found : candidates) {
+            for (const auto& candidate : found) {
+                stripes.push_back(&contentLockFor(candidate.key));
+            }
+        }
+        std::sort(stripes.begin(), stripes.end());
+        stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+        for (auto* stripe : stripes) {
+            stripe->lock_shared();
+        }
+
+        std::vector<DriveRequest> requests;
+        requests.reserve(num_candidates);
+        for (const auto& found : candidates) {
+            for (const auto& candidate : found) {
+                IORequest request;
+                request.type = IOType::READ;
+                request.path = DedupIndex::objectName(candidate.key);
+                request.buffer = verify_buffer.data() + requests.size() * block_size_;
+                request.size = block_size_;
+                requests.push_back({dedup_index_.driveOf(candidate.key), std::move(request)});
+            }
+        }
+        bool completed = submitBatch(requests, verify_results);
+
+        for (auto* stripe : stripes) {
+            stripe->unlock_shared();
+        }
+        if (!completed) {
+            // Nothing verified, so nothing is shared
+            verify_results.assign(num_candidates, -ETIMEDOUT);
+        }
+    }
+
+    // Keep the first match of each block, drop the other pins
+    size_t candidate_index = 0;
+    for (size_t i = 0; i < num_blocks; i++) {
+        for (const auto& candidate : candidates[i]) {
+            size_t slot = candidate_index++;
+            bool same = !dedup_options_.verify ||
+                        (verify_results[slot] == static_cast<ssize_t>(block_size_) &&
+                         memcmp(verify_buffer.data() + slot * block_size_, blocks[i].data,
+                                block_size_) == 0);
+            if (same && !blocks[i].matched) {
+                blocks[i].key = candidate.key;
+                blocks[i].matched = true;
+                continue;
+            }
+            if (!same && verify_results[slot] >= 0) {
+                dedup_collisions_.fetch_add(1, std::memory_order_relaxed);
+            }
+            released.push_back(candidate.key);
+        }
+    }
+
+    // Store what nothing matched, once per distinct block of the wave
+    std::unordered_map<uint64_t, size_t> created_by_hash;
+    std::vector<DriveRequest> requests;
+    std::vector<size_t> written;
+    for (size_t i = 0; i < num_blocks; i++) {
+        Block& block = blocks[i];
+        if (!block.data || block.matched) {
+            continue;
+        }
+        auto earlier = created_by_hash.find(block.fingerprint.low);
+        if (earlier != created_by_hash.end()) {
+            const Block& first = blocks[earlier->second];
+            size_t drive;
+            if (first.fingerprint == block.fingerprint &&
+                memcmp(first.data, block.data, block_size_) == 0 &&
+                dedup_index_.pin(first.key, drive)) {
+                block.key = first.key;
+                block.matched = true;
+                block.source = earlier->second;
+                continue;
+            }
+        }
+
+        size_t drive = load_balancer_->selectDrive(ring->locate(block.fingerprint.low), block_size_,
+                                                   ring->drives());
+        block.key = dedup_index_.create(block.fingerprint, drive);
+        block.source = i;
+        created_by_hash.emplace(block.fingerprint.low, i);
+
+        IORequest request;
+        request.type = IOType::WRITE;
+        request.path = DedupIndex::objectName(block.key);
+        request.data = block.data;
+        request.size = block_size_;
+        requests.push_back({drive, std::move(request)});
+        written.push_back(i);
+    }
+
+    std::vector<ssize_t> results;
+    ssize_t failure = 0;
+    if (!submitBatch(requests, results)) {
+        logger_.error("Write operation timed out for " + path);
+        failure = -ETIMEDOUT;
+    }
+    std::vector<bool> stored(num_blocks, true);
+    for (size_t j = 0; j < written.size(); j++) {
+        ssize_t bytes = failure < 0 ? failure : results[j];
+        if (bytes == static_cast<ssize_t>(block_size_)) {
+            dedup_index_.publish(blocks[written[j]].key);
+            continue;
+        }
+        if (failure == 0) {
+            logger_.error("Write Failed: Error on " + path + " on drive " +
+                         std::to_string(requests[j].drive));
+            failure = bytes < 0 ? bytes : -EIO;
+        }
+        stored[written[j]] = false;
+    }
+
+    // Point the file at its blocks; a duplicate of a failed write fails with it
+    for (size_t i = 0; i < num_blocks; i++) {
+        Block& block = blocks[i];
+        if (!block.data) {
+            continue;
+        }
+        if (block.source != SIZE_MAX && !stored[block.source]) {
+            released.push_back(block.key);
+            continue;
+        }
+        if (block.source != i) {
+            dedup_hits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        ContentKey previous;
+        if (dedup_index_.assign(file_id, block.index, block.key, previous)) {
+            released.push_back(previous);
+        }
+    }
+
+    releaseContent(released);
+    return failure < 0 ? failure : static_cast<ssize_t>(size);
+}
+
+ssize_t StorageAccelerator::dedupFanOut(IOType type, uint64_t file_id, off_t size) {
+    if (type == IOType::DELETE) {
+        releaseContent(dedup_index_.erase(file_id));
+        return 0;
+    }
+
+    releaseContent(dedup_index_.truncate(file_id, (size + block_size_ - 1) / block_size_));
+    size_t tail = size % block_size_;
+    if (tail == 0) {
+        return 0;
+    }
+
+    // The block holding the new end keeps zeroes past it, as a drive's truncate does
+    std::string label = dataObject(file_id);
+    std::vector<char> block(block_size_);
+    ssize_t result = dedupRead(label, file_id, block.data(), block_size_, size - tail);
+    if (result < 0) {
+        return result;
+    }
+    memset(block.data() + tail, 0, block_size_ - tail);
+    result = dedupWrite(label, file_id, block.data(), block_size_, size - tail);
+    return result < 0 ? result : 0;
+}
+
+void StorageAccelerator::releaseContent(const std::vector<ContentKey>& keys) {
+    std::vector<DriveRequest> deletes;
+    for (const auto& key : keys) {
+        size_t drive;
+        if (dedup_index_.release(key, drive)) {
+            IORequest request;
+            request.type = IOType::DELETE;
+            request.path = DedupIndex::objectName(key);
+            deletes.push_back({drive, std::move(request)});
+        }
+    }
+
+    std::vector<ssize_t> results;
+    if (!submitBatch(deletes, results)) {
+        logger_.error("Dedup: timed out deleting " + std::to_string(deletes.size()) +
+                     " unreferenced blocks");
+        return;
+    }
+    // A block whose write failed never reached its drive
+    for (size_t i = 0; i < deletes.size(); i++) {
+        if (results[i] < 0 && results[i] != -ENOENT) {
+            logger_.error("Dedup: failed to delete an unreferenced block on drive " +
+                         std::to_string(deletes[i].drive));
+        }
+    }
+}
+
+void StorageAccelerator::migrateContent(const DedupIndex::Stored& stored, size_t to) {
+    size_t drive;
+    // Freed since the snapshot
+    if (!dedup_index_.pin(stored.key, drive)) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(contentLockFor(stored.key));
+        std::string object = DedupIndex::objectName(stored.key);
+        std::vector<char> buffer(block_size_);
+        const ssize_t block_size = block_size_;
+        // A later job may have moved it already
+        if (dedup_index_.driveOf(stored.key) != stored.drive) {
+            lock.unlock();
+        } else if (drives_[stored.drive]->readFile(object, buffer.data(), block_size_, 0) != block_size ||
+                   drives_[to]->writeFile(object, buffer.data(), block_size_, 0) != block_size) {
+            logger_.error("Rebalance: failed to move stored block " + object + " to drive " +
+                         std::to_string(to));
+        } else {
+            dedup_index_.relocate(stored.key, stored.drive, to);
+            IORequest request;
+            request.type = IOType::DELETE;
+            request.path = object;
+            ssize_t result = drives_[stored.drive]->submitAndWait(std::move(request));
+            if (result < 0 && result != -ENOENT) {
+                logger_.error("Rebalance: failed to delete stored block " + object + " on drive " +
+                             std::to_string(stored.drive));
+            }
+        }
+    }
+    releaseContent({stored.key});
+}
@@ -0,0 +1,129 @@
+#include "utils/cpu_topology.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+int pin(pthread_t thread, const std::vector<int>& cpus) {
+    if (cpus.empty()) {
+        return 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return -pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+}  // namespace
+
+CpuTopology::CpuTopology(std::vector<std::vector<int>> nodes) : nodes_(std::move(nodes)) {
+    if (nodes_.empty()) {
+        nodes_.emplace_back();
+    }
+}
+
+CpuTopology CpuTopology::detect() {
+    std::vector<int> allowed = allowedCpus();
+    std::vector<bool> is_allowed;
+    for (int cpu : allowed) {
+        if (static_cast<size_t>(cpu) >= is_allowed.size()) {
+            is_allowed.resize(cpu + 1);
+        }
+        is_allowed[cpu] = true;
+    }
+
+    // Node ids may have gaps, so probe until several in a row are missing
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0, missing = 0; missing < 8; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list)) {
+            missing++;
+            continue;
+        }
+        missing = 0;
+
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(list)) {
+            if (static_cast<size_t>(cpu) < is_allowed.size() && is_allowed[cpu]) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+
+    if (nodes.empty()) {
+        nodes.push_back(std::move(allowed));
+    }
+    return CpuTopology(std::move(nodes));
+}
+
+std::vector<std::vector<int>> CpuTopology::spread(size_t workers) const {
+    std::vector<std::vector<int>> sets;
+    for (size_t i = 0; i < workers; i++) {
+        sets.push_back(nodes_[i % nodes_.size()]);
+    }
+    return sets;
+}
+
+std::vector<int> CpuTopology::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    const char* at = list.c_str();
+    while (*at != '\0' && *at != '\n') {
+        char* end = nullptr;
+        long first = strtol(at, &end, 10);
+        if (end == at || first < 0) {
+            return {};
+        }
+        long last = first;
+        at = end;
+        if (*at == '-') {
+            last = strtol(at + 1, &end, 10);
+            if (end == at + 1 || last < first) {
+                return {};
+            }
+            at = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        if (*at == ',') {
+            at++;
+        } else if (*at != '\0' && *at != '\n') {
+            return {};
+        }
+    }
+    return cpus;
+}
+
+int pinThread(std::thread& thread, const std::vector<int>& cpus) {
+    return pin(thread.native_handle(), cpus);
+}
+
+int pinCurrentThread(const std::vector<int>& cpus) {
+    return pin(pthread_self(), cpus);
+}
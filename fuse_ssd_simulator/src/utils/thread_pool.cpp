@@ -1,37 +1,122 @@
 #include "utils/thread_pool.h"
+#include "utils/cpu_topology.h"
+#include <algorithm>
+#include <stdexcept>
 
-ThreadPool::ThreadPool(size_t threads)
+namespace {
+
+// Which pool and worker the calling thread is, if any
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads, const std::vector<std::vector<int>>& worker_cpus)
     : stop_(false) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    // Queues exist before any worker looks at another's
     for (size_t i = 0; i < threads; ++i) {
-        workers_.emplace_back(
-            [this] {
-                while (true) {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex_);
-                        this->condition_.wait(lock,
-                            [this]{ return this->stop_ || !this->tasks_.empty(); });
-                        if (this->stop_ && this->tasks_.empty()) {
-                            return;
-                        }
-                        task = std::move(this->tasks_.front());
-                        this->tasks_.pop();
-                    }
-
-                    task();
-                }
-            }
-        );
+        std::vector<int> cpus = worker_cpus.empty() ? std::vector<int>()
+                                                    : worker_cpus[i % worker_cpus.size()];
+        workers_[i]->thread = std::thread([this, i, cpus] {
+            pinCurrentThread(cpus);
+            current_pool = this;
+            current_worker = i;
+            workerLoop(i);
+        });
     }
 }
 
 ThreadPool::~ThreadPool() {
-    stop_ = true;
+    {
+        // Under the lock, or a worker between its check and its wait misses the wakeup
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
     condition_.notify_all();
-    for (std::thread &worker: workers_) {
-        if (worker.joinable()) {
-            worker.join();
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    // A submission that raced with the stop flag landed after the workers left
+    for (auto& worker : workers_) {
+        for (auto& task : worker->tasks) {
+            task();
+        }
+    }
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    // Don't allow enqueueing after stopping the pool
+    if (stop_) {
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    size_t target = current_pool == this
+                        ? current_worker
+                        : next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+        Worker& worker = *workers_[target];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    // A sleeper counts itself before it checks pending_, so one of the two
+    // sides always sees the other
+    pending_.fetch_add(1);
+    if (sleepers_.load() > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+        }
+        condition_.notify_one();
+    }
+}
+
+bool ThreadPool::take(size_t self, std::function<void()>& task) {
+    {
+        Worker& own = *workers_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            pending_.fetch_sub(1);
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < workers_.size(); i++) {
+        Worker& victim = *workers_[(self + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            pending_.fetch_sub(1);
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t self) {
+    while (true) {
+        std::function<void()> task;
+        if (take(self, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleepers_.fetch_add(1);
+        condition_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+        sleepers_.fetch_sub(1);
+        if (stop_ && pending_.load() == 0) {
+            return;
         }
     }
 }
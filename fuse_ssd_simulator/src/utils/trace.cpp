@@ -0,0 +1,114 @@
+#include "utils/trace.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+struct TraceEvent {
+    const char* category;
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    uint64_t arg;
+};
+
+// Written only by its thread. size is published after each event, so a
+// concurrent dump reads complete events only.
+struct ThreadTrace {
+    explicit ThreadTrace(size_t id) : tid(id), events(new TraceEvent[Tracer::EVENTS_PER_THREAD]) {}
+
+    size_t tid;
+    std::unique_ptr<TraceEvent[]> events;
+    std::atomic<size_t> size{0};
+    std::atomic<size_t> dropped{0};
+};
+
+// Buffers outlive their threads so that spans of exited threads still dump
+std::mutex registry_mutex;
+std::vector<ThreadTrace*>& registry() {
+    static auto* traces = new std::vector<ThreadTrace*>();
+    return *traces;
+}
+
+ThreadTrace& localTrace() {
+    thread_local ThreadTrace* trace = nullptr;
+    if (!trace) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        trace = new ThreadTrace(registry().size() + 1);
+        registry().push_back(trace);
+    }
+    return *trace;
+}
+
+int64_t toNanoseconds(Tracer::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+}  // namespace
+
+void Tracer::record(const char* category, const char* name,
+                    Clock::time_point start, Clock::time_point end, uint64_t arg) {
+    ThreadTrace& trace = localTrace();
+    size_t index = trace.size.load(std::memory_order_relaxed);
+    if (index >= EVENTS_PER_THREAD) {
+        trace.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    trace.events[index] = {category, name, toNanoseconds(start), toNanoseconds(end) - toNanoseconds(start), arg};
+    trace.size.store(index + 1, std::memory_order_release);
+}
+
+bool Tracer::dump(const std::string& path) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        return false;
+    }
+
+    std::vector<ThreadTrace*> traces;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        traces = registry();
+    }
+
+    int pid = getpid();
+    bool first = true;
+    fprintf(out, "{\"traceEvents\":[");
+    for (const auto* trace : traces) {
+        size_t size = trace->size.load(std::memory_order_acquire);
+        for (size_t i = 0; i < size; i++) {
+            const TraceEvent& event = trace->events[i];
+            // Chrome trace timestamps are microseconds
+            fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                         "\"pid\":%d,\"tid\":%zu,\"args\":{\"arg\":%llu}}",
+                    first ? "" : ",", event.name, event.category, event.start_ns / 1e3,
+                    event.duration_ns / 1e3, pid, trace->tid,
+                    static_cast<unsigned long long>(event.arg));
+            first = false;
+        }
+    }
+    fprintf(out, "\n],\"otherData\":{\"dropped\":%zu}}\n", dropped());
+
+    return fclose(out) == 0;
+}
+
+size_t Tracer::recorded() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    size_t total = 0;
+    for (const auto* trace : registry()) {
+        total += trace->size.load(std::memory_order_acquire);
+    }
+    return total;
+}
+
+size_t Tracer::dropped() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    size_t total = 0;
+    for (const auto* trace : registry()) {
+        total += trace->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include "storage_accelerator/block_cache.h"
+#include <vector>
+#include <string>
+
+static const size_t BLOCK = 4096;
+
+TEST(BlockCacheTest, FillThenHitAndWriteThroughUpdates) {
+    BlockCache cache(BLOCK, BlockCacheOptions());
+    char out[16];
+    EXPECT_FALSE(cache.read(1, 0, 0, sizeof(out), out));
+
+    std::vector<char> block(BLOCK, 'a');
+    cache.fill(1, 0, cache.ticket(1, 0), block.data());
+    ASSERT_TRUE(cache.read(1, 0, 100, sizeof(out), out));
+    EXPECT_EQ(out[0], 'a');
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 1u);
+
+    cache.update(1, 0, 100, 4, "bbbb");
+    ASSERT_TRUE(cache.read(1, 0, 100, sizeof(out), out));
+    EXPECT_EQ(std::string(out, 5), "bbbba");
+    EXPECT_EQ(cache.dirtyBlocks(), 0u);
+}
+
+TEST(BlockCacheTest, FillRacingAWriteIsNotCached) {
+    BlockCache cache(BLOCK, BlockCacheOptions());
+    std::vector<char> stale(BLOCK, 's');
+
+    // A partial write lands between the drive read and the fill
+    uint64_t ticket = cache.ticket(1, 3);
+    cache.update(1, 3, 0, 4, "new!");
+    cache.fill(1, 3, ticket, stale.data());
+
+    char out[4];
+    EXPECT_FALSE(cache.read(1, 3, 0, sizeof(out), out));
+}
+
+TEST(BlockCacheTest, InvalidateDropsOnlyTheFilesBlocks) {
+    BlockCache cache(BLOCK, BlockCacheOptions());
+    std::vector<char> block(BLOCK, 'c');
+    for (uint64_t b = 0; b < 8; b++) {
+        cache.fill(1, b, cache.ticket(1, b), block.data());
+        cache.fill(2, b, cache.ticket(2, b), block.data());
+    }
+
+    // Tickets taken before a truncate of file 1
+    uint64_t pending_one = cache.ticket(1, 20);
+    uint64_t pending_two = cache.ticket(2, 20);
+    cache.invalidate(1, 4);
+    for (uint64_t b = 0; b < 8; b++) {
+        EXPECT_EQ(cache.cached(1, b), b < 4) << b;
+        EXPECT_TRUE(cache.cached(2, b)) << b;
+    }
+
+    // The truncated file's fill is stale, the other file's is not
+    cache.fill(1, 20, pending_one, block.data());
+    cache.fill(2, 20, pending_two, block.data());
+    EXPECT_FALSE(cache.cached(1, 20));
+    EXPECT_TRUE(cache.cached(2, 20));
+
+    cache.invalidate(1);
+    for (uint64_t b = 0; b < 4; b++) {
+        EXPECT_FALSE(cache.cached(1, b)) << b;
+    }
+}
+
+TEST(BlockCacheTest, WriteBackCoalescesAdjacentWrites) {
+    BlockCacheOptions options;
+    options.write_back = true;
+    BlockCache cache(BLOCK, options);
+
+    // Small appends build one dirty range per block
+    std::string text = "0123456789";
+    for (size_t pos = 0; pos < BLOCK + 10; pos += text.size()) {
+        size_t in_block = pos % BLOCK;
+        size_t len = std::min(text.size(), BLOCK - in_block);
+        ASSERT_TRUE(cache.write(7, pos / BLOCK, in_block, len, text.data()));
+        if (len < text.size()) {
+            ASSERT_TRUE(cache.write(7, pos / BLOCK + 1, 0, text.size() - len, text.data() + len));
+        }
+    }
+    EXPECT_EQ(cache.dirtyBlocks(), 2u);
+    EXPECT_EQ(cache.dirtyFiles(), std::vector<uint64_t>{7});
+
+    auto ranges = cache.dirtyRanges(7);
+    ASSERT_EQ(ranges.size(), 2u);
+    EXPECT_EQ(ranges[0].offset, 0u);
+    EXPECT_EQ(ranges[0].data.size(), BLOCK);
+    EXPECT_EQ(ranges[1].block, 1u);
+    EXPECT_EQ(ranges[1].data.size(), 14u);
+
+    // Known bytes hit, the unwritten rest of block 1 misses
+    char out[4];
+    EXPECT_TRUE(cache.read(7, 1, 0, sizeof(out), out));
+    EXPECT_FALSE(cache.read(7, 1, 100, sizeof(out), out));
+
+    // A write during the flush keeps its block dirty
+    ASSERT_TRUE(cache.write(7, 1, 14, 2, "xy"));
+    cache.markClean(7, ranges[0]);
+    cache.markClean(7, ranges[1]);
+    EXPECT_EQ(cache.dirtyBlocks(), 1u);
+    ASSERT_EQ(cache.dirtyRanges(7).size(), 1u);
+    EXPECT_EQ(cache.dirtyRanges(7)[0].data.size(), 16u);
+
+    // A write leaving a gap to dirty bytes is refused
+    EXPECT_FALSE(cache.write(7, 1, 1000, 2, "zz"));
+    cache.invalidate(7);
+    EXPECT_EQ(cache.dirtyBlocks(), 0u);
+    EXPECT_TRUE(cache.dirtyFiles().empty());
+}
+
+TEST(BlockCacheTest, ClockEvictsOnlyCleanBlocks) {
+    BlockCacheOptions options;
+    options.capacity = BlockCache::NUM_SHARDS * BLOCK;  // One slot per shard
+    options.write_back = true;
+    BlockCache cache(BLOCK, options);
+    EXPECT_EQ(cache.capacityBlocks(), BlockCache::NUM_SHARDS);
+
+    ASSERT_TRUE(cache.write(1, 0, 0, 4, "keep"));
+    std::vector<char> block(BLOCK, 'c');
+    for (uint64_t b = 0; b < 1000; b++) {
+        cache.fill(2, b, cache.ticket(2, b), block.data());
+    }
+    EXPECT_GT(cache.evictions(), 0u);
+
+    char out[4];
+    ASSERT_TRUE(cache.read(1, 0, 0, sizeof(out), out));
+    EXPECT_EQ(std::string(out, 4), "keep");
+}
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include "storage_accelerator/block_map.h"
+#include <thread>
+#include <vector>
+#include <atomic>
+
+TEST(BlockMapTest, FirstWritePinsTheBlock) {
+    BlockMap map;
+    EXPECT_EQ(map.locate(1, 0, 3), 3u);
+
+    // A redirected first write is found again on read
+    EXPECT_EQ(map.place(1, 0, 7), 7u);
+    EXPECT_EQ(map.locate(1, 0, 3), 7u);
+
+    // Overwrites stay put even if the balancer now prefers another drive
+    EXPECT_EQ(map.place(1, 0, 3), 7u);
+    EXPECT_EQ(map.place(1, 4096, 3), 3u);
+    EXPECT_EQ(map.blockCount(1), 2u);
+    EXPECT_EQ(map.drivesOf(1), (std::vector<size_t>{3, 7}));
+    EXPECT_EQ(map.locate(2, 0, 5), 5u);
+    EXPECT_TRUE(map.drivesOf(2).empty());
+}
+
+TEST(BlockMapTest, TruncateAndEraseForgetBlocks) {
+    BlockMap map;
+    for (off_t block = 0; block < 4; block++) {
+        map.place(1, block * 4096, 9);
+    }
+
+    // The block holding the new end keeps its place
+    map.truncate(1, 4096 + 100);
+    EXPECT_EQ(map.blockCount(1), 2u);
+    EXPECT_EQ(map.locate(1, 4096, 1), 9u);
+    EXPECT_EQ(map.locate(1, 8192, 1), 1u);
+
+    map.truncate(1, 4096);
+    EXPECT_EQ(map.blockCount(1), 1u);
+
+    map.erase(1);
+    EXPECT_EQ(map.blockCount(1), 0u);
+    EXPECT_EQ(map.locate(1, 0, 1), 1u);
+}
+
+TEST(BlockMapTest, ConcurrentFirstWritesAgree) {
+    BlockMap map;
+    std::vector<std::thread> threads;
+    std::vector<size_t> placed(8);
+    for (size_t t = 0; t < placed.size(); t++) {
+        threads.emplace_back([&, t]() { placed[t] = map.place(1, 0, t); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t drive : placed) {
+        EXPECT_EQ(drive, placed[0]);
+    }
+    EXPECT_EQ(map.locate(1, 0, 99), placed[0]);
+}
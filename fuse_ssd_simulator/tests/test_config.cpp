@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include "config/config.h"
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+TEST(ConfigTest, ParsesSizes) {
+    uint64_t size = 0;
+    ASSERT_TRUE(parseSize("4096", size));
+    EXPECT_EQ(size, 4096u);
+    ASSERT_TRUE(parseSize("64K", size));
+    EXPECT_EQ(size, 64u * 1024);
+    ASSERT_TRUE(parseSize("1m", size));
+    EXPECT_EQ(size, 1024u * 1024);
+    ASSERT_TRUE(parseSize("2G", size));
+    EXPECT_EQ(size, 2ULL << 30);
+    EXPECT_FALSE(parseSize("", size));
+    EXPECT_FALSE(parseSize("K", size));
+    EXPECT_FALSE(parseSize("-1", size));
+    EXPECT_FALSE(parseSize("12KB", size));
+    EXPECT_FALSE(parseSize("99999999999999999999", size));
+}
+
+TEST(ConfigTest, AppliesOptionsInOrder) {
+    AcceleratorConfig config;
+    std::string error;
+    EXPECT_EQ(applyConfigOption(config, "drives", "8", error), 0);
+    EXPECT_EQ(applyConfigOption(config, "latency_profile", "nvme", error), 0);
+    EXPECT_EQ(applyConfigOption(config, "read_latency_us", "50", error), 0);
+    EXPECT_EQ(applyConfigOption(config, "write_back", "", error), 0);
+    EXPECT_EQ(applyConfigOption(config, "load_balancing", "off", error), 0);
+    EXPECT_EQ(config.num_drives, 8);
+    EXPECT_EQ(config.drives.latency.read.base, std::chrono::microseconds(50));
+    EXPECT_EQ(config.drives.latency.write.base, LatencyProfile::nvme().write.base);
+    EXPECT_TRUE(config.cache.write_back);
+    EXPECT_FALSE(config.load_balancer.enabled);
+
+    EXPECT_EQ(applyConfigOption(config, "drives", "0", error), -EINVAL);
+    EXPECT_NE(error.find("drives"), std::string::npos);
+    EXPECT_EQ(applyConfigOption(config, "block_size", "0", error), -EINVAL);
+    EXPECT_EQ(applyConfigOption(config, "block_size", "3000", error), -EINVAL);
+    EXPECT_EQ(applyConfigOption(config, "block_size", "2M", error), -EINVAL);
+    EXPECT_EQ(applyConfigOption(config, "stripe_unit", "1G", error), -EINVAL);
+    EXPECT_EQ(config.drives.block_size, SSD_Simulator::DEFAULT_BLOCK_SIZE);
+    EXPECT_EQ(applyConfigOption(config, "latency_profile", "fast", error), -EINVAL);
+    EXPECT_EQ(applyConfigOption(config, "dedup", "maybe", error), -EINVAL);
+    EXPECT_EQ(applyConfigOption(config, "allow_other", "", error), -ENOENT);
+    EXPECT_EQ(config.num_drives, 8);
+}
+
+TEST(ConfigTest, AppliesFuseCacheOptions) {
+    FuseCacheOptions options;
+    std::string error;
+    EXPECT_EQ(applyFuseOption(options, "attr_timeout", "5", error), 0);
+    EXPECT_EQ(applyFuseOption(options, "negative_timeout", "0", error), 0);
+    EXPECT_EQ(applyFuseOption(options, "keep_cache", "off", error), 0);
+    EXPECT_EQ(applyFuseOption(options, "writeback_cache", "", error), 0);
+    EXPECT_EQ(applyFuseOption(options, "max_write", "128K", error), 0);
+    EXPECT_EQ(applyFuseOption(options, "max_background", "256", error), 0);
+    EXPECT_DOUBLE_EQ(options.attr_timeout, 5.0);
+    EXPECT_DOUBLE_EQ(options.negative_timeout, 0.0);
+    EXPECT_FALSE(options.keep_cache);
+    EXPECT_TRUE(options.writeback_cache);
+    EXPECT_EQ(options.max_write, 128u * 1024);
+    EXPECT_EQ(options.max_background, 256u);
+
+    EXPECT_EQ(applyFuseOption(options, "entry_timeout", "-1", error), -EINVAL);
+    EXPECT_EQ(applyFuseOption(options, "max_read", "8G", error), -EINVAL);
+    EXPECT_EQ(applyFuseOption(options, "drives", "4", error), -ENOENT);
+    EXPECT_DOUBLE_EQ(options.entry_timeout, 1.0);
+}
+
+TEST(ConfigTest, LoadsFilesAndReportsTheLine) {
+    std::string path = "/tmp/test_config_" + std::to_string(getpid()) + ".conf";
+    {
+        std::ofstream file(path);
+        file << "# layout\n"
+             << "block_size = 8K\n"
+             << "\n"
+             << "stripe_unit=1M  # large files\n"
+             << "seed = lab\n"
+             << "dedup\n";
+    }
+    AcceleratorConfig config;
+    std::string error;
+    ASSERT_EQ(loadConfigFile(config, path, error), 0) << error;
+    EXPECT_EQ(config.drives.block_size, 8u * 1024);
+    EXPECT_EQ(config.stripe_unit, 1024u * 1024);
+    EXPECT_EQ(config.hash_seed, "lab");
+    EXPECT_TRUE(config.dedup.enabled);
+
+    // Kernel caching keys only where the caller takes them
+    {
+        std::ofstream file(path);
+        file << "attr_timeout = 10\n"
+             << "drives = 2\n";
+    }
+    EXPECT_EQ(loadConfigFile(config, path, error), -EINVAL);
+    FuseCacheOptions options;
+    ASSERT_EQ(loadConfigFile(config, path, error, &options), 0) << error;
+    EXPECT_DOUBLE_EQ(options.attr_timeout, 10.0);
+    EXPECT_EQ(config.num_drives, 2);
+
+    {
+        std::ofstream file(path);
+        file << "drives = 4\n"
+             << "mystery = 1\n";
+    }
+    EXPECT_EQ(loadConfigFile(config, path, error), -EINVAL);
+    EXPECT_NE(error.find(path + ":2:"), std::string::npos);
+    unlink(path.c_str());
+    EXPECT_EQ(loadConfigFile(config, path, error), -ENOENT);
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include "hashing/consistent_hash_ring.h"
+#include <vector>
+#include <cstdint>
+
+static std::vector<size_t> placeKeys(const ConsistentHashRing& ring, size_t count) {
+    std::vector<size_t> owners(count);
+    for (size_t i = 0; i < count; i++) {
+        // Spread keys over the whole 64-bit space
+        owners[i] = ring.locate(i * 0x9E3779B97F4A7C15ull);
+    }
+    return owners;
+}
+
+TEST(ConsistentHashRingTest, AddingADriveOnlyMovesKeysToIt) {
+    ConsistentHashRing ring;
+    for (size_t drive = 0; drive < 16; drive++) {
+        ring.addDrive(drive);
+    }
+    const size_t num_keys = 100000;
+    auto before = placeKeys(ring, num_keys);
+
+    ring.addDrive(16);
+    auto after = placeKeys(ring, num_keys);
+
+    size_t moved = 0;
+    for (size_t i = 0; i < num_keys; i++) {
+        if (before[i] != after[i]) {
+            EXPECT_EQ(after[i], 16u);
+            moved++;
+        }
+    }
+    // Roughly 1/17 of the keys, far from the near-total reshuffle of modulo
+    EXPECT_GT(moved, num_keys / 34);
+    EXPECT_LT(moved, num_keys / 8);
+}
+
+TEST(ConsistentHashRingTest, RemovingADriveOnlyMovesItsKeys) {
+    ConsistentHashRing ring;
+    for (size_t drive = 0; drive < 8; drive++) {
+        ring.addDrive(drive);
+    }
+    const size_t num_keys = 50000;
+    auto before = placeKeys(ring, num_keys);
+
+    ring.removeDrive(3);
+    EXPECT_FALSE(ring.contains(3));
+    EXPECT_EQ(ring.drives().size(), 7u);
+    auto after = placeKeys(ring, num_keys);
+
+    std::vector<size_t> load(8, 0);
+    for (size_t i = 0; i < num_keys; i++) {
+        if (before[i] != 3) {
+            EXPECT_EQ(after[i], before[i]);
+        }
+        EXPECT_NE(after[i], 3u);
+        load[after[i]]++;
+    }
+    // Virtual nodes keep the remaining drives roughly even
+    for (size_t drive = 0; drive < 8; drive++) {
+        if (drive != 3) {
+            EXPECT_GT(load[drive], num_keys / 7 / 2);
+            EXPECT_LT(load[drive], num_keys / 7 * 2);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "storage_accelerator/dedup_index.h"
+#include <string>
+#include <vector>
+
+TEST(DedupIndexTest, SharedBlocksCountTheirReferences) {
+    DedupIndex index;
+    std::string content(4096, 'a');
+    Fingerprint fingerprint = DedupIndex::fingerprint(content.data(), content.size());
+    EXPECT_TRUE(fingerprint == DedupIndex::fingerprint(content.data(), content.size()));
+
+    // Unpublished blocks are nobody's candidate yet
+    ContentKey key = index.create(fingerprint, 3);
+    EXPECT_TRUE(index.candidates(fingerprint).empty());
+    index.publish(key);
+
+    ContentKey previous;
+    EXPECT_FALSE(index.assign(1, 0, key, previous));
+    auto found = index.candidates(fingerprint);
+    ASSERT_EQ(found.size(), 1u);
+    EXPECT_EQ(found[0].drive, 3u);
+    EXPECT_FALSE(index.assign(2, 5, found[0].key, previous));
+    EXPECT_EQ(index.uniqueBlocks(), 1u);
+    EXPECT_EQ(index.referencedBlocks(), 2u);
+
+    DedupIndex::Stored stored;
+    EXPECT_FALSE(index.acquire(1, 1, stored));
+    ASSERT_TRUE(index.acquire(2, 5, stored));
+    EXPECT_TRUE(stored.key == key);
+
+    // The last of the three references tells where to delete the block
+    size_t drive = 0;
+    EXPECT_FALSE(index.release(stored.key, drive));
+    std::vector<ContentKey> dropped = index.erase(1);
+    ASSERT_EQ(dropped.size(), 1u);
+    EXPECT_FALSE(index.release(dropped[0], drive));
+    ASSERT_TRUE(index.clear(2, 5, previous));
+    EXPECT_TRUE(index.release(previous, drive));
+    EXPECT_EQ(drive, 3u);
+    EXPECT_EQ(index.uniqueBlocks(), 0u);
+    EXPECT_EQ(index.referencedBlocks(), 0u);
+    EXPECT_FALSE(index.pin(key, drive));
+}
+
+TEST(DedupIndexTest, OverwritesAndTruncatesHandBackReferences) {
+    DedupIndex index;
+    Fingerprint first{1, 2};
+    Fingerprint second{3, 4};
+    ContentKey a = index.create(first, 0);
+    ContentKey b = index.create(second, 1);
+    ContentKey previous;
+    EXPECT_FALSE(index.assign(7, 0, a, previous));
+    EXPECT_TRUE(index.assign(7, 0, b, previous));
+    EXPECT_TRUE(previous == a);
+
+    size_t drive;
+    ASSERT_TRUE(index.pin(b, drive));
+    index.assign(7, 1, b, previous);
+    index.assign(7, 2, index.create(first, 2), previous);
+    EXPECT_EQ(index.blockCount(7), 3u);
+
+    std::vector<ContentKey> dropped = index.truncate(7, 1);
+    EXPECT_EQ(dropped.size(), 2u);
+    EXPECT_EQ(index.blockCount(7), 1u);
+    EXPECT_TRUE(index.truncate(7, 1).empty());
+}
+
+TEST(DedupIndexTest, CollidingBlocksGetTheirOwnGeneration) {
+    DedupIndex index;
+    Fingerprint fingerprint{5, 6};
+    ContentKey a = index.create(fingerprint, 0);
+    ContentKey b = index.create(fingerprint, 1);
+    EXPECT_FALSE(a == b);
+    EXPECT_NE(DedupIndex::objectName(a), DedupIndex::objectName(b));
+    index.publish(a);
+    index.publish(b);
+    EXPECT_EQ(index.candidates(fingerprint).size(), 2u);
+    EXPECT_EQ(index.snapshot().size(), 2u);
+
+    // Relocation only applies from the drive the caller saw
+    EXPECT_FALSE(index.relocate(b, 0, 2));
+    EXPECT_TRUE(index.relocate(b, 1, 2));
+    EXPECT_EQ(index.driveOf(b), 2u);
+
+    // A freed name is never handed out again; a's creator and the
+    // candidates call each hold a reference
+    size_t drive;
+    EXPECT_FALSE(index.release(a, drive));
+    EXPECT_TRUE(index.release(a, drive));
+    ContentKey c = index.create(fingerprint, 0);
+    EXPECT_FALSE(c == a);
+}
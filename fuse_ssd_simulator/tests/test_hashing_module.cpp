@@ -0,0 +1,26 @@
+#include <gtest/gtest.h>
+#include "hashing/hashing_module.h"
+#include <set>
+#include <vector>
+
+TEST(HashingModuleTest, BatchedBlockHashesMatchSingleOnes) {
+    HashingModule hashing("test_seed");
+    uint64_t file_key = hashing.fileKey(17);
+    EXPECT_EQ(file_key, hashing.fileKey(17));
+    EXPECT_NE(file_key, hashing.fileKey(18));
+
+    std::vector<uint64_t> hashes(64);
+    hashing.hashBlocks(file_key, 1000, hashes.size(), hashes.data());
+    for (size_t i = 0; i < hashes.size(); i++) {
+        EXPECT_EQ(hashes[i], hashing.hashBlock(file_key, 1000 + i));
+    }
+    EXPECT_EQ(std::set<uint64_t>(hashes.begin(), hashes.end()).size(), hashes.size());
+}
+
+TEST(HashingModuleTest, SeedChangesPlacement) {
+    HashingModule a("seed_a");
+    HashingModule b("seed_b");
+    EXPECT_NE(a.fileKey(2), b.fileKey(2));
+    EXPECT_NE(a.hashBlock(42, 7), b.hashBlock(42, 7));
+    EXPECT_NE(a.hashBlock(42, 7), a.hashBlock(7, 42));
+}
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include "storage_accelerator/load_balancer.h"
+#include <chrono>
+
+using namespace std::chrono;
+
+TEST(LoadBalancerTest, LatencyIsAnExponentialAverage) {
+    Logger logger("LoadBalancerTest");
+    LoadBalancerOptions options;
+    options.ewma_alpha = 0.5;
+    LoadBalancer balancer(2, &logger, options);
+
+    balancer.startOperation(0);
+    balancer.recordOperation(0, 4096, milliseconds(4));
+    EXPECT_DOUBLE_EQ(balancer.stats(0).avg_latency.load(), 4.0);
+
+    balancer.startOperation(0);
+    balancer.recordOperation(0, 4096, milliseconds(2));
+    EXPECT_DOUBLE_EQ(balancer.stats(0).avg_latency.load(), 3.0);
+    EXPECT_EQ(balancer.stats(0).pending_ops.load(), 0u);
+    EXPECT_GT(balancer.stats(0).avg_throughput.load(), 0.0);
+}
+
+TEST(LoadBalancerTest, HotPrimaryIsRelievedEarly) {
+    Logger logger("LoadBalancerTest");
+    LoadBalancer balancer(4, &logger);
+
+    // A quiet primary keeps its blocks
+    balancer.startOperation(1);
+    balancer.recordOperation(1, 4096, milliseconds(5));
+    EXPECT_EQ(balancer.selectDrive(1, 4096), 1u);
+
+    // Fifty queued 5ms requests is far past the threshold, even though the
+    // queue is nowhere near full
+    for (int i = 0; i < 50; i++) {
+        balancer.startOperation(1);
+    }
+    int redirected = 0;
+    for (int i = 0; i < 100; i++) {
+        size_t drive = balancer.selectDrive(1, 4096);
+        ASSERT_LT(drive, 4u);
+        redirected += drive != 1;
+    }
+    EXPECT_GT(redirected, 50);
+}
+
+TEST(LoadBalancerTest, DisabledBalancerKeepsPrimary) {
+    Logger logger("LoadBalancerTest");
+    LoadBalancerOptions options;
+    options.enabled = false;
+    LoadBalancer balancer(4, &logger, options);
+
+    balancer.startOperation(2);
+    balancer.recordOperation(2, 4096, milliseconds(50));
+    for (int i = 0; i < 100; i++) {
+        balancer.startOperation(2);
+    }
+    EXPECT_EQ(balancer.selectDrive(2, 4096), 2u);
+}
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "logger/logger.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+static std::string countedMessage(int& evaluations) {
+    evaluations++;
+    return "counted";
+}
+
+TEST(LoggerTest, DisabledLevelsSkipMessageConstruction) {
+    Logger logger("LoggerTest");
+    int evaluations = 0;
+
+    Logger::setLevel(INFO);
+    LOG_DEBUG(logger, countedMessage(evaluations));
+    EXPECT_EQ(evaluations, 0);
+    LOG_INFO(logger, countedMessage(evaluations));
+    EXPECT_EQ(evaluations, 1);
+
+    Logger::setLevel(ERROR);
+    EXPECT_FALSE(Logger::enabled(INFO));
+    EXPECT_TRUE(Logger::enabled(ERROR));
+    LOG_INFO(logger, countedMessage(evaluations));
+    EXPECT_EQ(evaluations, 1);
+
+    Logger::setLevel(INFO);
+}
+
+TEST(LoggerTest, FlushWritesEveryThreadsMessages) {
+    std::string log_file = "/tmp/test_logger_" + std::to_string(getpid()) + ".log";
+    Logger::init(log_file);
+
+    const int num_threads = 8;
+    const int per_thread = 2000;  // More than one ring's worth
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([t]() {
+            Logger logger("Worker" + std::to_string(t));
+            for (int i = 0; i < per_thread; i++) {
+                logger.info("message " + std::to_string(t) + ":" + std::to_string(i));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    Logger::flush();
+
+    std::ifstream in(log_file);
+    ASSERT_TRUE(in.is_open());
+    std::string line;
+    int count = 0;
+    while (std::getline(in, line)) {
+        if (line.find("[Worker") != std::string::npos && line.find("] [INFO ] message ") != std::string::npos) {
+            count++;
+        }
+    }
+    EXPECT_EQ(count, num_threads * per_thread);
+    unlink(log_file.c_str());
+}
@@ -0,0 +1,318 @@
+#include <gtest/gtest.h>
+#include "metadata/metadata_manager.h"
+#include <sys/stat.h>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+static FileMetadata makeMetadata(mode_t mode) {
+    FileMetadata metadata;
+    metadata.mode = mode;
+    metadata.nlink = 1;
+    metadata.uid = 0;
+    metadata.gid = 0;
+    metadata.size = 0;
+    metadata.atime = metadata.mtime = metadata.ctime = 0;
+    return metadata;
+}
+
+TEST(MetadataManagerTest, InodeTableFollowsRenameAndUnlink) {
+    MetadataManager manager;
+    EXPECT_EQ(manager.getPath(MetadataManager::ROOT_INO), "/");
+    EXPECT_EQ(manager.getMetadata("/")->ino, MetadataManager::ROOT_INO);
+
+    manager.addMetadata("/a", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/b", makeMetadata(S_IFREG | 0644));
+    uint64_t ino = manager.getMetadata("/a")->ino;
+    EXPECT_NE(ino, MetadataManager::ROOT_INO);
+    EXPECT_NE(ino, manager.getMetadata("/b")->ino);
+    EXPECT_EQ(manager.getPath(ino), "/a");
+
+    // Rename keeps the inode number and re-points the table
+    manager.addMetadata("/c", *manager.getMetadata("/a"));
+    manager.removeMetadata("/a");
+    EXPECT_EQ(manager.getMetadata("/c")->ino, ino);
+    EXPECT_EQ(manager.getPath(ino), "/c");
+
+    manager.removeMetadata("/c");
+    EXPECT_EQ(manager.getPath(ino), "");
+}
+
+TEST(MetadataManagerTest, LookupCountsDropWithForget) {
+    MetadataManager manager;
+    manager.addMetadata("/a", makeMetadata(S_IFREG | 0644));
+    uint64_t ino = manager.getMetadata("/a")->ino;
+
+    manager.lookup(ino);
+    manager.lookup(ino);
+    manager.lookup(ino);
+    EXPECT_EQ(manager.lookupCount(ino), 3u);
+
+    manager.forget(ino, 2);
+    EXPECT_EQ(manager.lookupCount(ino), 1u);
+    manager.forget(ino, 5);
+    EXPECT_EQ(manager.lookupCount(ino), 0u);
+    manager.forget(ino, 1);  // Unknown inodes are ignored
+    EXPECT_EQ(manager.lookupCount(ino), 0u);
+}
+
+TEST(MetadataManagerTest, UnlinkedInodesLiveUntilTheirLastReference) {
+    MetadataManager manager;
+    manager.addMetadata("/a", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/b", makeMetadata(S_IFREG | 0644));
+    uint64_t ino = manager.getMetadata("/a")->ino;
+    uint64_t other = manager.getMetadata("/b")->ino;
+
+    // Nothing refers to it, so the entry comes back for its data to go
+    std::shared_ptr<FileMetadata> removed;
+    ASSERT_EQ(manager.unlinkMetadata("/b", false, &removed), 0);
+    ASSERT_TRUE(removed);
+    EXPECT_EQ(removed->ino, other);
+    EXPECT_FALSE(manager.getMetadata(other));
+
+    manager.lookup(ino);
+    manager.openHandle(ino);
+    removed.reset();
+    ASSERT_EQ(manager.unlinkMetadata("/a", false, &removed), 0);
+    EXPECT_FALSE(removed);
+    EXPECT_EQ(manager.getPath(ino), "");
+    ASSERT_TRUE(manager.getMetadata(ino));
+    EXPECT_EQ(manager.getMetadata(ino)->nlink, 0u);
+
+    EXPECT_FALSE(manager.forget(ino, 1));
+    ASSERT_TRUE(manager.getMetadata(ino));
+    auto last = manager.releaseHandle(ino);
+    ASSERT_TRUE(last);
+    EXPECT_EQ(last->ino, ino);
+    EXPECT_FALSE(manager.getMetadata(ino));
+    EXPECT_FALSE(manager.releaseHandle(ino));
+}
+
+TEST(MetadataManagerTest, ChildrenIndexTracksDirectories) {
+    MetadataManager manager;
+    manager.addMetadata("/d", makeMetadata(S_IFDIR | 0755));
+    manager.addMetadata("/d/x", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/d/sub", makeMetadata(S_IFDIR | 0755));
+    manager.addMetadata("/d/sub/y", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/dx", makeMetadata(S_IFREG | 0644));
+
+    EXPECT_EQ(manager.listDirectory("/"), (std::vector<std::string>{"d", "dx"}));
+    EXPECT_EQ(manager.listDirectory("/d"), (std::vector<std::string>{"sub", "x"}));
+    EXPECT_TRUE(manager.hasChildren("/d/sub"));
+    EXPECT_FALSE(manager.hasChildren("/dx"));
+
+    auto entries = manager.listEntries("/d");
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[0].name, "sub");
+    EXPECT_EQ(entries[0].metadata, manager.getMetadata("/d/sub"));
+    EXPECT_EQ(entries[1].name, "x");
+    EXPECT_EQ(entries[1].metadata, manager.getMetadata("/d/x"));
+
+    manager.removeMetadata("/d/sub/y");
+    EXPECT_FALSE(manager.hasChildren("/d/sub"));
+    EXPECT_TRUE(manager.listDirectory("/d/sub").empty());
+}
+
+TEST(MetadataManagerTest, RenameMovesWholeSubtree) {
+    MetadataManager manager;
+    manager.addMetadata("/d", makeMetadata(S_IFDIR | 0755));
+    manager.addMetadata("/d/sub", makeMetadata(S_IFDIR | 0755));
+    manager.addMetadata("/d/sub/y", makeMetadata(S_IFREG | 0644));
+    uint64_t ino = manager.getMetadata("/d/sub/y")->ino;
+
+    EXPECT_EQ(manager.listSubtree("/d"),
+              (std::vector<std::string>{"/d", "/d/sub", "/d/sub/y"}));
+
+    ASSERT_EQ(manager.renameMetadata("/d", "/e"), 0);
+    EXPECT_FALSE(manager.exists("/d"));
+    EXPECT_FALSE(manager.exists("/d/sub/y"));
+    EXPECT_TRUE(manager.listDirectory("/d").empty());
+    EXPECT_EQ(manager.listDirectory("/"), (std::vector<std::string>{"e"}));
+    EXPECT_EQ(manager.listDirectory("/e/sub"), (std::vector<std::string>{"y"}));
+    EXPECT_EQ(manager.getMetadata("/e/sub/y")->ino, ino);
+    EXPECT_EQ(manager.getPath(ino), "/e/sub/y");
+    ASSERT_EQ(manager.listEntries("/e/sub").size(), 1u);
+    EXPECT_EQ(manager.listEntries("/e/sub")[0].metadata->ino, ino);
+}
+
+TEST(MetadataManagerTest, RenameReplacesOrExchangesDestination) {
+    MetadataManager manager;
+    manager.addMetadata("/a", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/b", makeMetadata(S_IFREG | 0644));
+    manager.addMetadata("/d", makeMetadata(S_IFDIR | 0755));
+    manager.addMetadata("/d/x", makeMetadata(S_IFREG | 0644));
+    uint64_t a = manager.getMetadata("/a")->ino;
+    uint64_t b = manager.getMetadata("/b")->ino;
+    uint64_t x = manager.getMetadata("/d/x")->ino;
+
+    EXPECT_EQ(manager.renameMetadata("/a", "/b", RENAME_NOREPLACE), -EEXIST);
+    EXPECT_EQ(manager.renameMetadata("/a", "/b", RENAME_NOREPLACE | RENAME_EXCHANGE), -EINVAL);
+    EXPECT_EQ(manager.renameMetadata("/a", "/c", RENAME_EXCHANGE), -ENOENT);
+    EXPECT_EQ(manager.renameMetadata("/a", "/d"), -EISDIR);
+    EXPECT_EQ(manager.renameMetadata("/d", "/a"), -ENOTDIR);
+    EXPECT_EQ(manager.renameMetadata("/d/x", "/d", RENAME_EXCHANGE), -EINVAL);
+
+    // Exchange swaps whole subtrees, inode numbers travel with their entries
+    ASSERT_EQ(manager.renameMetadata("/a", "/d", RENAME_EXCHANGE), 0);
+    EXPECT_EQ(manager.getMetadata("/a")->mode & S_IFMT, S_IFDIR);
+    EXPECT_EQ(manager.getMetadata("/d")->ino, a);
+    EXPECT_EQ(manager.getMetadata("/a/x")->ino, x);
+    EXPECT_FALSE(manager.exists("/d/x"));
+    EXPECT_EQ(manager.listDirectory("/a"), (std::vector<std::string>{"x"}));
+    EXPECT_TRUE(manager.listDirectory("/d").empty());
+    EXPECT_EQ(manager.getPath(a), "/d");
+    EXPECT_EQ(manager.getPath(x), "/a/x");
+
+    // A plain rename replaces the destination and hands it back
+    std::shared_ptr<FileMetadata> replaced;
+    ASSERT_EQ(manager.renameMetadata("/d", "/b", 0, &replaced), 0);
+    ASSERT_TRUE(replaced != nullptr);
+    EXPECT_EQ(replaced->ino, b);
+    EXPECT_EQ(manager.getMetadata("/b")->ino, a);
+    EXPECT_FALSE(manager.exists("/d"));
+    EXPECT_EQ(manager.getPath(b), "");
+    EXPECT_EQ(manager.listDirectory("/"), (std::vector<std::string>{"a", "b"}));
+
+    // Directories only replace empty directories
+    manager.addMetadata("/e", makeMetadata(S_IFDIR | 0755));
+    EXPECT_EQ(manager.renameMetadata("/e", "/a"), -ENOTEMPTY);
+    ASSERT_EQ(manager.renameMetadata("/a", "/e"), 0);
+    EXPECT_EQ(manager.getMetadata("/e/x")->ino, x);
+}
+
+TEST(MetadataManagerTest, NamespaceOperationsCheckAtomically) {
+    MetadataManager manager;
+    ASSERT_EQ(manager.createMetadata("/d", makeMetadata(S_IFDIR | 0755)), 0);
+    EXPECT_EQ(manager.createMetadata("/d", makeMetadata(S_IFDIR | 0755)), -EEXIST);
+    EXPECT_EQ(manager.createMetadata("/missing/x", makeMetadata(S_IFREG | 0644)), -ENOENT);
+    ASSERT_EQ(manager.createMetadata("/d/x", makeMetadata(S_IFREG | 0644)), 0);
+    EXPECT_EQ(manager.createMetadata("/d/x/y", makeMetadata(S_IFREG | 0644)), -ENOTDIR);
+
+    EXPECT_EQ(manager.unlinkMetadata("/d", true), -ENOTEMPTY);
+    EXPECT_EQ(manager.unlinkMetadata("/d", false), -EISDIR);
+    EXPECT_EQ(manager.unlinkMetadata("/d/x", true), -ENOTDIR);
+    EXPECT_EQ(manager.unlinkMetadata("/d/x", false), 0);
+    EXPECT_EQ(manager.unlinkMetadata("/d", true), 0);
+
+}
+
+TEST(MetadataManagerTest, ConcurrentCreatesSucceedOncePerPath) {
+    MetadataManager manager;
+    ASSERT_EQ(manager.createMetadata("/d", makeMetadata(S_IFDIR | 0755)), 0);
+
+    const int num_threads = 4;
+    const int num_files = 200;
+    std::atomic<int> created{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < num_files; i++) {
+                std::string path = "/d/f" + std::to_string(i);
+                if (manager.createMetadata(path, makeMetadata(S_IFREG | 0644)) == 0) {
+                    created++;
+                }
+                manager.getMetadata(path);
+                manager.listDirectory("/d");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(created, num_files);
+    EXPECT_EQ(manager.listDirectory("/d").size(), static_cast<size_t>(num_files));
+    EXPECT_EQ(manager.renameMetadata("/d", "/e"), 0);
+    EXPECT_EQ(manager.listDirectory("/e").size(), static_cast<size_t>(num_files));
+    EXPECT_EQ(manager.renameMetadata("/d", "/f"), -ENOENT);
+}
+
+TEST(MetadataManagerTest, HandlesAreStableAndUpdatesPersist) {
+    MetadataManager manager;
+    ASSERT_EQ(manager.createMetadata("/a", makeMetadata(S_IFREG | 0644)), 0);
+
+    auto handle = manager.getMetadata("/a");
+    EXPECT_EQ(manager.getMetadata("/a").get(), handle.get());
+
+    handle->size = 10;
+    handle->extendSize(4);
+    EXPECT_EQ(manager.getMetadata("/a")->size, 10);
+    handle->extendSize(42);
+    EXPECT_EQ(manager.getMetadata("/a")->size, 42);
+
+    // The same entry object moves with a rename
+    ASSERT_EQ(manager.renameMetadata("/a", "/b"), 0);
+    EXPECT_EQ(manager.getMetadata("/b").get(), handle.get());
+    handle->mode = S_IFREG | 0600;
+    EXPECT_EQ(manager.getMetadata("/b")->mode & 0777, 0600u);
+
+    // Unlinking hands back the entry and leaves outstanding handles valid
+    std::shared_ptr<FileMetadata> removed;
+    ASSERT_EQ(manager.unlinkMetadata("/b", false, &removed), 0);
+    EXPECT_EQ(removed.get(), handle.get());
+    EXPECT_EQ(handle->size, 42);
+}
+
+TEST(MetadataManagerTest, LogAndCheckpointSurviveRestart) {
+    std::string dir = "/tmp/test_metadata_" + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    uint64_t ino = 0;
+    {
+        MetadataManager manager;
+        ASSERT_EQ(manager.open(dir), 0);
+        ASSERT_EQ(manager.createMetadata("/d", makeMetadata(S_IFDIR | 0755)), 0);
+        ASSERT_EQ(manager.createMetadata("/d/a", makeMetadata(S_IFREG | 0644)), 0);
+        ASSERT_EQ(manager.createMetadata("/d/b", makeMetadata(S_IFREG | 0644)), 0);
+        auto entry = manager.getMetadata("/d/a");
+        ino = entry->ino;
+        entry->size = 123;
+        ASSERT_EQ(manager.logAttributes(*entry), 0);
+        ASSERT_EQ(manager.renameMetadata("/d/a", "/d/c"), 0);
+        ASSERT_EQ(manager.unlinkMetadata("/d/b", false), 0);
+    }
+
+    {
+        // Replayed from the log alone
+        MetadataManager manager;
+        ASSERT_EQ(manager.open(dir), 0);
+        auto entry = manager.getMetadata("/d/c");
+        ASSERT_NE(entry, nullptr);
+        EXPECT_EQ(entry->ino, ino);
+        EXPECT_EQ(entry->size.load(), 123);
+        EXPECT_EQ(manager.getPath(ino), "/d/c");
+        EXPECT_FALSE(manager.exists("/d/a"));
+        EXPECT_FALSE(manager.exists("/d/b"));
+        EXPECT_EQ(manager.listDirectory("/d"), std::vector<std::string>{"c"});
+
+        ASSERT_EQ(manager.checkpoint(), 0);
+        EXPECT_EQ(std::filesystem::file_size(dir + "/metadata.log"), 0u);
+        ASSERT_EQ(manager.createMetadata("/e", makeMetadata(S_IFREG | 0644)), 0);
+        // The unlinked /d/b keeps its number retired
+        EXPECT_GT(manager.getMetadata("/e")->ino, ino + 1);
+    }
+
+    // A torn record at the tail is dropped, appends carry on after it
+    {
+        std::ofstream log(dir + "/metadata.log", std::ios::app | std::ios::binary);
+        log.write("\x40\0\0\0garbage", 11);
+    }
+    {
+        MetadataManager manager;
+        ASSERT_EQ(manager.open(dir), 0);
+        EXPECT_TRUE(manager.exists("/d/c"));
+        EXPECT_TRUE(manager.exists("/e"));
+        ASSERT_EQ(manager.createMetadata("/f", makeMetadata(S_IFREG | 0644)), 0);
+    }
+    {
+        MetadataManager manager;
+        ASSERT_EQ(manager.open(dir), 0);
+        EXPECT_TRUE(manager.exists("/f"));
+        EXPECT_EQ(manager.getMetadata("/d/c")->ino, ino);
+    }
+    std::filesystem::remove_all(dir);
+}
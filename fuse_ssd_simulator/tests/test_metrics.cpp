@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include "monitoring/metrics.h"
+#include "monitoring/monitor.h"
+#include "storage_accelerator/storage_accelerator.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+TEST(MetricsTest, HistogramPercentilesStayWithinBucketError) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(histogram.percentile(0.5), 0u);
+
+    // 1..10000: the true p50 is 5000 and p99 is 9900
+    for (uint64_t value = 1; value <= 10000; value++) {
+        histogram.record(value);
+    }
+    EXPECT_EQ(histogram.count(), 10000u);
+    EXPECT_EQ(histogram.max(), 10000u);
+    EXPECT_EQ(histogram.sum(), 10000u * 10001 / 2);
+
+    auto near = [](uint64_t actual, double expected) {
+        return actual >= expected && actual <= expected * 1.125 + 1;
+    };
+    EXPECT_TRUE(near(histogram.percentile(0.5), 5000)) << histogram.percentile(0.5);
+    EXPECT_TRUE(near(histogram.percentile(0.99), 9900)) << histogram.percentile(0.99);
+    EXPECT_EQ(histogram.percentile(1.0), 10000u);
+}
+
+TEST(MetricsTest, HistogramIsSafeUnderConcurrentRecording) {
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&histogram]() {
+            for (uint64_t i = 0; i < 100000; i++) {
+                histogram.record(i % 1000);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(histogram.count(), 400000u);
+    EXPECT_EQ(histogram.max(), 999u);
+}
+
+TEST(MetricsTest, MonitorExportsDriveAndFileMetrics) {
+    // Without a cache the read reaches the drives
+    BlockCacheOptions no_cache;
+    no_cache.capacity = 0;
+    auto accelerator = std::make_shared<StorageAccelerator>(2, "metrics_seed", no_cache);
+    std::vector<char> data(64 * 1024, 'm');
+    ASSERT_EQ(accelerator->createFile("/metrics.bin", 0644), 0);
+    ASSERT_EQ(accelerator->writeFile("/metrics.bin", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    ASSERT_EQ(accelerator->readFile("/metrics.bin", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+
+    EXPECT_EQ(accelerator->readStats().ops.load(), 1u);
+    EXPECT_EQ(accelerator->writeStats().bytes.load(), data.size());
+
+    Logger logger("MetricsTest");
+    std::string metrics_file = "/tmp/test_metrics_" + std::to_string(getpid()) + ".prom";
+    Monitor monitor(accelerator, &logger, metrics_file);
+    ASSERT_TRUE(monitor.writeMetrics());
+
+    std::ifstream in(metrics_file);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string metrics = text.str();
+    EXPECT_NE(metrics.find("# TYPE fuse_ssd_drive_latency_seconds summary"), std::string::npos);
+    EXPECT_NE(metrics.find("fuse_ssd_fs_bytes_total{op=\"write\"} 65536"), std::string::npos);
+    EXPECT_NE(metrics.find("fuse_ssd_drive_ops_total{drive=\"0\",op=\"write\"}"), std::string::npos);
+    EXPECT_NE(metrics.find("fuse_ssd_drive_latency_seconds{drive=\"1\",op=\"read\",quantile=\"0.99\"}"),
+              std::string::npos);
+    EXPECT_NE(metrics.find("fuse_ssd_drive_queue_depth{drive=\"0\"} 0"), std::string::npos);
+    EXPECT_NE(metrics.find("fuse_ssd_cache_dirty_blocks 0"), std::string::npos);
+    unlink(metrics_file.c_str());
+}
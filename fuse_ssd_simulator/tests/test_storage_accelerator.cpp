@@ -1,7 +1,16 @@
 #include <gtest/gtest.h>
 #include "storage_accelerator/storage_accelerator.h"
 #include <sys/stat.h>
+#include <atomic>
 #include <bitset>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 class StorageAcceleratorTest : public ::testing::Test {
 protected:
@@ -67,4 +76,646 @@ TEST_F(StorageAcceleratorTest, DirectoryOperations) {
 
     // Delete directory
     ASSERT_EQ(accelerator->removeDirectory("/testdir"), 0);
-}
\ No newline at end of file
+}
+TEST_F(StorageAcceleratorTest, DrivePoolChangesKeepData) {
+    const size_t file_size = 256 * 1024;
+    std::vector<char> data(file_size);
+    for (size_t i = 0; i < file_size; i++) {
+        data[i] = static_cast<char>(i * 31 + 7);
+    }
+    ASSERT_EQ(accelerator->createFile("/pool.bin", 0644), 0);
+    ASSERT_EQ(accelerator->writeFile("/pool.bin", data.data(), file_size, 0),
+              static_cast<ssize_t>(file_size));
+
+    auto readBack = [&]() {
+        std::vector<char> buffer(file_size, 0);
+        EXPECT_EQ(accelerator->readFile("/pool.bin", buffer.data(), file_size, 0),
+                  static_cast<ssize_t>(file_size));
+        return buffer == data;
+    };
+
+    // Data stays readable while migration runs and after it finishes
+    int added = accelerator->addDrive();
+    ASSERT_GE(added, 4);
+    EXPECT_TRUE(readBack());
+    accelerator->waitForRebalance();
+    EXPECT_TRUE(readBack());
+    EXPECT_EQ(accelerator->activeDrives().size(), 5u);
+
+    ASSERT_EQ(accelerator->removeDrive(0), 0);
+    EXPECT_EQ(accelerator->removeDrive(0), -ENOENT);
+    accelerator->waitForRebalance();
+    EXPECT_TRUE(readBack());
+    EXPECT_EQ(accelerator->activeDrives(), std::vector<size_t>({1, 2, 3, static_cast<size_t>(added)}));
+
+    // Freed slots are reused
+    EXPECT_EQ(accelerator->addDrive(), 0);
+    accelerator->waitForRebalance();
+    EXPECT_TRUE(readBack());
+
+    // Migrated blocks leave no copy behind
+    EXPECT_EQ(accelerator->blocksInUse(), file_size / 4096);
+}
+
+TEST_F(StorageAcceleratorTest, IOContinuesWhileTheHighestDriveLeaves) {
+    const size_t file_size = 256 * 1024;
+    std::vector<char> data(file_size);
+    for (size_t i = 0; i < file_size; i++) {
+        data[i] = static_cast<char>(i * 17 + 3);
+    }
+    int added = accelerator->addDrive();
+    ASSERT_EQ(added, 4);
+    accelerator->waitForRebalance();
+    ASSERT_EQ(accelerator->createFile("/leaving.bin", 0644), 0);
+    ASSERT_EQ(accelerator->writeFile("/leaving.bin", data.data(), file_size, 0),
+              static_cast<ssize_t>(file_size));
+
+    // Blocks on drive 4 are past the end of the new ring until they move
+    std::atomic<bool> stop{false};
+    std::atomic<int> mismatches{0};
+    std::thread reader([&]() {
+        std::vector<char> buffer(file_size);
+        while (!stop) {
+            if (accelerator->readFile("/leaving.bin", buffer.data(), file_size, 0) !=
+                    static_cast<ssize_t>(file_size) ||
+                buffer != data) {
+                mismatches++;
+            }
+        }
+    });
+    ASSERT_EQ(accelerator->removeDrive(added), 0);
+    ASSERT_EQ(accelerator->writeFile("/leaving.bin", data.data(), file_size, 0),
+              static_cast<ssize_t>(file_size));
+    accelerator->waitForRebalance();
+    stop = true;
+    reader.join();
+    EXPECT_EQ(mismatches.load(), 0);
+
+    std::vector<char> buffer(file_size);
+    ASSERT_EQ(accelerator->readFile("/leaving.bin", buffer.data(), file_size, 0),
+              static_cast<ssize_t>(file_size));
+    EXPECT_EQ(buffer, data);
+    EXPECT_EQ(accelerator->blocksInUse(), file_size / 4096);
+}
+
+TEST_F(StorageAcceleratorTest, RenameKeepsDataInPlace) {
+    // Large enough to span every drive
+    std::vector<char> data(256 * 1024);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    std::string other(5000, 'o');
+
+    ASSERT_EQ(accelerator->createDirectory("/src", 0755), 0);
+    ASSERT_EQ(accelerator->createFile("/src/big", 0644), 0);
+    ASSERT_EQ(accelerator->createFile("/other", 0644), 0);
+    ASSERT_EQ(accelerator->writeFile("/src/big", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    ASSERT_EQ(accelerator->writeFile("/other", other.data(), other.size(), 0),
+              static_cast<ssize_t>(other.size()));
+    uint64_t ino = accelerator->getMetadata("/src/big")->ino;
+
+    auto readAll = [&](const std::string& path, size_t size) {
+        std::vector<char> buffer(size);
+        EXPECT_EQ(accelerator->readFile(path, buffer.data(), size, 0), static_cast<ssize_t>(size));
+        return buffer;
+    };
+
+    ASSERT_EQ(accelerator->renameFile("/src", "/dst", 0), 0);
+    EXPECT_EQ(accelerator->getMetadata("/dst/big")->ino, ino);
+    EXPECT_EQ(readAll("/dst/big", data.size()), data);
+
+    EXPECT_EQ(accelerator->renameFile("/dst/big", "/other", RENAME_NOREPLACE), -EEXIST);
+    ASSERT_EQ(accelerator->renameFile("/dst/big", "/other", RENAME_EXCHANGE), 0);
+    EXPECT_EQ(readAll("/other", data.size()), data);
+    EXPECT_EQ(readAll("/dst/big", other.size()), std::vector<char>(other.begin(), other.end()));
+
+    // A plain rename replaces the destination
+    ASSERT_EQ(accelerator->renameFile("/other", "/dst/big", 0), 0);
+    EXPECT_FALSE(accelerator->getMetadata("/other"));
+    EXPECT_EQ(accelerator->getMetadata("/dst/big")->ino, ino);
+    EXPECT_EQ(readAll("/dst/big", data.size()), data);
+}
+
+TEST_F(StorageAcceleratorTest, InodeIOOutlivesUnlinkUntilTheLastReference) {
+    std::string data(10000, 'i');
+    ASSERT_EQ(accelerator->createFile("/byino", 0644), 0);
+    uint64_t ino = accelerator->getMetadata("/byino")->ino;
+    // What the kernel holds for an open file: a lookup and a handle
+    accelerator->lookupInode(ino);
+    accelerator->openFile(ino);
+    ASSERT_EQ(accelerator->writeFile(ino, data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(accelerator->getMetadata(ino), accelerator->getMetadata("/byino"));
+
+    ASSERT_EQ(accelerator->renameFile("/byino", "/moved", 0), 0);
+    std::string buffer(data.size(), '\0');
+    ASSERT_EQ(accelerator->readFile(ino, &buffer[0], buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(buffer, data);
+
+    // Unlinked while open: the name is gone, the inode and its data are not
+    ASSERT_EQ(accelerator->deleteFile("/moved"), 0);
+    EXPECT_FALSE(accelerator->getMetadata("/moved"));
+    ASSERT_TRUE(accelerator->getMetadata(ino));
+    EXPECT_EQ(accelerator->getMetadata(ino)->nlink, 0u);
+    EXPECT_EQ(accelerator->getPath(ino), "");
+    ASSERT_EQ(accelerator->writeFile(ino, "tail", 4, data.size()), 4);
+    buffer.assign(data.size() + 4, '\0');
+    ASSERT_EQ(accelerator->readFile(ino, &buffer[0], buffer.size(), 0),
+              static_cast<ssize_t>(buffer.size()));
+    EXPECT_EQ(buffer, data + "tail");
+    EXPECT_GT(accelerator->blocksInUse(), 0u);
+
+    // ftruncate and fchmod on the open descriptor
+    ASSERT_EQ(accelerator->truncateFile(ino, data.size()), 0);
+    ASSERT_EQ(accelerator->chmodFile(ino, 0600), 0);
+    EXPECT_EQ(accelerator->getMetadata(ino)->size, data.size());
+    EXPECT_EQ(accelerator->getMetadata(ino)->mode & 07777, 0600u);
+
+    accelerator->releaseFile(ino);
+    ASSERT_EQ(accelerator->readFile(ino, &buffer[0], buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+
+    // The last reference goes and takes the data with it
+    accelerator->forgetInode(ino, 1);
+    EXPECT_FALSE(accelerator->getMetadata(ino));
+    EXPECT_EQ(accelerator->readFile(ino, &buffer[0], buffer.size(), 0), -ENOENT);
+    EXPECT_EQ(accelerator->writeFile(ino, data.data(), data.size(), 0), -ENOENT);
+    accelerator->waitForReclaim();
+    EXPECT_EQ(accelerator->blocksInUse(), 0u);
+}
+
+TEST_F(StorageAcceleratorTest, DeleteAndTruncateFreeEveryDrive) {
+    // Spread over all drives and above the synchronous reclaim limit
+    const size_t file_size = 2 * 1024 * 1024;
+    std::vector<char> data(file_size, 'd');
+    ASSERT_EQ(accelerator->createFile("/big", 0644), 0);
+    ASSERT_EQ(accelerator->createFile("/small", 0644), 0);
+    ASSERT_EQ(accelerator->writeFile("/big", data.data(), file_size, 0),
+              static_cast<ssize_t>(file_size));
+    ASSERT_EQ(accelerator->writeFile("/small", data.data(), 64 * 1024, 0), 64 * 1024);
+    EXPECT_EQ(accelerator->blocksInUse(), (file_size + 64 * 1024) / 4096);
+
+    // Shrinking frees blocks on every drive, growing again reads zeroes
+    ASSERT_EQ(accelerator->truncateFile("/small", 10000), 0);
+    EXPECT_EQ(accelerator->blocksInUse(), file_size / 4096 + 3);
+    ASSERT_EQ(accelerator->truncateFile("/small", 64 * 1024), 0);
+    std::vector<char> buffer(64 * 1024, 'z');
+    ASSERT_EQ(accelerator->readFile("/small", buffer.data(), buffer.size(), 0), 64 * 1024);
+    EXPECT_EQ(buffer[9999], 'd');
+    EXPECT_EQ(buffer[10000], 0);
+    EXPECT_EQ(buffer[64 * 1024 - 1], 0);
+
+    ASSERT_EQ(accelerator->deleteFile("/small"), 0);
+    EXPECT_EQ(accelerator->blocksInUse(), file_size / 4096);
+
+    // The large file is reclaimed in the background
+    ASSERT_EQ(accelerator->deleteFile("/big"), 0);
+    EXPECT_FALSE(accelerator->getMetadata("/big"));
+    accelerator->waitForReclaim();
+    EXPECT_EQ(accelerator->blocksInUse(), 0u);
+}
+
+TEST(StorageAcceleratorCacheTest, WriteBackHoldsDataUntilFlush) {
+    BlockCacheOptions options;
+    options.write_back = true;
+    StorageAccelerator accelerator(4, "test_seed", options);
+    ASSERT_EQ(accelerator.createFile("/log", 0644), 0);
+    uint64_t ino = accelerator.getMetadata("/log")->ino;
+
+    // Many small appends, like a log writer
+    std::string expected;
+    std::string line = "entry 0123456789 abcdefghij\n";
+    for (int i = 0; i < 400; i++) {
+        ASSERT_EQ(accelerator.writeFile("/log", line.data(), line.size(), expected.size()),
+                  static_cast<ssize_t>(line.size()));
+        expected += line;
+    }
+    EXPECT_EQ(accelerator.blocksInUse(), 0u);
+    EXPECT_GT(accelerator.cache().dirtyBlocks(), 0u);
+
+    std::vector<char> buffer(expected.size());
+    ASSERT_EQ(accelerator.readFile("/log", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(expected.size()));
+    EXPECT_EQ(std::string(buffer.begin(), buffer.end()), expected);
+
+    ASSERT_EQ(accelerator.flushFile(ino), 0);
+    EXPECT_EQ(accelerator.cache().dirtyBlocks(), 0u);
+    EXPECT_EQ(accelerator.blocksInUse(), (expected.size() + 4095) / 4096);
+
+    // Served from the cache now, and the drives hold the same bytes
+    uint64_t hits = accelerator.cache().hits();
+    ASSERT_EQ(accelerator.readFile("/log", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(expected.size()));
+    EXPECT_EQ(std::string(buffer.begin(), buffer.end()), expected);
+    EXPECT_GT(accelerator.cache().hits(), hits);
+
+    // Truncate sees data that was only in the cache
+    ASSERT_EQ(accelerator.writeFile("/log", "tail", 4, expected.size()), 4);
+    ASSERT_EQ(accelerator.truncateFile("/log", expected.size() + 2), 0);
+    char tail[2];
+    ASSERT_EQ(accelerator.readFile("/log", tail, 2, expected.size()), 2);
+    EXPECT_EQ(std::string(tail, 2), "ta");
+}
+
+TEST(StorageAcceleratorCacheTest, SequentialReadsArePrefetched) {
+    StorageAccelerator accelerator(4, "test_seed");
+    ASSERT_EQ(accelerator.createFile("/stream", 0644), 0);
+
+    // Unaligned writes leave the cache cold, so reads must reach the drives
+    const size_t file_size = 1024 * 1024;
+    std::vector<char> data(file_size);
+    for (size_t i = 0; i < file_size; i++) {
+        data[i] = static_cast<char>(i * 7 + i / 4096);
+    }
+    const size_t piece = 4095;
+    for (size_t pos = 0; pos < file_size; pos += piece) {
+        size_t len = std::min(piece, file_size - pos);
+        ASSERT_EQ(accelerator.writeFile("/stream", data.data() + pos, len, pos),
+                  static_cast<ssize_t>(len));
+    }
+
+    // Random access never triggers readahead
+    ReadStream random;
+    std::vector<char> chunk(64 * 1024);
+    ASSERT_EQ(accelerator.readFile("/stream", chunk.data(), 4096, 8 * 4096, &random), 4096);
+    ASSERT_EQ(accelerator.readFile("/stream", chunk.data(), 4096, 2 * 4096, &random), 4096);
+    accelerator.waitForReadahead();
+    EXPECT_EQ(accelerator.readaheadBlocks(), 0u);
+
+    // After the first read every block of a sequential scan is a hit
+    ReadStream stream;
+    ASSERT_EQ(accelerator.readFile("/stream", chunk.data(), chunk.size(), 0, &stream),
+              static_cast<ssize_t>(chunk.size()));
+    accelerator.waitForReadahead();
+    uint64_t misses = accelerator.cache().misses();
+    std::vector<char> result(chunk.begin(), chunk.end());
+    for (size_t pos = chunk.size(); pos < file_size; pos += chunk.size()) {
+        ASSERT_EQ(accelerator.readFile("/stream", chunk.data(), chunk.size(), pos, &stream),
+                  static_cast<ssize_t>(chunk.size()));
+        result.insert(result.end(), chunk.begin(), chunk.end());
+        accelerator.waitForReadahead();
+    }
+    EXPECT_EQ(accelerator.cache().misses(), misses);
+    EXPECT_EQ(result, data);
+    EXPECT_GE(accelerator.readaheadBlocks(), file_size / 4096 - 16);
+}
+
+TEST(StorageAcceleratorPersistenceTest, RestartKeepsFilesAndData) {
+    std::string dir = "/tmp/test_persist_" + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+    PersistenceOptions persistence;
+    persistence.directory = dir;
+    persistence.drive_blocks = 1024;
+
+    std::vector<char> data(40000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i % 251);
+    }
+    size_t blocks = 0;
+    {
+        StorageAccelerator accelerator(4, "test_seed", BlockCacheOptions(), persistence);
+        ASSERT_EQ(accelerator.createFile("/a", 0644), 0);
+        ASSERT_EQ(accelerator.writeFile("/a", data.data(), data.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        ASSERT_EQ(accelerator.createDirectory("/d", 0755), 0);
+        ASSERT_EQ(accelerator.createFile("/d/x", 0644), 0);
+        ASSERT_EQ(accelerator.writeFile("/d/x", "hello", 5, 0), 5);
+        ASSERT_EQ(accelerator.chmodFile("/d/x", 0600), 0);
+        ASSERT_EQ(accelerator.createFile("/gone", 0644), 0);
+        ASSERT_EQ(accelerator.writeFile("/gone", data.data(), data.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        ASSERT_EQ(accelerator.deleteFile("/gone"), 0);
+        accelerator.waitForReclaim();
+        blocks = accelerator.blocksInUse();
+    }
+
+    {
+        // The drives in the directory win over the drive count asked for
+        StorageAccelerator accelerator(2, "test_seed", BlockCacheOptions(), persistence);
+        EXPECT_EQ(accelerator.activeDrives().size(), 4u);
+        EXPECT_EQ(accelerator.blocksInUse(), blocks);
+        EXPECT_EQ(accelerator.getMetadata("/gone"), nullptr);
+
+        auto metadata = accelerator.getMetadata("/a");
+        ASSERT_NE(metadata, nullptr);
+        EXPECT_EQ(metadata->size.load(), static_cast<off_t>(data.size()));
+        std::vector<char> buffer(data.size());
+        ASSERT_EQ(accelerator.readFile("/a", buffer.data(), buffer.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(buffer, data);
+
+        char small[5];
+        ASSERT_EQ(accelerator.readFile("/d/x", small, 5, 0), 5);
+        EXPECT_EQ(std::string(small, 5), "hello");
+        EXPECT_EQ(accelerator.getMetadata("/d/x")->mode & 07777, 0600u);
+
+        // New inodes do not collide with the restored ones
+        ASSERT_EQ(accelerator.createFile("/b", 0644), 0);
+        EXPECT_GT(accelerator.getMetadata("/b")->ino, accelerator.getMetadata("/d/x")->ino);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST(StorageAcceleratorThreadingTest, PinnedThreadsServeIOAndMigrations) {
+    ThreadingOptions threading;
+    threading.pool_threads = 2;
+    threading.pin_threads = true;
+    StorageAccelerator accelerator(3, "test_seed", BlockCacheOptions(), PersistenceOptions(),
+                                   threading);
+
+    std::vector<char> data(512 * 1024);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 13 + 1);
+    }
+    ASSERT_EQ(accelerator.createFile("/pinned", 0644), 0);
+    ASSERT_EQ(accelerator.writeFile("/pinned", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+
+    // Migrations of the removed drive's blocks are spread over the pool
+    ASSERT_EQ(accelerator.removeDrive(1), 0);
+    accelerator.waitForRebalance();
+    EXPECT_EQ(accelerator.blocksInUse(), data.size() / 4096);
+
+    std::vector<char> buffer(data.size());
+    ASSERT_EQ(accelerator.readFile("/pinned", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(buffer, data);
+}
+
+TEST(StorageAcceleratorDedupTest, IdenticalBlocksAreStoredOnce) {
+    DedupOptions dedup;
+    dedup.enabled = true;
+    StorageAccelerator accelerator(4, "test_seed", BlockCacheOptions(), PersistenceOptions(),
+                                   ThreadingOptions(), dedup);
+    const size_t block = 4096;
+
+    // 64 blocks cycling through 8 distinct ones, with a zero block between
+    std::vector<char> data(65 * block);
+    for (size_t i = 0; i < 64; i++) {
+        memset(data.data() + (i < 32 ? i : i + 1) * block, static_cast<char>(i % 8 + 1), block);
+    }
+    ASSERT_EQ(accelerator.createFile("/a", 0644), 0);
+    ASSERT_EQ(accelerator.createFile("/b", 0644), 0);
+    ASSERT_EQ(accelerator.writeFile("/a", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    ASSERT_EQ(accelerator.writeFile("/b", data.data(), data.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(accelerator.blocksInUse(), 8u);
+    EXPECT_EQ(accelerator.dedup().uniqueBlocks(), 8u);
+    EXPECT_EQ(accelerator.dedup().referencedBlocks(), 128u);
+
+    std::vector<char> buffer(data.size());
+    ASSERT_EQ(accelerator.readFile("/b", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(buffer, data);
+
+    // A partial overwrite gives /a a block of its own and leaves /b alone
+    ASSERT_EQ(accelerator.writeFile("/a", "xyz", 3, block + 100), 3);
+    memcpy(data.data() + block + 100, "xyz", 3);
+    ASSERT_EQ(accelerator.readFile("/a", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    EXPECT_EQ(buffer, data);
+    EXPECT_EQ(accelerator.blocksInUse(), 9u);
+    ASSERT_EQ(accelerator.readFile("/b", buffer.data(), block, block), static_cast<ssize_t>(block));
+    EXPECT_EQ(buffer[100], 2);
+
+    // Truncating mid-block stores the cut tail as a block of its own
+    ASSERT_EQ(accelerator.truncateFile("/a", 2 * block + 10), 0);
+    ASSERT_EQ(accelerator.truncateFile("/a", 3 * block), 0);
+    ASSERT_EQ(accelerator.readFile("/a", buffer.data(), 3 * block, 0),
+              static_cast<ssize_t>(3 * block));
+    EXPECT_EQ(buffer[2 * block + 9], 3);
+    EXPECT_EQ(buffer[2 * block + 10], 0);
+    EXPECT_EQ(accelerator.blocksInUse(), 10u);
+
+    // Stored blocks follow a drive that leaves
+    ASSERT_EQ(accelerator.removeDrive(2), 0);
+    accelerator.waitForRebalance();
+    ASSERT_EQ(accelerator.readFile("/b", buffer.data(), buffer.size(), 0),
+              static_cast<ssize_t>(data.size()));
+    memcpy(data.data() + block + 100, "\2\2\2", 3);
+    EXPECT_EQ(buffer, data);
+
+    // Blocks go once nothing points at them
+    ASSERT_EQ(accelerator.deleteFile("/a"), 0);
+    accelerator.waitForReclaim();
+    EXPECT_EQ(accelerator.blocksInUse(), 8u);
+    ASSERT_EQ(accelerator.deleteFile("/b"), 0);
+    accelerator.waitForReclaim();
+    EXPECT_EQ(accelerator.blocksInUse(), 0u);
+    EXPECT_EQ(accelerator.dedup().uniqueBlocks(), 0u);
+    EXPECT_GT(accelerator.dedupHits(), 0u);
+}
+
+TEST(StorageAcceleratorSmallFileTest, SmallFilesStayInlineUntilTheyGrow) {
+    std::string dir = "/tmp/test_inline_" + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+    PersistenceOptions persistence;
+    persistence.directory = dir;
+    persistence.drive_blocks = 64;
+    SmallFileOptions small_files;
+    small_files.inline_limit = 1024;
+
+    std::string expected(200, '\0');
+    memcpy(&expected[0], "hello", 5);
+    memcpy(&expected[100], "world", 5);
+    {
+        StorageAccelerator accelerator(4, "test_seed", BlockCacheOptions(), persistence,
+                                       ThreadingOptions(), DedupOptions(), small_files);
+        ASSERT_EQ(accelerator.createFile("/small", 0644), 0);
+        ASSERT_EQ(accelerator.writeFile("/small", "hello", 5, 0), 5);
+        ASSERT_EQ(accelerator.writeFile("/small", "world!", 6, 100), 6);
+        ASSERT_EQ(accelerator.truncateFile("/small", 105), 0);
+        ASSERT_EQ(accelerator.truncateFile("/small", 200), 0);
+        EXPECT_EQ(accelerator.blocksInUse(), 0u);
+
+        std::vector<char> buffer(300);
+        ASSERT_EQ(accelerator.readFile("/small", buffer.data(), buffer.size(), 0), 200);
+        EXPECT_EQ(std::string(buffer.data(), 200), expected);
+
+        // Outgrowing the limit moves the file to the drives
+        ASSERT_EQ(accelerator.createFile("/grows", 0644), 0);
+        ASSERT_EQ(accelerator.writeFile("/grows", "abc", 3, 0), 3);
+        std::vector<char> data(5000, 'x');
+        ASSERT_EQ(accelerator.writeFile("/grows", data.data(), data.size(), 3),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(accelerator.inlineSpills(), 1u);
+        EXPECT_EQ(accelerator.blocksInUse(), 2u);
+        buffer.resize(5003);
+        ASSERT_EQ(accelerator.readFile("/grows", buffer.data(), buffer.size(), 0), 5003);
+        EXPECT_EQ(std::string(buffer.data(), 3), "abc");
+        EXPECT_EQ(buffer[5002], 'x');
+        ASSERT_EQ(accelerator.truncateFile("/grows", 10), 0);
+        EXPECT_EQ(accelerator.readFile("/grows", buffer.data(), buffer.size(), 0), 10);
+    }
+
+    {
+        // Inline contents come back from the metadata log
+        StorageAccelerator accelerator(4, "test_seed", BlockCacheOptions(), persistence,
+                                       ThreadingOptions(), DedupOptions(), small_files);
+        std::vector<char> buffer(200);
+        ASSERT_EQ(accelerator.readFile("/small", buffer.data(), buffer.size(), 0), 200);
+        EXPECT_EQ(std::string(buffer.data(), 200), expected);
+        ASSERT_EQ(accelerator.readFile("/grows", buffer.data(), 10, 0), 10);
+        EXPECT_EQ(std::string(buffer.data(), 10), "abcxxxxxxx");
+        EXPECT_EQ(accelerator.blocksInUse(), 1u);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+namespace {
+
+// Write requests completed by all drives, from the exported metrics
+double driveWrites(StorageAccelerator& accelerator) {
+    PrometheusWriter writer;
+    accelerator.exportMetrics(writer);
+    double total = 0;
+    std::istringstream lines(writer.str());
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 25, "fuse_ssd_drive_ops_total{") == 0 &&
+            line.find("op=\"write\"") != std::string::npos) {
+            total += std::stod(line.substr(line.rfind(' ') + 1));
+        }
+    }
+    return total;
+}
+
+// Sum of one drive gauge over all drives, from the exported metrics
+double driveGauge(StorageAccelerator& accelerator, const std::string& name) {
+    PrometheusWriter writer;
+    accelerator.exportMetrics(writer);
+    double total = 0;
+    std::istringstream lines(writer.str());
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, name.size() + 1, name + "{") == 0) {
+            total += std::stod(line.substr(line.rfind(' ') + 1));
+        }
+    }
+    return total;
+}
+
+}  // namespace
+
+TEST(StorageAcceleratorTimeoutTest, TimedOutWavesLeaveNothingPending) {
+    AcceleratorConfig config;
+    config.num_drives = 2;
+    config.cache.capacity = 0;
+    config.drives.latency.write.base =
+        SSD_Simulator::IO_TIMEOUT + std::chrono::milliseconds(200);
+    StorageAccelerator accelerator(config);
+
+    std::vector<char> data(16 * 1024, 't');
+    ASSERT_EQ(accelerator.createFile("/slow", 0644), 0);
+    EXPECT_EQ(accelerator.writeFile("/slow", data.data(), data.size(), 0), -ETIMEDOUT);
+    EXPECT_EQ(driveGauge(accelerator, "fuse_ssd_drive_pending_operations"), 0);
+}
+
+TEST(StorageAcceleratorStripeTest, LargeUnitsTakeFewerDriveWrites) {
+    std::string dir = "/tmp/test_stripe_" + std::to_string(getpid());
+    std::filesystem::remove_all(dir);
+    AcceleratorConfig config;
+    config.num_drives = 4;
+    config.persistence.directory = dir;
+    config.persistence.drive_blocks = 1024;
+
+    std::vector<char> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<char>(i * 13 + i / 4096);
+    }
+    std::vector<char> patch(10000, 'p');
+    memcpy(&data[60000], patch.data(), patch.size());
+    {
+        StorageAccelerator accelerator(config);
+        ASSERT_EQ(accelerator.createDirectory("/big", 0755), 0);
+        ASSERT_EQ(accelerator.setStripeUnit("/big", 64 * 1024), 0);
+        ASSERT_EQ(accelerator.createDirectory("/big/sub", 0755), 0);
+        ASSERT_EQ(accelerator.createFile("/big/sub/f", 0644), 0);
+        ASSERT_EQ(accelerator.createFile("/small", 0644), 0);
+        size_t unit = 0;
+        ASSERT_EQ(accelerator.getStripeUnit("/big/sub/f", unit), 0);
+        EXPECT_EQ(unit, 64u * 1024);
+        ASSERT_EQ(accelerator.getStripeUnit("/small", unit), 0);
+        EXPECT_EQ(unit, SSD_Simulator::DEFAULT_BLOCK_SIZE);
+        EXPECT_EQ(accelerator.setStripeUnit("/big/sub/f", 1000), -EINVAL);
+        EXPECT_EQ(accelerator.setStripeUnit("/big/sub/f", 0), -EINVAL);
+        EXPECT_EQ(accelerator.setStripeUnit("/missing", 4096), -ENOENT);
+
+        // One request per unit instead of one per block
+        double before = driveWrites(accelerator);
+        ASSERT_EQ(accelerator.writeFile("/big/sub/f", data.data(), data.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(driveWrites(accelerator) - before, 16);
+        before = driveWrites(accelerator);
+        ASSERT_EQ(accelerator.writeFile("/small", data.data(), data.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(driveWrites(accelerator) - before, 256);
+        EXPECT_EQ(accelerator.setStripeUnit("/small", 64 * 1024), -EBUSY);
+
+        // A write across a unit boundary
+        ASSERT_EQ(accelerator.writeFile("/big/sub/f", patch.data(), patch.size(), 60000),
+                  static_cast<ssize_t>(patch.size()));
+        EXPECT_EQ(accelerator.blocksInUse(), 2 * data.size() / 4096);
+
+        // Whole units move when a drive leaves
+        ASSERT_EQ(accelerator.removeDrive(1), 0);
+        accelerator.waitForRebalance();
+        std::vector<char> buffer(data.size());
+        ASSERT_EQ(accelerator.readFile("/big/sub/f", buffer.data(), buffer.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(buffer, data);
+    }
+
+    {
+        // The unit comes back with the metadata, so the blocks are found again
+        StorageAccelerator accelerator(config);
+        size_t unit = 0;
+        ASSERT_EQ(accelerator.getStripeUnit("/big/sub/f", unit), 0);
+        EXPECT_EQ(unit, 64u * 1024);
+        std::vector<char> buffer(data.size());
+        ASSERT_EQ(accelerator.readFile("/big/sub/f", buffer.data(), buffer.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(buffer, data);
+        ASSERT_EQ(accelerator.createFile("/big/g", 0644), 0);
+        ASSERT_EQ(accelerator.getStripeUnit("/big/g", unit), 0);
+        EXPECT_EQ(unit, 64u * 1024);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST(StorageAcceleratorStripeTest, DriveGeometryIsConfigurable) {
+    AcceleratorConfig config;
+    config.num_drives = 2;
+    config.drives.block_size = 16 * 1024;
+    config.drives.channels = 2;
+    config.drives.queue_size = 8;
+    config.drives.latency = LatencyProfile::nvme();
+    config.stripe_unit = 32 * 1024;
+    {
+        StorageAccelerator accelerator(config);
+        EXPECT_EQ(accelerator.defaultStripeUnit(), 32u * 1024);
+        ASSERT_EQ(accelerator.createFile("/f", 0644), 0);
+        std::vector<char> data(100 * 1024, 'z');
+        ASSERT_EQ(accelerator.writeFile("/f", data.data(), data.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(accelerator.blocksInUse(), 7u);
+        std::vector<char> buffer(data.size());
+        ASSERT_EQ(accelerator.readFile("/f", buffer.data(), buffer.size(), 0),
+                  static_cast<ssize_t>(data.size()));
+        EXPECT_EQ(buffer, data);
+    }
+
+    config.drives.block_size = 3000;
+    EXPECT_THROW(StorageAccelerator accelerator(config), std::runtime_error);
+    config.drives.block_size = 0;
+    EXPECT_THROW(StorageAccelerator accelerator(config), std::runtime_error);
+    config.drives.block_size = 4096;
+    config.stripe_unit = 6000;
+    EXPECT_THROW(StorageAccelerator accelerator(config), std::runtime_error);
+    EXPECT_THROW(StorageAccelerator accelerator(0, "test_seed"), std::runtime_error);
+    EXPECT_THROW(StorageAccelerator accelerator(StorageAccelerator::MAX_DRIVES + 1, "test_seed"),
+                 std::runtime_error);
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "utils/thread_pool.h"
+#include "utils/cpu_topology.h"
+#include <sched.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+TEST(ThreadPoolTest, RunsEveryTaskAndReturnsResults) {
+    ThreadPool pool(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 1000; i++) {
+        results.push_back(pool.enqueue([](int x) { return x * 2; }, i));
+    }
+    long sum = 0;
+    for (auto& result : results) {
+        sum += result.get();
+    }
+    EXPECT_EQ(sum, 999L * 1000);
+}
+
+TEST(ThreadPoolTest, IdleWorkersStealFromABusyOne) {
+    ThreadPool pool(4);
+    const int subtasks = 64;
+    std::atomic<int> done{0};
+
+    // The subtasks land on the busy worker's own queue; only thieves can run them
+    auto busy = pool.enqueue([&]() {
+        for (int i = 0; i < subtasks; i++) {
+            pool.enqueue([&done]() { done++; });
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (done < subtasks && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    busy.get();
+    EXPECT_EQ(done.load(), subtasks);
+    EXPECT_GE(pool.steals(), static_cast<uint64_t>(subtasks));
+}
+
+TEST(ThreadPoolTest, DestructionRunsQueuedTasks) {
+    std::atomic<int> done{0};
+    {
+        ThreadPool pool(1);
+        for (int i = 0; i < 100; i++) {
+            pool.enqueue([&done]() {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                done++;
+            });
+        }
+    }
+    EXPECT_EQ(done.load(), 100);
+}
+
+TEST(CpuTopologyTest, ParsesCpuLists) {
+    EXPECT_EQ(CpuTopology::parseCpuList("0-3,8,10-11\n"),
+              (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(CpuTopology::parseCpuList("5"), std::vector<int>{5});
+    EXPECT_TRUE(CpuTopology::parseCpuList("").empty());
+    EXPECT_TRUE(CpuTopology::parseCpuList("3-1").empty());
+    EXPECT_TRUE(CpuTopology::parseCpuList("1,x").empty());
+
+    CpuTopology topology({{0, 1}, {2, 3}});
+    EXPECT_EQ(topology.nodeOfDrive(5), 1u);
+    auto sets = topology.spread(3);
+    ASSERT_EQ(sets.size(), 3u);
+    EXPECT_EQ(sets[2], (std::vector<int>{0, 1}));
+}
+
+TEST(CpuTopologyTest, PinnedWorkersRunOnTheirCpu) {
+    CpuTopology topology = CpuTopology::detect();
+    ASSERT_GE(topology.nodeCount(), 1u);
+    ASSERT_FALSE(topology.nodeCpus(0).empty());
+    int cpu = topology.nodeCpus(topology.nodeCount() - 1).back();
+
+    ThreadPool pool(2, {{cpu}});
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(pool.enqueue([]() { return sched_getcpu(); }).get(), cpu);
+    }
+}
@@ -0,0 +1,51 @@
+#define FUSE_SSD_TRACING
+#include <gtest/gtest.h>
+#include "utils/trace.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+static size_t countOccurrences(const std::string& text, const std::string& needle) {
+    size_t count = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + 1)) {
+        count++;
+    }
+    return count;
+}
+
+TEST(TraceTest, SpansFromAllThreadsAreDumpedAsChromeTrace) {
+    size_t before = Tracer::recorded();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([]() {
+            for (int i = 0; i < 100; i++) {
+                TRACE_SCOPE_ARG("test", "trace_test_scope", i);
+            }
+            TRACE_NOW(start);
+            TRACE_NOW(end);
+            TRACE_SPAN("test", "trace_test_span", start, end, 7);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(Tracer::recorded() - before, 4u * 101);
+
+    // Spans of threads that have already exited are still dumped
+    std::string trace_file = "/tmp/test_trace_" + std::to_string(getpid()) + ".json";
+    ASSERT_TRUE(Tracer::dump(trace_file));
+    std::ifstream in(trace_file);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string trace = text.str();
+
+    EXPECT_EQ(trace.compare(0, 15, "{\"traceEvents\":"), 0);
+    EXPECT_EQ(countOccurrences(trace, "\"name\":\"trace_test_scope\""), 400u);
+    EXPECT_EQ(countOccurrences(trace, "\"name\":\"trace_test_span\",\"cat\":\"test\",\"ph\":\"X\""), 4u);
+    EXPECT_NE(trace.find("\"otherData\":{\"dropped\":0}"), std::string::npos);
+    unlink(trace_file.c_str());
+}